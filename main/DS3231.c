@@ -33,6 +33,7 @@
 #include "driver/gpio.h"
 #include "DS3231.h"
 #include "adc_read.h"
+#include "esp_attr.h"
 
 static const char *TAG = "DS3231";
 
@@ -164,47 +165,173 @@ esp_err_t ds3231_read_register(uint8_t reg_addr, uint8_t *data)
     return ret;
 }
 
-/* Function to get time and date from DS3231 */
-ds3231_datetime_t ds3231_get_datetime()
+/* Function to read consecutive registers from DS3231 in one transaction */
+esp_err_t ds3231_read_registers(uint8_t reg_addr, uint8_t *data, size_t len)
 {
-    ds3231_datetime_t datetime = {0};
-    esp_err_t ret;
-    uint8_t temp;
+    if (ds3231_handle == NULL)
+    {
+        ESP_LOGE(TAG, "DS3231 device not initialized!");
+        return ESP_FAIL;
+    }
 
-    ret = ds3231_read_register(DS3231_REG_SECONDS, &temp);
+    // Repeated start: write the register pointer, then read len bytes while
+    // the DS3231 auto-increments it
+    esp_err_t ret = i2c_master_transmit_receive(ds3231_handle, &reg_addr, 1, data, len, DS3231_I2C_TIMEOUT_MS);
     if (ret != ESP_OK)
-        return datetime;
-    datetime.seconds = temp;
+    {
+        ESP_LOGE(TAG, "Failed to read registers 0x%02x+%u: %s", reg_addr, (unsigned)len, esp_err_to_name(ret));
+    }
 
-    ret = ds3231_read_register(DS3231_REG_MINUTES, &temp);
-    if (ret != ESP_OK)
-        return datetime;
-    datetime.minutes = temp;
+    return ret;
+}
 
-    ret = ds3231_read_register(DS3231_REG_HOURS, &temp);
+/* Function to read date, time and optionally temperature in one burst */
+esp_err_t ds3231_read_snapshot(ds3231_snapshot_t *snapshot, bool with_temp)
+{
+    // Registers 0x00 to 0x12 cover the clock (0x00-0x06) and the temperature (0x11-0x12)
+    uint8_t regs[DS3231_REG_TEMP_LSB + 1];
+    size_t len = with_temp ? sizeof(regs) : sizeof(ds3231_datetime_t);
+
+    esp_err_t ret = ds3231_read_registers(DS3231_REG_SECONDS, regs, len);
     if (ret != ESP_OK)
-        return datetime;
-    datetime.hours = temp;
+        return ret;
 
-    ret = ds3231_read_register(DS3231_REG_DAY, &temp);
+    memcpy(&snapshot->datetime, regs, sizeof(ds3231_datetime_t));
+    snapshot->has_temp = with_temp;
+    if (with_temp)
+    {
+        // Signed whole degrees in the MSB, quarter degrees in bits 7:6 of the LSB
+        snapshot->temp_quarter_c = (int16_t)(((int8_t)regs[DS3231_REG_TEMP_MSB] * 4) | (regs[DS3231_REG_TEMP_LSB] >> 6));
+    }
+
+    return ESP_OK;
+}
+
+/* Convert DS3231 registers to seconds since 1970-01-01, the clock holds UTC */
+time_t ds3231_datetime_to_epoch(const ds3231_datetime_t *datetime)
+{
+    int year = 2000 + bcd_to_dec(datetime->year) + ((datetime->month & 0x80) ? 100 : 0);
+    int month = bcd_to_dec(datetime->month & 0x1F);
+    int day = bcd_to_dec(datetime->date & 0x3F);
+    int hour;
+
+    if (datetime->hours & 0x40)
+    {
+        // 12 hour mode, bit 5 is PM
+        hour = bcd_to_dec(datetime->hours & 0x1F) % 12 + ((datetime->hours & 0x20) ? 12 : 0);
+    }
+    else
+    {
+        hour = bcd_to_dec(datetime->hours & 0x3F);
+    }
+
+    // Days from civil date, counting years from March so February ends the year
+    int y = year - (month <= 2);
+    int era = y / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = (int64_t)era * 146097 + doe - 719468;
+
+    return (time_t)(days * 86400 + hour * 3600 +
+                    bcd_to_dec(datetime->minutes & 0x7F) * 60 +
+                    bcd_to_dec(datetime->seconds & 0x7F));
+}
+
+/* Function to write consecutive registers to DS3231 in one transaction */
+esp_err_t ds3231_write_registers(uint8_t reg_addr, const uint8_t *data, size_t len)
+{
+    uint8_t buf[1 + DS3231_REG_TEMP_LSB + 1];
+
+    if (ds3231_handle == NULL)
+    {
+        ESP_LOGE(TAG, "DS3231 device not initialized!");
+        return ESP_FAIL;
+    }
+    if (len > sizeof(buf) - 1)
+        return ESP_ERR_INVALID_SIZE;
+
+    buf[0] = reg_addr;
+    memcpy(&buf[1], data, len);
+    esp_err_t ret = i2c_master_transmit(ds3231_handle, buf, len + 1, DS3231_I2C_TIMEOUT_MS);
     if (ret != ESP_OK)
-        return datetime;
-    datetime.day = temp;
+    {
+        ESP_LOGE(TAG, "Failed to write registers 0x%02x+%u: %s", reg_addr, (unsigned)len, esp_err_to_name(ret));
+    }
 
-    ret = ds3231_read_register(DS3231_REG_DATE, &temp);
+    return ret;
+}
+
+/* Next multiple of period_s at least guard_s after now, so the alarm cannot
+ * pass before the ESP is asleep */
+time_t ds3231_next_aligned(time_t now, uint32_t period_s, uint32_t guard_s)
+{
+    time_t next = (now / period_s + 1) * period_s;
+    while (next - now < (time_t)guard_s)
+        next += period_s;
+    return next;
+}
+
+/* Program Alarm 1 to match hours, minutes and seconds of when (UTC) and
+ * route it to INT/SQW. Clears a pending alarm so the line is released. */
+esp_err_t ds3231_set_alarm1(time_t when)
+{
+    struct tm tm_when;
+    gmtime_r(&when, &tm_when);
+
+    // A1M4 set: the day/date field is ignored, the alarm fires once per day
+    // at this time, well beyond any period we program
+    uint8_t alarm[4] = {
+        dec_to_bcd(tm_when.tm_sec),
+        dec_to_bcd(tm_when.tm_min),
+        dec_to_bcd(tm_when.tm_hour),
+        DS3231_ALARM_MASK,
+    };
+    esp_err_t ret = ds3231_write_registers(DS3231_REG_ALARM1_SECONDS, alarm, sizeof(alarm));
     if (ret != ESP_OK)
-        return datetime;
-    datetime.date = temp;
+        return ret;
 
-    ret = ds3231_read_register(DS3231_REG_MONTH, &temp);
+    uint8_t control;
+    ret = ds3231_read_registers(DS3231_REG_CONTROL, &control, 1);
     if (ret != ESP_OK)
-        return datetime;
-    datetime.month = temp;
+        return ret;
+    if ((control & (DS3231_CONTROL_INTCN | DS3231_CONTROL_A1IE)) != (DS3231_CONTROL_INTCN | DS3231_CONTROL_A1IE))
+    {
+        control |= DS3231_CONTROL_INTCN | DS3231_CONTROL_A1IE;
+        ret = ds3231_write_registers(DS3231_REG_CONTROL, &control, 1);
+        if (ret != ESP_OK)
+            return ret;
+    }
 
-    ret = ds3231_read_register(DS3231_REG_YEAR, &temp);
+    ret = ds3231_clear_alarm1();
+    if (ret == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Alarm 1 set for %02d:%02d:%02d", tm_when.tm_hour, tm_when.tm_min, tm_when.tm_sec);
+    }
+    return ret;
+}
+
+/* Clear the Alarm 1 flag, which releases INT/SQW */
+esp_err_t ds3231_clear_alarm1(void)
+{
+    uint8_t status;
+    esp_err_t ret = ds3231_read_registers(DS3231_REG_STATUS, &status, 1);
     if (ret != ESP_OK)
-        return datetime;
-    datetime.year = temp;
+        return ret;
+    if (!(status & DS3231_STATUS_A1F))
+        return ESP_OK;
+
+    status &= ~DS3231_STATUS_A1F;
+    return ds3231_write_registers(DS3231_REG_STATUS, &status, 1);
+}
+
+/* Function to get time and date from DS3231 */
+ds3231_datetime_t ds3231_get_datetime()
+{
+    ds3231_datetime_t datetime = {0};
+
+    if (ds3231_read_registers(DS3231_REG_SECONDS, (uint8_t *)&datetime, sizeof(datetime)) != ESP_OK)
+        return (ds3231_datetime_t){0};
 
     ESP_LOGI(TAG, "Date: %02d/%02d/20%02d | Day: %d | Time: %02d:%02d:%02d",
              bcd_to_dec(datetime.date), bcd_to_dec(datetime.month), bcd_to_dec(datetime.year),
@@ -217,26 +344,14 @@ ds3231_datetime_t ds3231_get_datetime()
 ds3231_time_t ds3231_get_time()
 {
     ds3231_time_t time = {0};
-    esp_err_t ret;
-    uint8_t temp;
+    uint8_t regs[3];
 
-    // Read seconds
-    ret = ds3231_read_register(DS3231_REG_SECONDS, &temp);
-    if (ret != ESP_OK)
+    // Seconds, minutes and hours in one read, so they cannot tear across a rollover
+    if (ds3231_read_registers(DS3231_REG_SECONDS, regs, sizeof(regs)) != ESP_OK)
         return time;
-    time.seconds = temp;
-
-    // Read minutes
-    ret = ds3231_read_register(DS3231_REG_MINUTES, &temp);
-    if (ret != ESP_OK)
-        return time;
-    time.minutes = temp;
-
-    // Read hours
-    ret = ds3231_read_register(DS3231_REG_HOURS, &temp);
-    if (ret != ESP_OK)
-        return time;
-    time.hours = temp;
+    time.seconds = regs[0];
+    time.minutes = regs[1];
+    time.hours = regs[2];
 
     ESP_LOGI(TAG, "Time: %02d:%02d:%02d",
              bcd_to_dec(time.hours), bcd_to_dec(time.minutes), bcd_to_dec(time.seconds));
@@ -244,27 +359,80 @@ ds3231_time_t ds3231_get_time()
     return time;
 }
 
-void get_file_path(char *output_path)
+/* Last resolved day file, so directories are created once per month and
+ * the path once per day instead of on every record */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t card_serial;   /*!< Card the directories were created on */
+    int year;
+    int month;
+    int day;
+    bool dirs_exist;
+    char path[FILE_PATH_MAX];
+} file_path_cache_t;
+
+#define FILE_PATH_CACHE_MAGIC 0x50415448u
+
+static RTC_DATA_ATTR file_path_cache_t path_cache;
+
+/* Create one directory, true if it exists afterwards */
+static bool make_dir(const char *path)
 {
-    const char *machine_id = "m-2003";
+    if (mkdir(path, 0777) != 0)
+    {
+        if (errno == EEXIST)
+        {
+            ESP_LOGI(TAG, "Directory already exists: %s", path);
+            return true;
+        }
+        ESP_LOGE(TAG, "Failed to create directory: %s", path);
+        return false;
+    }
+    ESP_LOGI(TAG, "Directory created: %s", path);
+    return true;
+}
+
+void get_file_path_set_card(uint32_t card_serial)
+{
+    if (path_cache.magic != FILE_PATH_CACHE_MAGIC || path_cache.card_serial != card_serial)
+    {
+        // Another card, or first use: nothing is known to exist on it
+        memset(&path_cache, 0, sizeof(path_cache));
+        path_cache.magic = FILE_PATH_CACHE_MAGIC;
+        path_cache.card_serial = card_serial;
+    }
+}
+
+void get_file_path_invalidate(void)
+{
+    path_cache.magic = 0;
+}
+
+esp_err_t get_file_path(char *output_path, size_t size, const struct tm *date)
+{
+    const char *machine_id = LOG_MACHINE_ID;
     const char *base_path = "/sdcard";
-    struct tm date_obj = {0};
     char month[4];
 
-    // Get datetime from DS3231
-    ds3231_datetime_t datetime = ds3231_get_datetime();
+    int day = date->tm_mday;
+    int month_num = date->tm_mon + 1;
+    int year = date->tm_year + 1900;
 
-    // Convert BCD values to decimal
-    int day = bcd_to_dec(datetime.date);
-    int month_num = bcd_to_dec(datetime.month);
-    int year = 2000 + bcd_to_dec(datetime.year);
-
-    date_obj.tm_mday = day;
-    date_obj.tm_mon = month_num - 1;
-    date_obj.tm_year = year - 1900;
+    bool cached = path_cache.magic == FILE_PATH_CACHE_MAGIC;
+    if (cached && path_cache.dirs_exist && path_cache.year == year &&
+        path_cache.month == month_num && path_cache.day == day)
+    {
+        if (strlen(path_cache.path) >= size)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        strcpy(output_path, path_cache.path);
+        return ESP_OK;
+    }
 
     // Convert month number to name
-    strftime(month, sizeof(month), "%b", &date_obj);
+    strftime(month, sizeof(month), "%b", date);
 
     // Convert month name to lowercase manually
     for (char *p = month; *p; p++)
@@ -275,79 +443,42 @@ void get_file_path(char *output_path)
         }
     }
 
-    // Construct file path
-    // sprintf(output_path, "%s/%s/%d/%s/%02d-%02d-%02d.csv",
-    //         base_path, machine_id, year, month, day, month_num, year % 100);
-   
-    char dir_machine_id[32];
-    sprintf(dir_machine_id, "%s/%s",
+    // The month directory only changes with the month, skip the directory
+    // scans if it was already created on this card
+    if (!(cached && path_cache.dirs_exist && path_cache.year == year && path_cache.month == month_num))
+    {
+        char dir_machine_id[FILE_PATH_MAX];
+        snprintf(dir_machine_id, sizeof(dir_machine_id), "%s/%s",
                  base_path, machine_id);
-    
-    char dir_year[32];
-    sprintf(dir_year, "%s/%s/%d",
+
+        char dir_year[FILE_PATH_MAX];
+        snprintf(dir_year, sizeof(dir_year), "%s/%s/%d",
                  base_path, machine_id, year);
-        
-    char dir_months[32];
-    sprintf(dir_months, "%s/%s/%d/%s",
-                 base_path, machine_id, year, month);
 
-    
-    
-    
-    
-    
+        char dir_months[FILE_PATH_MAX];
+        snprintf(dir_months, sizeof(dir_months), "%s/%s/%d/%s",
+                 base_path, machine_id, year, month);
 
-    // Create the directory
-    if (mkdir(dir_machine_id, 0777) != 0)
-    {
-        if (errno == EEXIST)
-        {
-            ESP_LOGI(TAG, "Directory already exists: %s", dir_machine_id);
-        }
-        else
-        {
-            ESP_LOGE(TAG, "Failed to create directory: %s", dir_machine_id);
-        }
-    }
-    else
-    {
-        ESP_LOGI(TAG, "Directory created: %s", dir_machine_id);
+        bool dirs_exist = make_dir(dir_machine_id) && make_dir(dir_year) && make_dir(dir_months);
+        path_cache.dirs_exist = dirs_exist && cached;
     }
 
-    if (mkdir(dir_year, 0777) != 0)
-    {
-        if (errno == EEXIST)
-        {
-            ESP_LOGI(TAG, "Directory already exists: %s", dir_year);
-        }
-        else
-        {
-            ESP_LOGE(TAG, "Failed to create directory: %s", dir_year);
-        }
-    }
-    else
+    int len = snprintf(output_path, size, "%s/%s/%d/%s/%02d-%02d-%02d.csv",
+                       base_path, machine_id, year, month, day, month_num, year % 100);
+    if (len < 0 || (size_t)len >= size || (size_t)len >= sizeof(path_cache.path))
     {
-        ESP_LOGI(TAG, "Directory created: %s", dir_year);
+        ESP_LOGE(TAG, "Day file path does not fit in %u bytes", (unsigned)size);
+        return ESP_ERR_INVALID_SIZE;
     }
 
-    if (mkdir(dir_months, 0777) != 0)
+    if (cached)
     {
-        if (errno == EEXIST)
-        {
-            ESP_LOGI(TAG, "Directory already exists: %s", dir_months);
-        }
-        else
-        {
-            ESP_LOGE(TAG, "Failed to create directory: %s", dir_months);
-        }
-    }
-    else
-    {
-        ESP_LOGI(TAG, "Directory created: %s", dir_months);
+        path_cache.year = year;
+        path_cache.month = month_num;
+        path_cache.day = day;
+        strcpy(path_cache.path, output_path);
     }
-
-    sprintf(output_path, "%s/%s/%d/%s/%02d-%02d-%02d.csv",
-                base_path, machine_id, year, month, day, month_num, year % 100);
+    return ESP_OK;
 }
 
 void delete_file(const char *file_path)
@@ -2,6 +2,9 @@
 #define DS3231_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
 #include "esp_err.h"
 
 /* I2C Configuration */
@@ -10,6 +13,16 @@
 #define I2C_MASTER_NUM 0          /*!< I2C port number */
 #define I2C_MASTER_FREQ_HZ 400000 /*!< I2C clock frequency */
 #define DS3231_ADDR 0x68          /*!< I2C address of DS3231 */
+#define DS3231_I2C_TIMEOUT_MS 100 /*!< Timeout of one I2C transaction */
+
+/* Alarm wake configuration */
+#define DS3231_ALARM_WAKE_ENABLE 0  /*!< Set to 1 to wake on the DS3231 alarm instead of the ESP timer */
+#define DS3231_ALARM_PERIOD_S 30    /*!< Samples land on multiples of this, e.g. :00 and :30 */
+#define DS3231_ALARM_GUARD_S 2      /*!< Minimum lead time when programming the next alarm */
+#define DS3231_INT_GPIO 6           /*!< RTC GPIO wired to INT/SQW, active low open drain */
+
+/* Log file naming */
+#define LOG_MACHINE_ID "m-2003"     /*!< Top directory on the card, also stored in binary file headers */
 
 /* DS3231 Register Addresses */
 #define DS3231_REG_SECONDS 0x00
@@ -19,9 +32,25 @@
 #define DS3231_REG_DATE 0x04
 #define DS3231_REG_MONTH 0x05
 #define DS3231_REG_YEAR 0x06
+#define DS3231_REG_ALARM1_SECONDS 0x07
+#define DS3231_REG_ALARM1_MINUTES 0x08
+#define DS3231_REG_ALARM1_HOURS 0x09
+#define DS3231_REG_ALARM1_DAY 0x0A
+#define DS3231_REG_CONTROL 0x0E
+#define DS3231_REG_STATUS 0x0F
+#define DS3231_REG_TEMP_MSB 0x11
+#define DS3231_REG_TEMP_LSB 0x12
 
-/* Data structure to store DS3231 Date and Time */
-typedef struct
+/* Control and status bits */
+#define DS3231_ALARM_MASK 0x80      /*!< AxMy bit, set to ignore that field */
+#define DS3231_CONTROL_A1IE 0x01
+#define DS3231_CONTROL_INTCN 0x04
+#define DS3231_STATUS_A1F 0x01
+
+/* Data structure to store DS3231 Date and Time
+ * Raw BCD registers 0x00-0x06 in register order, so a burst read lands
+ * directly in it. */
+typedef struct __attribute__((packed))
 {
     uint8_t seconds;
     uint8_t minutes;
@@ -37,13 +66,35 @@ typedef struct {
     uint8_t minutes;
     uint8_t seconds;
 } ds3231_time_t;
+
+/* Coherent copy of the clock, and optionally the temperature, from one burst */
+typedef struct
+{
+    ds3231_datetime_t datetime;
+    int16_t temp_quarter_c;   /*!< Temperature in 0.25 degC steps, valid if has_temp */
+    bool has_temp;
+} ds3231_snapshot_t;
+
 /* Function prototypes */
 esp_err_t i2c_master_init(void);
 esp_err_t ds3231_read_register(uint8_t reg_addr, uint8_t *data);
 ds3231_datetime_t ds3231_get_datetime(void);
 ds3231_time_t ds3231_get_time(void);
+esp_err_t ds3231_read_registers(uint8_t reg_addr, uint8_t *data, size_t len);
+esp_err_t ds3231_read_snapshot(ds3231_snapshot_t *snapshot, bool with_temp);
+time_t ds3231_datetime_to_epoch(const ds3231_datetime_t *datetime);
+esp_err_t ds3231_write_registers(uint8_t reg_addr, const uint8_t *data, size_t len);
+time_t ds3231_next_aligned(time_t now, uint32_t period_s, uint32_t guard_s);
+esp_err_t ds3231_set_alarm1(time_t when);
+esp_err_t ds3231_clear_alarm1(void);
 uint8_t bcd_to_dec(uint8_t val);
 uint8_t dec_to_bcd(uint8_t val);
-void get_file_path(char *output_path);
+/* Longest day file path, with room to spare over
+ * "/sdcard/<machine id>/<yyyy>/<mon>/<dd-mm-yy>.csv" */
+#define FILE_PATH_MAX 48
+
+esp_err_t get_file_path(char *output_path, size_t size, const struct tm *date);
+void get_file_path_set_card(uint32_t card_serial);
+void get_file_path_invalidate(void);
 void delete_file(const char *file_path);
 #endif /* DS3231_H */
@@ -1,47 +1,488 @@
 #include <string.h>
-#include <sys/unistd.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include "esp_vfs_fat.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_rom_sys.h"
+#include "driver/gpio.h"
 #include "sdmmc_cmd.h"
-#include "sd_test_io.h"
+#include "sdmmc_defs.h"
+#include "driver/sdspi_host.h"
+#include "ff.h"
+#include "diskio_impl.h"
+#include "diskio_sdmmc.h"
+#include "SD.h"
+#include "sd_clock.h"
+#include "sd_io.h"
 #if SOC_SDMMC_IO_POWER_EXTERNAL
 #include "sd_pwr_ctrl_by_on_chip_ldo.h"
 #endif
 
 static const char *TAG = "SD_CARD";
-static esp_err_t s_example_write_file(const char *path, char *data)
+
+static sdmmc_card_t *s_card;
+static sdmmc_card_t s_card_storage;
+static spi_host_device_t s_bus;
+static BYTE s_pdrv = FF_DRV_NOT_USED;
+#if SD_POWER_GATE_ENABLE
+static bool s_powered;
+static int64_t s_power_on_us;
+#endif
+
+// Card as the last full probe left it, so a wake from deep sleep can skip
+// the probe while the card stays powered and in SPI mode
+typedef struct
 {
-    ESP_LOGI(TAG, "Opening file %s", path);
-    FILE *f = fopen(path, "w");
-    if (f == NULL) {
-        ESP_LOGE(TAG, "Failed to open file for writing");
-        return ESP_FAIL;
+    uint32_t magic;
+    uint8_t cid[16];            // Raw CMD10 response the card is checked against
+    sdmmc_card_t card;          // CID, CSD, SCR, OCR and the negotiated clock
+} sd_card_cache_t;
+
+#define SD_CARD_CACHE_MAGIC 0x53444331
+
+static RTC_DATA_ATTR sd_card_cache_t s_cache;
+static DMA_ATTR uint8_t s_cid_buf[16];
+
+/* Raw CID register via CMD10, one command and a 16 byte data block */
+static esp_err_t sd_card_read_cid(sdmmc_card_t *card, uint8_t *cid)
+{
+    sdmmc_command_t cmd = {
+        .opcode = MMC_SEND_CID,
+        .flags = SCF_CMD_READ | SCF_CMD_ADTC | SCF_RSP_R1,
+        .data = s_cid_buf,
+        .datalen = sizeof(s_cid_buf),
+        .blklen = sizeof(s_cid_buf),
+    };
+    esp_err_t ret = card->host.do_transaction(card->host.slot, &cmd);
+    if (ret == ESP_OK)
+        ret = cmd.error;
+    if (ret == ESP_OK)
+        memcpy(cid, s_cid_buf, sizeof(s_cid_buf));
+    return ret;
+}
+
+/**
+ * @brief Take the card over from the cache instead of probing it
+ *
+ * Runs at the cached clock from the start, skipping the 400 kHz
+ * identification, and only checks that the same card answers CMD10.
+ */
+static esp_err_t sd_card_resume(const sdmmc_host_t *host, sdmmc_card_t *card)
+{
+    uint8_t cid[16];
+
+    if (s_cache.magic != SD_CARD_CACHE_MAGIC)
+        return ESP_ERR_NOT_FOUND;
+
+    *card = s_cache.card;
+    card->host = *host;
+    esp_err_t ret = host->set_card_clk(host->slot, card->max_freq_khz);
+    if (ret == ESP_OK)
+        ret = sd_card_read_cid(card, cid);
+    if (ret == ESP_OK && memcmp(cid, s_cache.cid, sizeof(cid)) != 0)
+        ret = ESP_ERR_INVALID_RESPONSE;
+    if (ret == ESP_OK)
+    {
+        // The card kept CRC checking on, the new host device has to know
+        sdmmc_command_t cmd = {
+            .opcode = SD_CRC_ON_OFF,
+            .arg = 1,
+            .flags = SCF_RSP_R1,
+        };
+        ret = host->do_transaction(host->slot, &cmd);
+        if (ret == ESP_OK)
+            ret = cmd.error;
     }
-    fprintf(f, data);
-    fclose(f);
-    ESP_LOGI(TAG, "File written");
+    return ret;
+}
+
+/* Full identification, remembered for the next wake */
+static esp_err_t sd_card_probe(const sdmmc_host_t *host, sdmmc_card_t *card)
+{
+    s_cache.magic = 0;
+    // A failed resume may have left the cached clock set
+    esp_err_t ret = host->set_card_clk(host->slot, SDMMC_FREQ_PROBING);
+    if (ret == ESP_OK)
+        ret = sdmmc_card_init(host, card);
+    if (ret != ESP_OK)
+        return ret;
 
+    if (sd_card_read_cid(card, s_cache.cid) == ESP_OK)
+    {
+        s_cache.card = *card;
+        s_cache.magic = SD_CARD_CACHE_MAGIC;
+    }
     return ESP_OK;
 }
 
-static esp_err_t s_example_read_file(const char *path)
+#ifdef CONFIG_EXAMPLE_FORMAT_IF_MOUNT_FAILED
+/* Partition the card as one volume and format it, as esp_vfs_fat_sdspi_mount() would */
+static FRESULT sd_card_format(BYTE pdrv, const char *drv, sdmmc_card_t *card)
 {
-    ESP_LOGI(TAG, "Reading file %s", path);
-    FILE *f = fopen(path, "r");
-    if (f == NULL) {
-        ESP_LOGE(TAG, "Failed to open file for reading");
+    const size_t workbuf_size = 4096;
+    void *workbuf = malloc(workbuf_size);
+    if (workbuf == NULL)
+        return FR_NOT_ENOUGH_CORE;
+
+    ESP_LOGW(TAG, "Partitioning and formatting the card");
+    LBA_t plist[] = {100, 0, 0, 0};
+    FRESULT res = f_fdisk(pdrv, plist, workbuf);
+    if (res == FR_OK)
+    {
+        size_t alloc_unit_size = esp_vfs_fat_get_allocation_unit_size(card->csd.sector_size,
+                                                                      SD_ALLOCATION_UNIT_SIZE);
+        const MKFS_PARM opt = {(BYTE)FM_ANY, 0, 0, 0, alloc_unit_size};
+        res = f_mkfs(drv, &opt, workbuf, workbuf_size);
+    }
+    free(workbuf);
+    return res;
+}
+#endif // CONFIG_EXAMPLE_FORMAT_IF_MOUNT_FAILED
+
+/* Register the card with FatFs and the VFS and mount the volume */
+static esp_err_t sd_card_mount_fat(sdmmc_card_t *card)
+{
+    BYTE pdrv = FF_DRV_NOT_USED;
+    FATFS *fs = NULL;
+
+    if (ff_diskio_get_drive(&pdrv) != ESP_OK || pdrv == FF_DRV_NOT_USED)
+    {
+        ESP_LOGE(TAG, "The maximum count of volumes is already mounted");
+        return ESP_ERR_NO_MEM;
+    }
+    char drv[3] = {(char)('0' + pdrv), ':', 0};
+    sd_io_register(pdrv, card);
+
+    const esp_vfs_fat_conf_t conf = {
+        .base_path = MOUNT_POINT,
+        .fat_drive = drv,
+        .max_files = 5,
+    };
+    esp_err_t ret = esp_vfs_fat_register_cfg(&conf, &fs);
+    if (ret != ESP_OK)
+    {
+        ff_diskio_unregister(pdrv);
+        return ret;
+    }
+    FRESULT res = f_mount(fs, drv, 1);
+#ifdef CONFIG_EXAMPLE_FORMAT_IF_MOUNT_FAILED
+    // Same conditions as esp_vfs_fat_sdspi_mount() with format_if_mount_failed
+    if (res == FR_NO_FILESYSTEM || res == FR_INT_ERR)
+    {
+        res = sd_card_format(pdrv, drv, card);
+        if (res == FR_OK)
+            res = f_mount(fs, drv, 1);
+    }
+#endif
+    if (res != FR_OK)
+    {
+        ESP_LOGE(TAG, "Failed to mount filesystem (%d).", res);
+        esp_vfs_fat_unregister_path(MOUNT_POINT);
+        ff_diskio_unregister(pdrv);
         return ESP_FAIL;
     }
-    char line[EXAMPLE_MAX_CHAR_SIZE];
-    fgets(line, sizeof(line), f);
-    fclose(f);
+    s_pdrv = pdrv;
+    return ESP_OK;
+}
 
-    // strip newline
-    char *pos = strchr(line, '\n');
-    if (pos) {
-        *pos = '\0';
+esp_err_t sd_card_mount(sdmmc_card_t **out_card)
+{
+    esp_err_t ret;
+
+    if (s_card)
+    {
+        if (out_card)
+            *out_card = s_card;
+        return ESP_OK;
     }
-    ESP_LOGI(TAG, "Read from file: '%s'", line);
 
+    ESP_LOGI(TAG, "Initializing SD card");
+#if SD_POWER_GATE_ENABLE
+    sd_card_power_on();
+    int64_t ramp_left = s_power_on_us + SD_PWR_RAMP_US - esp_timer_get_time();
+    if (ramp_left > 0)
+        esp_rom_delay_us((uint32_t)ramp_left);
+#endif
+
+    // Bus, host device, card and volume come up one by one, rather than
+    // through esp_vfs_fat_sdspi_mount(), so a known card can skip its probe
+    int64_t t_start = esp_timer_get_time();
+
+    // By default, SD card frequency is initialized to SDMMC_FREQ_DEFAULT (20MHz)
+    // For setting a specific frequency, use host.max_freq_khz (range 400kHz - 20MHz for SDSPI)
+    // Example: for fixed frequency of 10MHz, use host.max_freq_khz = 10000;
+    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+
+    // For SoCs where the SD power can be supplied both via an internal or external (e.g. on-board LDO) power supply.
+    // When using specific IO pins (which can be used for ultra high-speed SDMMC) to connect to the SD card
+    // and the internal LDO power supply, we need to initialize the power supply first.
+#if CONFIG_EXAMPLE_SD_PWR_CTRL_LDO_INTERNAL_IO
+    sd_pwr_ctrl_ldo_config_t ldo_config = {
+        .ldo_chan_id = CONFIG_EXAMPLE_SD_PWR_CTRL_LDO_IO_ID,
+    };
+    sd_pwr_ctrl_handle_t pwr_ctrl_handle = NULL;
+
+    ret = sd_pwr_ctrl_new_on_chip_ldo(&ldo_config, &pwr_ctrl_handle);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create a new on-chip LDO power control driver");
+        return ret;
+    }
+    host.pwr_ctrl_handle = pwr_ctrl_handle;
+#endif
+
+    spi_bus_config_t bus_cfg = {
+        .mosi_io_num = PIN_NUM_MOSI,
+        .miso_io_num = PIN_NUM_MISO,
+        .sclk_io_num = PIN_NUM_CLK,
+        .quadwp_io_num = -1,
+        .quadhd_io_num = -1,
+        // Room for a whole FAT sector in one DMA transfer
+        .max_transfer_sz = SD_IO_DMA_BUF_BYTES,
+    };
+
+    s_bus = host.slot;
+    ret = spi_bus_initialize(s_bus, &bus_cfg, SDSPI_DEFAULT_DMA);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to initialize bus.");
+        return ret;
+    }
+    int64_t t_bus = esp_timer_get_time();
+
+    // This initializes the slot without card detect (CD) and write protect (WP) signals.
+    // Modify slot_config.gpio_cd and slot_config.gpio_wp if your board has these signals.
+    sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
+    slot_config.gpio_cs = PIN_NUM_CS;
+    slot_config.host_id = s_bus;
+
+    sdspi_dev_handle_t handle;
+    ret = host.init();
+    if (ret == ESP_OK)
+        ret = sdspi_host_init_device(&slot_config, &handle);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to attach the card to the bus (%s)", esp_err_to_name(ret));
+        spi_bus_free(s_bus);
+        return ret;
+    }
+    host.slot = handle;
+    int64_t t_device = esp_timer_get_time();
+
+    bool resumed = sd_card_resume(&host, &s_card_storage) == ESP_OK;
+    ret = resumed ? ESP_OK : sd_card_probe(&host, &s_card_storage);
+    int64_t t_card = esp_timer_get_time();
+
+    if (ret == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Mounting filesystem");
+        ret = sd_card_mount_fat(&s_card_storage);
+    }
+    if (ret != ESP_OK)
+    {
+        if (ret != ESP_FAIL)
+        {
+            ESP_LOGE(TAG, "Failed to initialize the card (%s). "
+                          "Make sure SD card lines have pull-up resistors in place.",
+                     esp_err_to_name(ret));
+        }
+        s_cache.magic = 0;
+        sdspi_host_remove_device(handle);
+        spi_bus_free(s_bus);
+        return ret;
+    }
+    int64_t t_fat = esp_timer_get_time();
+    ESP_LOGI(TAG, "Filesystem mounted");
+    s_card = &s_card_storage;
+
+#if SD_CLOCK_TUNE_ENABLE
+    // On failure the card keeps the clock sdmmc_card_init() picked
+    ret = sd_clock_init(s_card, resumed);
+    if (ret != ESP_OK)
+        ESP_LOGW(TAG, "Failed to set the card clock (%s)", esp_err_to_name(ret));
+#endif
+    int64_t t_clock = esp_timer_get_time();
+    ESP_LOGI(TAG, "Mount took %lld us: bus %lld, device %lld, card %s %lld, FAT %lld, clock %lld",
+             (long long)(t_clock - t_start), (long long)(t_bus - t_start), (long long)(t_device - t_bus),
+             resumed ? "resumed" : "probed", (long long)(t_card - t_device), (long long)(t_fat - t_card),
+             (long long)(t_clock - t_fat));
+
+    if (out_card)
+        *out_card = s_card;
+    return ESP_OK;
+}
+
+esp_err_t sd_card_unmount(void)
+{
+    if (s_card == NULL)
+        return ESP_OK;
+
+    char drv[3] = {(char)('0' + s_pdrv), ':', 0};
+    f_mount(NULL, drv, 0);
+    ff_diskio_unregister(s_pdrv);
+    esp_err_t ret = esp_vfs_fat_unregister_path(MOUNT_POINT);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to unmount (%s)", esp_err_to_name(ret));
+        return ret;
+    }
+    s_pdrv = FF_DRV_NOT_USED;
+    sdspi_host_remove_device(s_card->host.slot);
+    s_card = NULL;
+    ESP_LOGI(TAG, "Card unmounted");
+
+    return spi_bus_free(s_bus);
+}
+
+#if SD_POWER_GATE_ENABLE
+static const gpio_num_t s_spi_pins[] = {PIN_NUM_MISO, PIN_NUM_MOSI, PIN_NUM_CLK, PIN_NUM_CS};
+#define SD_SPI_PIN_COUNT (sizeof(s_spi_pins) / sizeof(s_spi_pins[0]))
+#endif
+
+void sd_card_power_on(void)
+{
+#if SD_POWER_GATE_ENABLE
+    if (s_powered)
+        return;
+
+    // Set the level before the hold from sd_card_power_off() lets go, so
+    // the switch input never floats
+    const gpio_config_t pwr = {
+        .pin_bit_mask = BIT64(PIN_NUM_SD_PWR),
+        .mode = GPIO_MODE_OUTPUT,
+    };
+    gpio_set_level(PIN_NUM_SD_PWR, SD_PWR_ON_LEVEL);
+    gpio_config(&pwr);
+    gpio_hold_dis(PIN_NUM_SD_PWR);
+    s_power_on_us = esp_timer_get_time();
+    s_powered = true;
+
+    // The SPI driver takes the pins over on mount
+    for (size_t i = 0; i < SD_SPI_PIN_COUNT; i++)
+        gpio_hold_dis(s_spi_pins[i]);
+#endif
+}
+
+void sd_card_power_off(void)
+{
+#if SD_POWER_GATE_ENABLE
+    sd_card_unmount();
+    // An unpowered card forgets its state, the next mount has to probe it
+    s_cache.magic = 0;
+
+    // No driver, no pulls, no input buffer: nothing flows into the card
+    const gpio_config_t pwr = {
+        .pin_bit_mask = BIT64(PIN_NUM_SD_PWR),
+        .mode = GPIO_MODE_OUTPUT,
+    };
+    gpio_config_t spi = {
+        .mode = GPIO_MODE_DISABLE,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+    };
+    for (size_t i = 0; i < SD_SPI_PIN_COUNT; i++)
+        spi.pin_bit_mask |= BIT64(s_spi_pins[i]);
+    gpio_config(&spi);
+    gpio_set_level(PIN_NUM_SD_PWR, !SD_PWR_ON_LEVEL);
+    gpio_config(&pwr);
+
+    // All of them are RTC GPIOs, their hold lasts through deep sleep
+    for (size_t i = 0; i < SD_SPI_PIN_COUNT; i++)
+        gpio_hold_en(s_spi_pins[i]);
+    gpio_hold_en(PIN_NUM_SD_PWR);
+    s_powered = false;
+    ESP_LOGI(TAG, "Card power off");
+#endif
+}
+
+bool sd_card_is_mounted(void)
+{
+    return s_card != NULL;
+}
+
+esp_err_t sd_card_file_sectors(const char *name, size_t size, uint32_t *first, uint32_t *count)
+{
+    esp_err_t ret;
+    struct stat st;
+    bool contiguous = false;
+    char path[32];
+
+    if (s_card == NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    snprintf(path, sizeof(path), MOUNT_POINT "/%s", name);
+    if (stat(path, &st) != 0)
+    {
+        ESP_LOGI(TAG, "Reserving %u KiB for %s", (unsigned)(size / 1024), path);
+        ret = esp_vfs_fat_create_contiguous_file(MOUNT_POINT, path, size, true);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to create %s (%s)", path, esp_err_to_name(ret));
+            return ret;
+        }
+    }
+    ret = esp_vfs_fat_test_contiguous_file(MOUNT_POINT, path, &contiguous);
+    if (ret != ESP_OK || !contiguous)
+    {
+        ESP_LOGE(TAG, "%s is not contiguous, delete it to have it reserved again", path);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Look the file's first cluster up through FatFs on the card's drive.
+    // FIL carries a sector buffer, too big for the stack of the caller.
+    static FIL file;
+    snprintf(path, sizeof(path), "%u:/%s", s_pdrv, name);
+    if (f_open(&file, path, FA_READ) != FR_OK)
+    {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return ESP_FAIL;
+    }
+    FATFS *fs = file.obj.fs;
+#if FF_MAX_SS != FF_MIN_SS
+    uint32_t fs_sector_size = fs->ssize;
+#else
+    uint32_t fs_sector_size = FF_MAX_SS;
+#endif
+    bool allocated = file.obj.sclust >= 2;
+    LBA_t lba = fs->database + (LBA_t)(file.obj.sclust - 2) * fs->csize;
+    *first = lba * (fs_sector_size / s_card->csd.sector_size);
+    *count = f_size(&file) / s_card->csd.sector_size;
+    f_close(&file);
+    if (!allocated)
+    {
+        ESP_LOGE(TAG, "%s has no clusters", path);
+        return ESP_ERR_INVALID_SIZE;
+    }
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+#if SD_RING_ENABLE
+// Card sector holding the first byte of SD_RING_FILE_NAME
+static uint32_t s_ring_base;
+
+static int sd_ring_card_read(void *ctx, uint32_t sector, void *buf, uint32_t count)
+{
+    return sdmmc_read_sectors(ctx, buf, s_ring_base + sector, count) == ESP_OK ? 0 : -1;
+}
+
+static int sd_ring_card_write(void *ctx, uint32_t sector, const void *buf, uint32_t count)
+{
+    return sdmmc_write_sectors(ctx, buf, s_ring_base + sector, count) == ESP_OK ? 0 : -1;
+}
+
+esp_err_t sd_card_ring_dev(sd_ring_dev_t *dev)
+{
+    esp_err_t ret = sd_card_file_sectors(SD_RING_FILE_NAME, SD_RING_BYTES, &s_ring_base, &dev->n_sectors);
+    if (ret != ESP_OK)
+        return ret;
+
+    dev->ctx = s_card;
+    dev->read = sd_ring_card_read;
+    dev->write = sd_ring_card_write;
+    return ESP_OK;
+}
+#endif // SD_RING_ENABLE
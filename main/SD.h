@@ -2,17 +2,95 @@
 #define SD_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "esp_err.h"
+#include "sdmmc_cmd.h"
 
 
-#define EXAMPLE_MAX_CHAR_SIZE    64
 #define MOUNT_POINT "/sdcard"
 
-#define PIN_NUM_MISO 12
-#define PIN_NUM_MOSI 11
-#define PIN_NUM_CLK 13
-#define PIN_NUM_CS 10
+// Pin assignments of the SD card on the SPI bus
+#define PIN_NUM_MISO 14
+#define PIN_NUM_MOSI 13
+#define PIN_NUM_CLK 12
+#define PIN_NUM_CS 11
 
+// Load switch on the card supply, off through deep sleep so an idle card
+// draws nothing between flushes. The card is then probed on every mount.
+// The pull-ups on the SD lines must sit on the switched rail, or they
+// feed the card while it is off.
+#define SD_POWER_GATE_ENABLE 0
+#define PIN_NUM_SD_PWR 10           // RTC GPIO, so its level holds through deep sleep
+#define SD_PWR_ON_LEVEL 1
+#define SD_PWR_RAMP_US 1000         // Switch on to first command, the SD spec asks for 1 ms
 
+// Cluster size when a card without a filesystem gets formatted, which only
+// happens with CONFIG_EXAMPLE_FORMAT_IF_MOUNT_FAILED
+#define SD_ALLOCATION_UNIT_SIZE (16 * 1024)
 
-#endif
\ No newline at end of file
+// Raw record ring (sd_ring.h) in place of the FAT day files, for rates where
+// FAT bookkeeping dominates. It lives inside one contiguous file, so the
+// card stays a valid FAT volume; do not delete or copy over that file.
+#define SD_RING_ENABLE 0
+#define SD_RING_FILE_NAME "ring.bin"
+#define SD_RING_BYTES (4 * 1024 * 1024)
+
+/**
+ * @brief Bring up the SPI bus and card, and mount FAT at MOUNT_POINT
+ *
+ * After a full probe the card's registers and clock are kept in RTC
+ * memory. On later wakes the card, still powered and in SPI mode, is only
+ * checked with CMD10 against the cached CID; any mismatch or error falls
+ * back to the full probe. With SD_POWER_GATE_ENABLE the card was off
+ * through the sleep and is always probed. The time per phase is logged.
+ *
+ * @param[out] out_card Initialised card, optional
+ */
+esp_err_t sd_card_mount(sdmmc_card_t **out_card);
+
+/* Unmount and release the SPI bus, a no-op if not mounted */
+esp_err_t sd_card_unmount(void);
+
+/**
+ * @brief Switch the card supply on without waiting for it to settle
+ *
+ * Call as soon as a wake knows it will mount the card, so the ramp runs
+ * alongside other work; sd_card_mount() only waits out what is left of
+ * SD_PWR_RAMP_US. A no-op without SD_POWER_GATE_ENABLE.
+ */
+void sd_card_power_on(void);
+
+/**
+ * @brief Unmount, cut the card supply and park the SPI pins
+ *
+ * The pins are left without driver or pulls and held through deep sleep,
+ * so nothing back-powers the card. Call before esp_deep_sleep_start(). A
+ * no-op without SD_POWER_GATE_ENABLE, the card then stays powered and
+ * mounts from the RTC cache.
+ */
+void sd_card_power_off(void);
+
+bool sd_card_is_mounted(void);
+
+/**
+ * @brief Card sectors of a file in the volume root kept as one extent
+ *
+ * Creates the file contiguous with size bytes if it does not exist, so
+ * its sectors can be used with sdmmc_read/write_sectors past FAT.
+ */
+esp_err_t sd_card_file_sectors(const char *name, size_t size, uint32_t *first, uint32_t *count);
+
+#if SD_RING_ENABLE
+#include "sd_ring.h"
+
+/**
+ * @brief Block device over the sectors of SD_RING_FILE_NAME
+ *
+ * Creates the file with a contiguous SD_RING_BYTES extent if it does not
+ * exist. Reads and writes go to the card with sdmmc_read/write_sectors,
+ * past FAT. Needs the card mounted.
+ */
+esp_err_t sd_card_ring_dev(sd_ring_dev_t *dev);
+#endif
+
+#endif
@@ -0,0 +1,95 @@
+#include "adc_cal_lut.h"
+#include <string.h>
+
+#define ADC_CAL_LUT_RAW_MAX ((1 << ADC_CAL_LUT_RAW_BITS) - 1)
+
+static uint32_t adc_cal_lut_checksum(const adc_cal_lut_t *lut)
+{
+    const uint8_t *p = (const uint8_t *)lut;
+    size_t len = offsetof(adc_cal_lut_t, checksum);
+    uint32_t sum1 = 0xFFFF;
+    uint32_t sum2 = 0xFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        sum1 = (sum1 + p[i]) % 0xFFFF;
+        sum2 = (sum2 + sum1) % 0xFFFF;
+    }
+    return (sum2 << 16) | sum1;
+}
+
+static bool adc_cal_lut_intact(const adc_cal_lut_t *lut)
+{
+    return lut->magic == ADC_CAL_LUT_MAGIC && lut->checksum == adc_cal_lut_checksum(lut);
+}
+
+bool adc_cal_lut_is_valid(const adc_cal_lut_t *lut, int atten)
+{
+    if (atten < 0 || atten >= ADC_CAL_LUT_ATTEN_NUM) {
+        return false;
+    }
+    return adc_cal_lut_intact(lut) && (lut->valid_mask & (1u << atten));
+}
+
+bool adc_cal_lut_fill(adc_cal_lut_t *lut, int atten, adc_cal_lut_source_t source, void *ctx)
+{
+    if (atten < 0 || atten >= ADC_CAL_LUT_ATTEN_NUM) {
+        return false;
+    }
+    if (!adc_cal_lut_intact(lut)) {
+        memset(lut, 0, sizeof(*lut));
+        lut->magic = ADC_CAL_LUT_MAGIC;
+    }
+
+    lut->valid_mask &= ~(1u << atten);
+    bool ok = true;
+    for (int i = 0; i < ADC_CAL_LUT_ENTRIES; i++) {
+        int raw = i << ADC_CAL_LUT_SEG_SHIFT;
+        // The last breakpoint sits one past full scale, clamp it
+        int mv = source(raw > ADC_CAL_LUT_RAW_MAX ? ADC_CAL_LUT_RAW_MAX : raw, ctx);
+        if (mv < 0) {
+            ok = false;
+            break;
+        }
+        lut->mv[atten][i] = (uint16_t)mv;
+    }
+    if (ok) {
+        lut->valid_mask |= 1u << atten;
+    }
+
+    lut->checksum = adc_cal_lut_checksum(lut);
+    return ok;
+}
+
+int adc_cal_lut_mv_to_raw(const adc_cal_lut_t *lut, int atten, int mv)
+{
+    // The curve is monotonic, so bisect over the whole code range
+    int lo = 0;
+    int hi = ADC_CAL_LUT_RAW_MAX;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (adc_cal_lut_lookup(lut, atten, mid) < mv) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void adc_cal_lut_convert(const adc_cal_lut_t *lut, int atten, const uint16_t *raw,
+                         int *mv, size_t n, unsigned raw_bits)
+{
+    unsigned shift = ADC_CAL_LUT_RAW_BITS - raw_bits;
+    for (size_t i = 0; i < n; i++) {
+        mv[i] = adc_cal_lut_lookup(lut, atten, raw[i] << shift);
+    }
+}
+
+void adc_cal_lut_convert_frame(const adc_cal_lut_t *lut, int atten, const adc_frame_t *frame,
+                               int *mv, unsigned raw_bits)
+{
+    unsigned shift = ADC_CAL_LUT_RAW_BITS - raw_bits;
+    for (size_t i = 0; i < frame->n_samples; i++) {
+        mv[i] = adc_cal_lut_lookup(lut, atten, frame->samples[i].raw << shift);
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef ADC_CAL_LUT_H
+#define ADC_CAL_LUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "adc_frame.h"
+
+/*
+ * Raw -> millivolt lookup table built once from the eFuse calibration scheme.
+ *
+ * The curve is sampled every 2^ADC_CAL_LUT_SEG_SHIFT raw codes and linearly
+ * interpolated in between. The S2 line-fitting scheme is linear, so this is
+ * exact to within rounding while keeping each attenuation at 258 bytes,
+ * small enough to live in RTC memory across deep sleep.
+ */
+
+#define ADC_CAL_LUT_RAW_BITS 13  /*!< ADC_BITWIDTH_DEFAULT on the S2 */
+#define ADC_CAL_LUT_SEG_SHIFT 6
+#define ADC_CAL_LUT_ENTRIES ((1 << (ADC_CAL_LUT_RAW_BITS - ADC_CAL_LUT_SEG_SHIFT)) + 1)
+#define ADC_CAL_LUT_ATTEN_NUM 4  /*!< ADC_ATTEN_DB_0 .. ADC_ATTEN_DB_12 */
+#define ADC_CAL_LUT_MAGIC 0x4C43414Du  /*!< Bump when the layout changes */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t valid_mask;  /*!< Bit n set once attenuation n has been filled */
+    uint16_t mv[ADC_CAL_LUT_ATTEN_NUM][ADC_CAL_LUT_ENTRIES];
+    uint32_t checksum;    /*!< Fletcher-32 over everything above */
+} adc_cal_lut_t;
+
+/* Returns the calibrated voltage in mV for a raw code, or a negative value on error */
+typedef int (*adc_cal_lut_source_t)(int raw, void *ctx);
+
+/* True if the checksum matches and the attenuation has been filled */
+bool adc_cal_lut_is_valid(const adc_cal_lut_t *lut, int atten);
+
+/**
+ * @brief Sample the calibration curve of one attenuation into the table
+ *
+ * Resets the whole table first if its checksum does not match, and reseals
+ * it afterwards.
+ *
+ * @return false if source failed for any point
+ */
+bool adc_cal_lut_fill(adc_cal_lut_t *lut, int atten, adc_cal_lut_source_t source, void *ctx);
+
+/* Convert one raw code (ADC_CAL_LUT_RAW_BITS wide) to mV */
+static inline int adc_cal_lut_lookup(const adc_cal_lut_t *lut, int atten, int raw)
+{
+    const uint16_t *mv = lut->mv[atten];
+    int seg = raw >> ADC_CAL_LUT_SEG_SHIFT;
+    int frac = raw & ((1 << ADC_CAL_LUT_SEG_SHIFT) - 1);
+    int lo = mv[seg];
+    return lo + (((mv[seg + 1] - lo) * frac + (1 << (ADC_CAL_LUT_SEG_SHIFT - 1))) >> ADC_CAL_LUT_SEG_SHIFT);
+}
+
+/* Smallest raw code (ADC_CAL_LUT_RAW_BITS wide) that reads as at least mv */
+int adc_cal_lut_mv_to_raw(const adc_cal_lut_t *lut, int atten, int mv);
+
+/**
+ * @brief Convert a block of raw codes
+ *
+ * @param raw_bits Width of the input codes; narrower codes (e.g. the 12-bit
+ *                 DMA results) are scaled up to ADC_CAL_LUT_RAW_BITS
+ */
+void adc_cal_lut_convert(const adc_cal_lut_t *lut, int atten, const uint16_t *raw,
+                         int *mv, size_t n, unsigned raw_bits);
+
+/* Convert every sample of a DMA frame, mv must hold frame->n_samples entries */
+void adc_cal_lut_convert_frame(const adc_cal_lut_t *lut, int atten, const adc_frame_t *frame,
+                               int *mv, unsigned raw_bits);
+
+#endif // ADC_CAL_LUT_H
@@ -0,0 +1,73 @@
+#include "adc_frame.h"
+
+size_t adc_frame_parse(adc_frame_t *frame, const uint8_t *buf, size_t len,
+                       uint32_t channel_mask, int64_t end_time_us, uint32_t conv_period_ns)
+{
+    size_t n_words = len / ADC_FRAME_BYTES_PER_CONV;
+    if (n_words > ADC_FRAME_MAX_SAMPLES) {
+        n_words = ADC_FRAME_MAX_SAMPLES;
+    }
+
+    uint16_t stored = 0;
+    uint16_t rejected = 0;
+    for (size_t i = 0; i < n_words; i++) {
+        // DMA words are little endian on the target, read them bytewise so
+        // the host build does not depend on alignment or endianness.
+        uint16_t word = (uint16_t)(buf[2 * i] | (buf[2 * i + 1] << 8));
+        uint8_t channel = (word >> ADC_FRAME_CHANNEL_SHIFT) & ADC_FRAME_CHANNEL_MASK;
+
+        if ((channel_mask & (1u << channel)) == 0) {
+            rejected++;
+            continue;
+        }
+        frame->samples[stored].raw = word & ADC_FRAME_DATA_MASK;
+        frame->samples[stored].channel = channel;
+        stored++;
+    }
+
+    frame->n_samples = stored;
+    frame->n_rejected = rejected;
+    frame->conv_period_ns = conv_period_ns;
+
+    // Every word, rejected or not, occupied one conversion slot.
+    int64_t span_ns = n_words ? (int64_t)(n_words - 1) * conv_period_ns : 0;
+    frame->timestamp_us = end_time_us - span_ns / 1000;
+
+    return stored;
+}
+
+void adc_frame_ring_reset(adc_frame_ring_t *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->overruns = 0;
+}
+
+adc_frame_t *adc_frame_ring_claim(adc_frame_ring_t *ring)
+{
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (ring->head - tail >= ADC_FRAME_RING_LEN) {
+        ring->overruns++;
+        return NULL;
+    }
+    return &ring->frames[ring->head % ADC_FRAME_RING_LEN];
+}
+
+void adc_frame_ring_publish(adc_frame_ring_t *ring)
+{
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+const adc_frame_t *adc_frame_ring_peek(adc_frame_ring_t *ring)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head == ring->tail) {
+        return NULL;
+    }
+    return &ring->frames[ring->tail % ADC_FRAME_RING_LEN];
+}
+
+void adc_frame_ring_release(adc_frame_ring_t *ring)
+{
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
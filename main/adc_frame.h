@@ -0,0 +1,75 @@
+#ifndef ADC_FRAME_H
+#define ADC_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Frame parser and frame ring for the continuous ADC engine.
+ *
+ * Nothing in here depends on ESP-IDF, so the same code runs on the target
+ * (fed by the ADC DMA) and in a Linux build (fed by a synthetic buffer).
+ */
+
+#define ADC_FRAME_MAX_SAMPLES 256   /*!< Conversions held by one frame */
+#define ADC_FRAME_RING_LEN 8        /*!< Frames buffered between producer and consumer */
+
+/* The S2 digital controller emits 2-byte results in ADC_DIGI_OUTPUT_FORMAT_TYPE1
+ * layout: data in bits [11:0], channel in bits [15:12]. */
+#define ADC_FRAME_BYTES_PER_CONV 2
+#define ADC_FRAME_DATA_MASK 0x0FFF
+#define ADC_FRAME_CHANNEL_SHIFT 12
+#define ADC_FRAME_CHANNEL_MASK 0x0F
+
+typedef struct {
+    uint16_t raw;
+    uint8_t channel;
+} adc_frame_sample_t;
+
+/* One DMA conversion frame. Sample i was taken at
+ * timestamp_us + i * conv_period_ns / 1000. */
+typedef struct {
+    int64_t timestamp_us;     /*!< Capture time of samples[0] */
+    uint32_t conv_period_ns;  /*!< Time between consecutive conversions */
+    uint32_t seq;             /*!< Frame sequence number, gaps mean dropped frames */
+    uint16_t n_samples;
+    uint16_t n_rejected;      /*!< Words with an unexpected channel id */
+    adc_frame_sample_t samples[ADC_FRAME_MAX_SAMPLES];
+} adc_frame_t;
+
+/* Single-producer / single-consumer ring of frames. */
+typedef struct {
+    adc_frame_t frames[ADC_FRAME_RING_LEN];
+    volatile uint32_t head;   /*!< Next slot the producer fills */
+    volatile uint32_t tail;   /*!< Next slot the consumer reads */
+    uint32_t overruns;        /*!< Frames dropped because the consumer fell behind */
+} adc_frame_ring_t;
+
+/**
+ * @brief Decode a DMA conversion buffer into a frame
+ *
+ * @param frame          Frame to fill; seq is left untouched
+ * @param buf            Raw bytes returned by the ADC DMA
+ * @param len            Length of buf in bytes
+ * @param channel_mask   Bit n set if channel n belongs to the pattern
+ * @param end_time_us    Time the last conversion in buf completed
+ * @param conv_period_ns Time between conversions (1e9 / total sample rate)
+ *
+ * @return Number of samples stored
+ */
+size_t adc_frame_parse(adc_frame_t *frame, const uint8_t *buf, size_t len,
+                       uint32_t channel_mask, int64_t end_time_us, uint32_t conv_period_ns);
+
+void adc_frame_ring_reset(adc_frame_ring_t *ring);
+
+/* Producer side: claim the slot to fill, then publish it. claim returns NULL
+ * and counts an overrun when the consumer has not released any slot. */
+adc_frame_t *adc_frame_ring_claim(adc_frame_ring_t *ring);
+void adc_frame_ring_publish(adc_frame_ring_t *ring);
+
+/* Consumer side: peek the oldest frame (NULL when empty), then release it. */
+const adc_frame_t *adc_frame_ring_peek(adc_frame_ring_t *ring);
+void adc_frame_ring_release(adc_frame_ring_t *ring);
+
+#endif // ADC_FRAME_H
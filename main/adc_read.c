@@ -1,12 +1,26 @@
 #include "adc_read.h"
+#include "adc_cal_lut.h"
+#include "esp_attr.h"
 #include "esp_log.h"
 
 static const char *TAG = "ADC_READER";
+
+const adc_reader_channel_t adc_reader_channels[] = {
+    { .channel = ADC1_CHANNEL_3, .atten = ADC_ATTEN_DB_12, .name = "ADC1 Channel 3" },
+    { .channel = ADC1_CHANNEL_2, .atten = ADC_ATTEN_DB_12, .name = "ADC1 Channel 4" },
+};
+const size_t adc_reader_channel_count = sizeof(adc_reader_channels) / sizeof(adc_reader_channels[0]);
+
+_Static_assert(sizeof(adc_reader_channels) / sizeof(adc_reader_channels[0]) <= ADC_READER_MAX_CHANNELS,
+               "too many ADC channels");
+
 static adc_oneshot_unit_handle_t adc1_handle;
-static adc_cali_handle_t adc_cali_handle;
-static bool is_calibrated = false;
+static uint32_t calibrated_attens;  // bit n set when attenuation n has a valid table
+
+// Survives deep sleep, so the calibration scheme is only built on a cold boot
+static RTC_DATA_ATTR adc_cal_lut_t adc_cal_lut;
 
-static bool adc_reader_calibration_init(void);
+static bool adc_reader_calibration_init(adc_atten_t atten);
 
 void adc_reader_init(void) {
     ESP_LOGI(TAG, "Initializing ADC...");
@@ -16,65 +30,100 @@ void adc_reader_init(void) {
     };
     ESP_ERROR_CHECK(adc_oneshot_new_unit(&adc_config, &adc1_handle));
 
-    adc_oneshot_chan_cfg_t channel_config = {
-        .atten = ADC_ATTEN_DB_12,  // Use correct attenuation level
-        .bitwidth = ADC_BITWIDTH_DEFAULT,
-    };
-
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, ADC1_CHANNEL_3, &channel_config));
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, ADC1_CHANNEL_2, &channel_config));
+    calibrated_attens = 0;
+    for (size_t i = 0; i < adc_reader_channel_count; i++) {
+        const adc_reader_channel_t *ch = &adc_reader_channels[i];
+        adc_oneshot_chan_cfg_t channel_config = {
+            .atten = ch->atten,
+            .bitwidth = ADC_BITWIDTH_DEFAULT,
+        };
+        ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, ch->channel, &channel_config));
+
+        if (calibrated_attens & (1u << ch->atten)) {
+            continue;
+        }
+        if (adc_cal_lut_is_valid(&adc_cal_lut, ch->atten) || adc_reader_calibration_init(ch->atten)) {
+            calibrated_attens |= 1u << ch->atten;
+        }
+    }
+}
 
-    is_calibrated = adc_reader_calibration_init();
+static int adc_reader_cali_source(int raw, void *ctx) {
+    int voltage = 0;
+    if (adc_cali_raw_to_voltage((adc_cali_handle_t)ctx, raw, &voltage) != ESP_OK) {
+        return -1;
+    }
+    return voltage;
 }
 
-static bool adc_reader_calibration_init(void) {
-    ESP_LOGI(TAG, "Initializing ADC Calibration...");
+static bool adc_reader_calibration_init(adc_atten_t atten) {
+    ESP_LOGI(TAG, "Initializing ADC Calibration (atten %d)...", atten);
+    adc_cali_handle_t adc_cali_handle;
     adc_cali_line_fitting_config_t cali_config = {
         .unit_id = ADC_UNIT_1,
-        .atten = ADC_ATTEN_DB_12,
+        .atten = atten,
         .bitwidth = ADC_BITWIDTH_DEFAULT,
     };
 
-    if (adc_cali_create_scheme_line_fitting(&cali_config, &adc_cali_handle) == ESP_OK) {
-        ESP_LOGI(TAG, "ADC Calibration Successful!");
-        return true;
-    } else {
+    if (adc_cali_create_scheme_line_fitting(&cali_config, &adc_cali_handle) != ESP_OK) {
         ESP_LOGW(TAG, "ADC Calibration Failed! Proceeding without calibration.");
         return false;
     }
+
+    // The scheme is only needed to expand the lookup table, drop it right away
+    bool ok = adc_cal_lut_fill(&adc_cal_lut, atten, adc_reader_cali_source, adc_cali_handle);
+    ESP_ERROR_CHECK(adc_cali_delete_scheme_line_fitting(adc_cali_handle));
+
+    if (ok) {
+        ESP_LOGI(TAG, "ADC Calibration Successful!");
+    } else {
+        ESP_LOGW(TAG, "ADC Calibration table incomplete! Proceeding without calibration.");
+    }
+    return ok;
 }
 
-int adc_reader_get_value1(void) {
-    int raw_value = 0;
-    ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, ADC1_CHANNEL_3, &raw_value));
-    
-    if (is_calibrated) {
-        int voltage = 0;
-        ESP_ERROR_CHECK(adc_cali_raw_to_voltage(adc_cali_handle, raw_value, &voltage));
-        return voltage;
+static inline int adc_reader_convert(adc_atten_t atten, int raw_value) {
+    if (calibrated_attens & (1u << atten)) {
+        return adc_cal_lut_lookup(&adc_cal_lut, atten, raw_value);
     }
 
     return raw_value;
 }
 
-int adc_reader_get_value2(void) {
-    int raw_value = 0;
-    ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, ADC1_CHANNEL_2, &raw_value));
+size_t adc_reader_scan(int *raw, int *mv, size_t n) {
+    return adc_reader_scan_mask(UINT32_MAX, raw, mv, n);
+}
 
-    if (is_calibrated) {
-        int voltage = 0;
-        ESP_ERROR_CHECK(adc_cali_raw_to_voltage(adc_cali_handle, raw_value, &voltage));
-        return voltage;
+size_t adc_reader_scan_mask(uint32_t mask, int *raw, int *mv, size_t n) {
+    if (n > adc_reader_channel_count) {
+        n = adc_reader_channel_count;
     }
 
-    return raw_value;
+    for (size_t i = 0; i < n; i++) {
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+        int raw_value = 0;
+        ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, adc_reader_channels[i].channel, &raw_value));
+        if (raw) {
+            raw[i] = raw_value;
+        }
+        if (mv) {
+            mv[i] = adc_reader_convert(adc_reader_channels[i].atten, raw_value);
+        }
+    }
+
+    return n;
+}
+
+int adc_reader_raw_to_mv(int raw_value) {
+    return adc_reader_convert(ADC_ATTEN_DB_12, raw_value);
+}
+
+const adc_cal_lut_t *adc_reader_get_cal_lut(void) {
+    return calibrated_attens ? &adc_cal_lut : NULL;
 }
 
 void adc_reader_deinit(void) {
     ESP_ERROR_CHECK(adc_oneshot_del_unit(adc1_handle));
-
-    if (is_calibrated) {
-        ESP_LOGI(TAG, "Deinitializing ADC Calibration...");
-        ESP_ERROR_CHECK(adc_cali_delete_scheme_line_fitting(adc_cali_handle));
-    }
 }
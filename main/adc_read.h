@@ -1,16 +1,51 @@
 #ifndef ADC_READER_H
 #define ADC_READER_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include "esp_err.h"
 #include "esp_adc/adc_oneshot.h"
 #include "esp_adc/adc_cali.h"
+#include "adc_cal_lut.h"
 
 #define ADC1_CHANNEL_3 ADC_CHANNEL_3  // GPIO39
 #define ADC1_CHANNEL_2 ADC_CHANNEL_4  // GPIO40
 
+#define ADC_READER_MAX_CHANNELS 8
+
+/* One analog input. The board's inputs are listed in adc_reader_channels[]
+ * in adc_read.c; adding an input only means adding a row there. */
+typedef struct {
+    adc_channel_t channel;  /*!< ADC1 channel */
+    adc_atten_t atten;
+    const char *name;       /*!< Label used in logs */
+    uint32_t interval_s;    /*!< Sampling interval, 0 for the logger's default */
+} adc_reader_channel_t;
+
+extern const adc_reader_channel_t adc_reader_channels[];
+extern const size_t adc_reader_channel_count;
+
 void adc_reader_init(void);
-int adc_reader_get_value1(void);
-int adc_reader_get_value2(void);
+
+/**
+ * @brief Read every configured channel once, in table order
+ *
+ * @param raw Raw codes, may be NULL
+ * @param mv  Calibrated millivolts (raw codes when uncalibrated), may be NULL
+ * @param n   Capacity of the arrays
+ *
+ * @return Number of channels read, min(n, adc_reader_channel_count)
+ */
+size_t adc_reader_scan(int *raw, int *mv, size_t n);
+
+/* Like adc_reader_scan(), but only the channels whose bit is set in mask;
+ * the other entries of raw and mv keep their values */
+size_t adc_reader_scan_mask(uint32_t mask, int *raw, int *mv, size_t n);
+
+/* Convert a raw ADC_BITWIDTH_DEFAULT code taken at ADC_ATTEN_DB_12 */
+int adc_reader_raw_to_mv(int raw_value);
+/* Calibration table, NULL when uncalibrated */
+const adc_cal_lut_t *adc_reader_get_cal_lut(void);
 void adc_reader_deinit(void);
 
 #endif // ADC_READER_H
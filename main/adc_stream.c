@@ -0,0 +1,211 @@
+#include <assert.h>
+#include <inttypes.h>
+#include "adc_stream.h"
+#include "adc_read.h"
+#include "esp_attr.h"
+#include "esp_check.h"
+#include "esp_adc/adc_continuous.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "soc/soc_caps.h"
+
+#define ADC_STREAM_FRAME_BYTES (ADC_FRAME_MAX_SAMPLES * ADC_FRAME_BYTES_PER_CONV)
+#define ADC_STREAM_POOL_BYTES (ADC_STREAM_FRAME_BYTES * ADC_STREAM_POOL_FRAMES)
+
+static const char *TAG = "ADC_STREAM";
+
+const adc_channel_t adc_stream_default_channels[2] = {ADC1_CHANNEL_3, ADC1_CHANNEL_2};
+
+static adc_continuous_handle_t stream_handle;
+static TaskHandle_t reader_task_handle;
+static SemaphoreHandle_t frame_ready;
+static adc_frame_ring_t frame_ring;
+static uint32_t channel_mask;
+static uint32_t conv_period_ns;
+static bool stream_gated;
+static volatile uint32_t gate_frames;
+
+static bool IRAM_ATTR on_conv_done(adc_continuous_handle_t handle,
+                                   const adc_continuous_evt_data_t *edata, void *user_data)
+{
+    BaseType_t must_yield = pdFALSE;
+    vTaskNotifyGiveFromISR(reader_task_handle, &must_yield);
+    return must_yield == pdTRUE;
+}
+
+static void reader_task(void *args)
+{
+    // Everything the driver pool can hold, so a backlog is drained in one go
+    static uint8_t backlog[ADC_STREAM_POOL_BYTES];
+    uint32_t lens[ADC_STREAM_POOL_FRAMES];
+    uint32_t seq = 0;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        if (stream_gated && gate_frames == 0) {
+            // Leave the data in the pool, it is the pre-trigger history
+            continue;
+        }
+
+        size_t n = 0;
+        size_t used = 0;
+        while (n < ADC_STREAM_POOL_FRAMES &&
+               adc_continuous_read(stream_handle, backlog + used, ADC_STREAM_FRAME_BYTES, &lens[n], 0) == ESP_OK) {
+            used += lens[n];
+            n++;
+        }
+
+        // The last frame just completed; earlier ones end one frame length
+        // apart, counted back from it.
+        int64_t end_time = esp_timer_get_time();
+        for (size_t i = n; i-- > 1;) {
+            end_time -= (int64_t)(lens[i] / ADC_FRAME_BYTES_PER_CONV) * conv_period_ns / 1000;
+        }
+
+        used = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (i > 0) {
+                end_time += (int64_t)(lens[i] / ADC_FRAME_BYTES_PER_CONV) * conv_period_ns / 1000;
+            }
+            uint32_t frame_seq = seq++;
+            const uint8_t *buf = backlog + used;
+            used += lens[i];
+
+            if (stream_gated) {
+                if (gate_frames == 0) {
+                    continue;
+                }
+                gate_frames--;
+            }
+            adc_frame_t *frame = adc_frame_ring_claim(&frame_ring);
+            if (frame == NULL) {
+                continue;
+            }
+            adc_frame_parse(frame, buf, lens[i], channel_mask, end_time, conv_period_ns);
+            frame->seq = frame_seq;
+            adc_frame_ring_publish(&frame_ring);
+            xSemaphoreGive(frame_ready);
+        }
+    }
+}
+
+esp_err_t adc_stream_configure(const adc_stream_config_t *config)
+{
+    if (config->n_channels == 0 || config->n_channels > SOC_ADC_PATT_LEN_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // The controller converts one pattern entry per tick, so the total rate
+    // is the per-channel rate times the number of channels.
+    uint32_t total_hz = config->rate_hz * config->n_channels;
+    if (total_hz < SOC_ADC_SAMPLE_FREQ_THRES_LOW || total_hz > SOC_ADC_SAMPLE_FREQ_THRES_HIGH) {
+        ESP_LOGE(TAG, "Sample rate %" PRIu32 " Hz out of range", total_hz);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ESP_LOGI(TAG, "Starting continuous ADC, %u channels at %" PRIu32 " Hz",
+             (unsigned)config->n_channels, config->rate_hz);
+
+    adc_continuous_handle_cfg_t handle_config = {
+        .max_store_buf_size = ADC_STREAM_FRAME_BYTES * ADC_STREAM_POOL_FRAMES,
+        .conv_frame_size = ADC_STREAM_FRAME_BYTES,
+        .flags.flush_pool = config->gated,
+    };
+    ESP_RETURN_ON_ERROR(adc_continuous_new_handle(&handle_config, &stream_handle), TAG, "new handle");
+
+    adc_digi_pattern_config_t pattern[SOC_ADC_PATT_LEN_MAX] = {0};
+    channel_mask = 0;
+    for (size_t i = 0; i < config->n_channels; i++) {
+        pattern[i].atten = config->atten;
+        pattern[i].channel = config->channels[i];
+        pattern[i].unit = ADC_UNIT_1;
+        pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+        channel_mask |= 1u << config->channels[i];
+    }
+
+    adc_continuous_config_t dig_config = {
+        .pattern_num = config->n_channels,
+        .adc_pattern = pattern,
+        .sample_freq_hz = total_hz,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    };
+    ESP_RETURN_ON_ERROR(adc_continuous_config(stream_handle, &dig_config), TAG, "config");
+    conv_period_ns = 1000000000UL / total_hz;
+    stream_gated = config->gated;
+    gate_frames = 0;
+
+    adc_frame_ring_reset(&frame_ring);
+    frame_ready = xSemaphoreCreateCounting(ADC_FRAME_RING_LEN, 0);
+    assert(frame_ready);
+
+    BaseType_t task_created = xTaskCreate(reader_task, "adc_stream", 4096, NULL, 5, &reader_task_handle);
+    assert(task_created);
+
+    adc_continuous_evt_cbs_t cbs = {
+        .on_conv_done = on_conv_done,
+    };
+    return adc_continuous_register_event_callbacks(stream_handle, &cbs, NULL);
+}
+
+esp_err_t adc_stream_run(void)
+{
+    return adc_continuous_start(stream_handle);
+}
+
+esp_err_t adc_stream_start(const adc_stream_config_t *config)
+{
+    ESP_RETURN_ON_ERROR(adc_stream_configure(config), TAG, "configure");
+    return adc_stream_run();
+}
+
+adc_continuous_handle_t adc_stream_get_handle(void)
+{
+    return stream_handle;
+}
+
+void adc_stream_open_gate(uint32_t n_frames)
+{
+    gate_frames = n_frames;
+}
+
+bool adc_stream_gate_is_open(void)
+{
+    return gate_frames != 0;
+}
+
+esp_err_t adc_stream_stop(void)
+{
+    ESP_RETURN_ON_ERROR(adc_continuous_stop(stream_handle), TAG, "stop");
+    vTaskDelete(reader_task_handle);
+    reader_task_handle = NULL;
+    vSemaphoreDelete(frame_ready);
+    frame_ready = NULL;
+
+    if (frame_ring.overruns) {
+        ESP_LOGW(TAG, "%" PRIu32 " frames dropped", frame_ring.overruns);
+    }
+    return adc_continuous_deinit(stream_handle);
+}
+
+const adc_frame_t *adc_stream_peek_frame(uint32_t timeout_ms)
+{
+    if (xSemaphoreTake(frame_ready, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+        return NULL;
+    }
+    return adc_frame_ring_peek(&frame_ring);
+}
+
+void adc_stream_release_frame(void)
+{
+    adc_frame_ring_release(&frame_ring);
+}
+
+uint32_t adc_stream_overruns(void)
+{
+    return frame_ring.overruns;
+}
@@ -0,0 +1,76 @@
+#ifndef ADC_STREAM_H
+#define ADC_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal/adc_types.h"
+#include "esp_adc/adc_continuous.h"
+#include "adc_frame.h"
+
+/*
+ * Continuous (DMA) acquisition on ADC1. The digital controller cycles through
+ * the configured channels and the DMA fills conversion frames that a reader
+ * task turns into timestamped adc_frame_t entries.
+ *
+ * ADC1 cannot be driven by adc_oneshot and adc_continuous at the same time,
+ * call adc_reader_deinit() before adc_stream_start().
+ */
+
+#define ADC_STREAM_DEFAULT_RATE_HZ 2000 /*!< Per-channel sample rate */
+#define ADC_STREAM_POOL_FRAMES 4        /*!< DMA frames the driver may hold */
+
+typedef struct {
+    const adc_channel_t *channels;  /*!< ADC1 channels in scan order */
+    size_t n_channels;
+    uint32_t rate_hz;               /*!< Per-channel sample rate */
+    adc_atten_t atten;
+    bool gated;                     /*!< Only publish frames while the gate is open, see adc_stream_open_gate() */
+} adc_stream_config_t;
+
+/* ADC1 channels 3 and 4 at ADC_STREAM_DEFAULT_RATE_HZ each */
+#define ADC_STREAM_CONFIG_DEFAULT() {                   \
+    .channels = adc_stream_default_channels,            \
+    .n_channels = 2,                                    \
+    .rate_hz = ADC_STREAM_DEFAULT_RATE_HZ,              \
+    .atten = ADC_ATTEN_DB_12,                           \
+    .gated = false,                                     \
+}
+
+extern const adc_channel_t adc_stream_default_channels[2];
+
+/* adc_stream_configure() followed by adc_stream_run() */
+esp_err_t adc_stream_start(const adc_stream_config_t *config);
+
+/* Create and configure the driver without starting conversions, so filters
+ * and monitors can be attached to adc_stream_get_handle() first. */
+esp_err_t adc_stream_configure(const adc_stream_config_t *config);
+esp_err_t adc_stream_run(void);
+esp_err_t adc_stream_stop(void);
+
+adc_continuous_handle_t adc_stream_get_handle(void);
+
+/**
+ * @brief Publish the next n_frames frames of a gated stream
+ *
+ * While the gate is closed the driver pool keeps overwriting its oldest
+ * frame, so the first frames published after opening are the most recent
+ * ADC_STREAM_POOL_FRAMES of history. Safe to call from an ISR.
+ */
+void adc_stream_open_gate(uint32_t n_frames);
+bool adc_stream_gate_is_open(void);
+
+/**
+ * @brief Wait for the oldest unread frame
+ *
+ * The frame stays valid until adc_stream_release_frame() is called.
+ *
+ * @return Frame, or NULL if none arrived within timeout_ms
+ */
+const adc_frame_t *adc_stream_peek_frame(uint32_t timeout_ms);
+void adc_stream_release_frame(void);
+
+/* Frames dropped because the consumer did not keep up */
+uint32_t adc_stream_overruns(void);
+
+#endif // ADC_STREAM_H
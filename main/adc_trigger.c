@@ -0,0 +1,147 @@
+#include <assert.h>
+#include <inttypes.h>
+#include "adc_trigger.h"
+#include "adc_cal_lut.h"
+#include "esp_adc/adc_filter.h"
+#include "esp_adc/adc_monitor.h"
+#include "esp_attr.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "soc/soc_caps.h"
+
+static const char *TAG = "ADC_TRIGGER";
+
+static adc_iir_filter_handle_t filter_handle;
+static adc_monitor_handle_t monitor_handles[2];   // high and low edge, the S2 takes one threshold per monitor
+static size_t monitor_count;
+static TaskHandle_t trigger_task_handle;
+static uint32_t burst_frames;
+static uint32_t trigger_count;
+
+static bool IRAM_ATTR on_threshold(adc_monitor_handle_t monitor_handle,
+                                   const adc_monitor_evt_data_t *event_data, void *user_data)
+{
+    BaseType_t must_yield = pdFALSE;
+    vTaskNotifyGiveFromISR(trigger_task_handle, &must_yield);
+    return must_yield == pdTRUE;
+}
+
+static void adc_trigger_set_monitors(bool enable)
+{
+    for (size_t i = 0; i < monitor_count; i++) {
+        if (enable) {
+            ESP_ERROR_CHECK(adc_continuous_monitor_enable(monitor_handles[i]));
+        } else {
+            ESP_ERROR_CHECK(adc_continuous_monitor_disable(monitor_handles[i]));
+        }
+    }
+}
+
+static void trigger_task(void *args)
+{
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // The monitor keeps firing while the input stays out of band, mute it
+        // until this burst has been handed over.
+        adc_trigger_set_monitors(false);
+        trigger_count++;
+        ESP_LOGI(TAG, "Triggered (#%" PRIu32 ")", trigger_count);
+
+        adc_stream_open_gate(ADC_STREAM_POOL_FRAMES + burst_frames);
+        while (adc_stream_gate_is_open()) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+
+        ulTaskNotifyTake(pdTRUE, 0);
+        adc_trigger_set_monitors(true);
+    }
+}
+
+static esp_err_t adc_trigger_add_monitor(adc_continuous_handle_t handle, adc_channel_t channel,
+                                         int32_t h_threshold, int32_t l_threshold)
+{
+    adc_monitor_config_t monitor_config = {
+        .adc_unit = ADC_UNIT_1,
+        .channel = channel,
+        .h_threshold = h_threshold,
+        .l_threshold = l_threshold,
+    };
+    adc_monitor_evt_cbs_t cbs = {
+        .on_over_high_thresh = on_threshold,
+        .on_below_low_thresh = on_threshold,
+    };
+    adc_monitor_handle_t *monitor = &monitor_handles[monitor_count];
+
+    ESP_RETURN_ON_ERROR(adc_new_continuous_monitor(handle, &monitor_config, monitor), TAG, "new monitor");
+    ESP_RETURN_ON_ERROR(adc_continuous_monitor_register_event_callbacks(*monitor, &cbs, NULL), TAG, "monitor callbacks");
+    monitor_count++;
+    return ESP_OK;
+}
+
+esp_err_t adc_trigger_start(const adc_stream_config_t *stream_config, const adc_trigger_config_t *config)
+{
+    const adc_cal_lut_t *lut = adc_reader_get_cal_lut();
+    if (lut == NULL || !adc_cal_lut_is_valid(lut, stream_config->atten)) {
+        ESP_LOGE(TAG, "No calibration table, cannot convert thresholds");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!stream_config->gated) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ESP_RETURN_ON_ERROR(adc_stream_configure(stream_config), TAG, "stream");
+    adc_continuous_handle_t handle = adc_stream_get_handle();
+
+    adc_continuous_iir_filter_config_t filter_config = {
+        .unit = ADC_UNIT_1,
+        .channel = config->channel,
+        .coeff = config->filter_coeff,
+    };
+    ESP_RETURN_ON_ERROR(adc_new_continuous_iir_filter(handle, &filter_config, &filter_handle), TAG, "filter");
+    ESP_RETURN_ON_ERROR(adc_continuous_iir_filter_enable(filter_handle), TAG, "filter enable");
+
+    // Thresholds compare against the 12-bit DMA result, the table is 13-bit
+    int shift = ADC_CAL_LUT_RAW_BITS - SOC_ADC_DIGI_MAX_BITWIDTH;
+    monitor_count = 0;
+    if (config->high_mv >= 0) {
+        int32_t raw = adc_cal_lut_mv_to_raw(lut, stream_config->atten, config->high_mv) >> shift;
+        ESP_RETURN_ON_ERROR(adc_trigger_add_monitor(handle, config->channel, raw, -1), TAG, "high");
+    }
+    if (config->low_mv >= 0) {
+        int32_t raw = adc_cal_lut_mv_to_raw(lut, stream_config->atten, config->low_mv) >> shift;
+        ESP_RETURN_ON_ERROR(adc_trigger_add_monitor(handle, config->channel, -1, raw), TAG, "low");
+    }
+
+    burst_frames = config->burst_frames;
+    trigger_count = 0;
+    BaseType_t task_created = xTaskCreate(trigger_task, "adc_trigger", 3072, NULL, 6, &trigger_task_handle);
+    assert(task_created);
+
+    adc_trigger_set_monitors(true);
+    ESP_LOGI(TAG, "Armed on channel %d, band %d..%d mV", config->channel, config->low_mv, config->high_mv);
+    return adc_stream_run();
+}
+
+esp_err_t adc_trigger_stop(void)
+{
+    vTaskDelete(trigger_task_handle);
+    trigger_task_handle = NULL;
+
+    adc_trigger_set_monitors(false);
+    ESP_RETURN_ON_ERROR(adc_stream_stop(), TAG, "stream");
+
+    for (size_t i = 0; i < monitor_count; i++) {
+        ESP_RETURN_ON_ERROR(adc_del_continuous_monitor(monitor_handles[i]), TAG, "monitor");
+    }
+    monitor_count = 0;
+    ESP_RETURN_ON_ERROR(adc_continuous_iir_filter_disable(filter_handle), TAG, "filter");
+    return adc_del_continuous_iir_filter(filter_handle);
+}
+
+uint32_t adc_trigger_count(void)
+{
+    return trigger_count;
+}
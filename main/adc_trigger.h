@@ -0,0 +1,51 @@
+#ifndef ADC_TRIGGER_H
+#define ADC_TRIGGER_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal/adc_types.h"
+#include "adc_read.h"
+#include "adc_stream.h"
+
+/*
+ * Event-driven capture on top of a gated adc_stream.
+ *
+ * The digital controller IIR-filters the watched channel and its threshold
+ * monitor interrupts only when the filtered value leaves [low_mv, high_mv].
+ * Each event publishes the pre-trigger history still held in the driver
+ * pool followed by burst_frames fresh frames; between events nothing is
+ * handed to the CPU.
+ */
+
+#define ADC_TRIGGER_MODE_ENABLE 0  /*!< Set to 1 to stay awake and record bursts instead of periodic samples */
+
+typedef struct {
+    adc_channel_t channel;                      /*!< Watched ADC1 channel, must be part of the stream */
+    int low_mv;                                 /*!< Lower band edge, negative to disable */
+    int high_mv;                                /*!< Upper band edge, negative to disable */
+    adc_digi_iir_filter_coeff_t filter_coeff;
+    uint32_t burst_frames;                      /*!< Frames recorded after the trigger */
+} adc_trigger_config_t;
+
+#define ADC_TRIGGER_CONFIG_DEFAULT() {                  \
+    .channel = ADC1_CHANNEL_3,                          \
+    .low_mv = 500,                                      \
+    .high_mv = 2500,                                    \
+    .filter_coeff = ADC_DIGI_IIR_FILTER_COEFF_64,       \
+    .burst_frames = 16,                                 \
+}
+
+/**
+ * @brief Start a gated stream and arm the trigger
+ *
+ * Requires a valid calibration table (run adc_reader_init() once before) to
+ * turn the band edges into raw thresholds. Frames of every burst are read
+ * with adc_stream_peek_frame().
+ */
+esp_err_t adc_trigger_start(const adc_stream_config_t *stream_config, const adc_trigger_config_t *config);
+esp_err_t adc_trigger_stop(void);
+
+/* Number of times the trigger fired since adc_trigger_start() */
+uint32_t adc_trigger_count(void);
+
+#endif // ADC_TRIGGER_H
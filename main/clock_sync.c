@@ -0,0 +1,116 @@
+#include <inttypes.h>
+#include <string.h>
+#include "clock_sync.h"
+#include "DS3231.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+
+static const char *TAG = "CLOCK_SYNC";
+
+static RTC_DATA_ATTR clock_sync_state_t clock_state;
+
+void clock_sync_reset(clock_sync_state_t *state)
+{
+    memset(state, 0, sizeof(*state));
+    state->magic = CLOCK_SYNC_MAGIC;
+    state->uncertainty_ppm = CLOCK_SYNC_UNKNOWN_PPM;
+}
+
+bool clock_sync_valid(const clock_sync_state_t *state)
+{
+    return state->magic == CLOCK_SYNC_MAGIC && state->n_syncs > 0;
+}
+
+bool clock_sync_due(const clock_sync_state_t *state, int64_t sys_now_us, int64_t budget_us)
+{
+    if (!clock_sync_valid(state) || sys_now_us < state->sync_us) {
+        return true;
+    }
+    int64_t elapsed = sys_now_us - state->sync_us;
+    int64_t error_bound = CLOCK_SYNC_RESOLUTION_US + elapsed / 1000000 * state->uncertainty_ppm;
+    return error_bound > budget_us;
+}
+
+void clock_sync_update(clock_sync_state_t *state, int64_t sys_now_us, int64_t ref_us)
+{
+    if (clock_sync_valid(state) && sys_now_us > state->sync_us && ref_us > state->sync_us) {
+        state->sys_span_us += sys_now_us - state->sync_us;
+        state->ref_span_us += ref_us - state->sync_us;
+
+        // Exponential forgetting, so a temperature change is picked up within a day
+        while (state->ref_span_us > CLOCK_SYNC_WINDOW_US) {
+            state->ref_span_us /= 2;
+            state->sys_span_us /= 2;
+        }
+
+        int64_t span_s = state->ref_span_us / 1000000;
+        if (span_s > 0) {
+            state->drift_ppm = (int32_t)((state->sys_span_us - state->ref_span_us) / span_s);
+            // Both ends of the span carry the DS3231 one second granularity
+            int64_t uncertainty = 2 * CLOCK_SYNC_RESOLUTION_US / span_s;
+            if (uncertainty < CLOCK_SYNC_FLOOR_PPM) {
+                uncertainty = CLOCK_SYNC_FLOOR_PPM;
+            }
+            if (uncertainty < state->uncertainty_ppm) {
+                state->uncertainty_ppm = (int32_t)uncertainty;
+            }
+        }
+    }
+
+    state->sync_us = ref_us;
+    state->n_syncs++;
+}
+
+int64_t clock_sync_correct(const clock_sync_state_t *state, int64_t sys_now_us)
+{
+    if (!clock_sync_valid(state)) {
+        return sys_now_us;
+    }
+    int64_t elapsed = sys_now_us - state->sync_us;
+    return sys_now_us - elapsed / 1000000 * state->drift_ppm;
+}
+
+static int64_t clock_sync_sys_now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+esp_err_t clock_sync_wake(void)
+{
+    if (clock_state.magic != CLOCK_SYNC_MAGIC) {
+        clock_sync_reset(&clock_state);
+    }
+
+    int64_t sys_now = clock_sync_sys_now();
+    if (!clock_sync_due(&clock_state, sys_now, CLOCK_SYNC_BUDGET_US)) {
+        return ESP_OK;
+    }
+
+    ds3231_snapshot_t snapshot;
+    esp_err_t ret = ds3231_read_snapshot(&snapshot, false);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    sys_now = clock_sync_sys_now();
+    int64_t ref_us = (int64_t)ds3231_datetime_to_epoch(&snapshot.datetime) * 1000000 + CLOCK_SYNC_RESOLUTION_US;
+
+    clock_sync_update(&clock_state, sys_now, ref_us);
+    struct timeval tv = {
+        .tv_sec = ref_us / 1000000,
+        .tv_usec = ref_us % 1000000,
+    };
+    settimeofday(&tv, NULL);
+
+    ESP_LOGI(TAG, "Synced from DS3231, off by %" PRId64 " ms, drift %" PRId32 " ppm (+/- %" PRId32 ")",
+             (sys_now - ref_us) / 1000, clock_state.drift_ppm, clock_state.uncertainty_ppm);
+    return ESP_OK;
+}
+
+void clock_sync_gettimeofday(struct timeval *tv)
+{
+    int64_t now = clock_sync_correct(&clock_state, clock_sync_sys_now());
+    tv->tv_sec = now / 1000000;
+    tv->tv_usec = now % 1000000;
+}
@@ -0,0 +1,60 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include "esp_err.h"
+
+/*
+ * Keeps the system clock (driven by the ESP RTC, CONFIG_RTC_CLK_SRC_INT_RC)
+ * in step with the DS3231 so timestamps come from gettimeofday() instead of
+ * the I2C bus.
+ *
+ * The system clock keeps counting through deep sleep. Every sync measures
+ * how far it ran ahead of or behind the DS3231; the accumulated ratio gives
+ * a drift estimate used to correct timestamps between syncs. The DS3231 is
+ * only read again once the worst-case error of the corrected clock could
+ * exceed CLOCK_SYNC_BUDGET_US.
+ */
+
+#define CLOCK_SYNC_BUDGET_US 1000000     /*!< Largest timestamp error tolerated between syncs */
+#define CLOCK_SYNC_RESOLUTION_US 500000  /*!< DS3231 reads whole seconds, we sync to the middle */
+#define CLOCK_SYNC_UNKNOWN_PPM 50000     /*!< Assumed error of the internal RC before any estimate */
+#define CLOCK_SYNC_FLOOR_PPM 200         /*!< Never trust the estimate beyond this */
+#define CLOCK_SYNC_WINDOW_US (24LL * 3600 * 1000000)  /*!< History older than this fades out */
+#define CLOCK_SYNC_MAGIC 0x434C4B53u
+
+typedef struct {
+    uint32_t magic;
+    int64_t sync_us;          /*!< System time right after the last sync */
+    int64_t ref_span_us;      /*!< DS3231 time covered by the drift estimate */
+    int64_t sys_span_us;      /*!< System time elapsed over the same intervals */
+    int32_t drift_ppm;        /*!< Positive when the system clock runs fast */
+    int32_t uncertainty_ppm;
+    uint32_t n_syncs;
+} clock_sync_state_t;
+
+void clock_sync_reset(clock_sync_state_t *state);
+bool clock_sync_valid(const clock_sync_state_t *state);
+
+/* True if the corrected clock may be off by more than budget_us at sys_now_us */
+bool clock_sync_due(const clock_sync_state_t *state, int64_t sys_now_us, int64_t budget_us);
+
+/* Record a sync: the system clock read sys_now_us when the reference read ref_us */
+void clock_sync_update(clock_sync_state_t *state, int64_t sys_now_us, int64_t ref_us);
+
+/* Drift-corrected estimate of the reference time */
+int64_t clock_sync_correct(const clock_sync_state_t *state, int64_t sys_now_us);
+
+/**
+ * @brief Sync the system clock from the DS3231 if the drift budget requires it
+ *
+ * Call once per wake, after i2c_master_init().
+ */
+esp_err_t clock_sync_wake(void);
+
+/* gettimeofday() with the drift correction applied */
+void clock_sync_gettimeofday(struct timeval *tv);
+
+#endif // CLOCK_SYNC_H
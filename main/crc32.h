@@ -0,0 +1,15 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * CRC-32 as used by zlib and Ethernet (reflected, polynomial 0xEDB88320).
+ * Plain C with a 16-entry table, so it builds on the host as well.
+ */
+
+/* Continue crc over data; start with 0. crc32_update(0, "123456789", 9) is 0xCBF43926 */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+
+#endif // CRC32_H
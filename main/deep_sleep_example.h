@@ -11,6 +11,7 @@ extern "C" {
 #endif
 
 #include "sdkconfig.h"
+#include "DS3231.h"
 
 #if CONFIG_EXAMPLE_GPIO_WAKEUP
 void example_deep_sleep_register_gpio_wakeup(void);
@@ -20,6 +21,10 @@ void example_deep_sleep_register_gpio_wakeup(void);
 void example_deep_sleep_register_ext0_wakeup(void);
 #endif
 
+#if DS3231_ALARM_WAKE_ENABLE
+void example_deep_sleep_register_rtc_alarm_wakeup(void);
+#endif
+
 
 void example_deep_sleep_register_ext1_wakeup(void);
 
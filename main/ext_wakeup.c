@@ -8,6 +8,7 @@
 #include "esp_sleep.h"
 #include "sdkconfig.h"
 #include "driver/rtc_io.h"
+#include "DS3231.h"
 
 
 #if CONFIG_EXAMPLE_EXT0_WAKEUP
@@ -30,6 +31,21 @@ void example_deep_sleep_register_ext0_wakeup(void)
 }
 #endif // CONFIG_EXAMPLE_EXT0_WAKEUP
 
+#if DS3231_ALARM_WAKE_ENABLE
+void example_deep_sleep_register_rtc_alarm_wakeup(void)
+{
+    // INT/SQW is active low, and on this chip ext1 can only wake on any-high
+    // or all-low across its mask, so it cannot share the mask with the
+    // active-high pins below. EXT0 takes a single pin at either level.
+    printf("Enabling DS3231 alarm wakeup on pin GPIO%d\n", DS3231_INT_GPIO);
+    ESP_ERROR_CHECK(esp_sleep_enable_ext0_wakeup(DS3231_INT_GPIO, 0));
+
+    // INT/SQW is open drain, hold it high while the alarm is idle
+    ESP_ERROR_CHECK(rtc_gpio_pulldown_dis(DS3231_INT_GPIO));
+    ESP_ERROR_CHECK(rtc_gpio_pullup_en(DS3231_INT_GPIO));
+}
+#endif // DS3231_ALARM_WAKE_ENABLE
+
 
 void example_deep_sleep_register_ext1_wakeup(void)
 {
@@ -0,0 +1,148 @@
+#include <string.h>
+#include <stdbool.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "init_graph.h"
+
+static const char *TAG = "INIT_GRAPH";
+
+_Static_assert(INIT_GRAPH_MAX_NODES <= 24, "one event group bit per node");
+
+/* mask plus everything it depends on, directly or not */
+static uint32_t init_graph_closure(const init_graph_t *graph, uint32_t mask)
+{
+    uint32_t prev;
+    do {
+        prev = mask;
+        for (size_t i = 0; i < graph->n_nodes; i++) {
+            if (mask & (1u << i)) {
+                mask |= graph->nodes[i].deps;
+            }
+        }
+    } while (mask != prev);
+    return mask;
+}
+
+static void init_graph_task(void *arg);
+
+/* Start every wanted node that is ready; call with the lock held */
+static void init_graph_dispatch(init_graph_t *graph)
+{
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        for (size_t i = 0; i < graph->n_nodes; i++) {
+            uint32_t bit = 1u << i;
+            uint32_t deps = graph->nodes[i].deps;
+            if (!(graph->wanted & bit) || (graph->started & bit) || (deps & ~graph->done)) {
+                continue;
+            }
+
+            graph->started |= bit;
+            graph->start_us[i] = esp_timer_get_time() - graph->t0;
+            if (deps & graph->failed) {
+                graph->result[i] = ESP_ERR_INVALID_STATE;
+            } else if (xTaskCreate(init_graph_task, graph->nodes[i].name, INIT_GRAPH_STACK,
+                                   &graph->jobs[i], INIT_GRAPH_PRIORITY, NULL) == pdPASS) {
+                continue;
+            } else {
+                graph->result[i] = ESP_ERR_NO_MEM;
+            }
+            // Failed without running, which may unblock others
+            graph->failed |= bit;
+            graph->done |= bit;
+            xEventGroupSetBits(graph->events, bit);
+            progress = true;
+        }
+    }
+}
+
+static void init_graph_task(void *arg)
+{
+    init_graph_job_t *job = arg;
+    init_graph_t *graph = job->graph;
+    uint32_t bit = 1u << job->index;
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = graph->nodes[job->index].init();
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    xSemaphoreTake(graph->lock, portMAX_DELAY);
+    graph->elapsed_us[job->index] = elapsed;
+    graph->result[job->index] = ret;
+    if (ret != ESP_OK) {
+        graph->failed |= bit;
+    }
+    graph->done |= bit;
+    init_graph_dispatch(graph);
+    xSemaphoreGive(graph->lock);
+
+    xEventGroupSetBits(graph->events, bit);
+    vTaskDelete(NULL);
+}
+
+esp_err_t init_graph_create(init_graph_t *graph, const init_graph_node_t *nodes, size_t n_nodes)
+{
+    if (n_nodes > INIT_GRAPH_MAX_NODES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(graph, 0, sizeof(*graph));
+    graph->nodes = nodes;
+    graph->n_nodes = n_nodes;
+    graph->t0 = esp_timer_get_time();
+    for (size_t i = 0; i < n_nodes; i++) {
+        graph->jobs[i].graph = graph;
+        graph->jobs[i].index = i;
+    }
+    graph->lock = xSemaphoreCreateMutex();
+    graph->events = xEventGroupCreate();
+    if (graph->lock == NULL || graph->events == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void init_graph_start(init_graph_t *graph, uint32_t mask)
+{
+    xSemaphoreTake(graph->lock, portMAX_DELAY);
+    graph->wanted |= init_graph_closure(graph, mask);
+    init_graph_dispatch(graph);
+    xSemaphoreGive(graph->lock);
+}
+
+esp_err_t init_graph_require(init_graph_t *graph, uint32_t mask)
+{
+    init_graph_start(graph, mask);
+    uint32_t closure = init_graph_closure(graph, mask);
+    xEventGroupWaitBits(graph->events, closure, pdFALSE, pdTRUE, portMAX_DELAY);
+
+    for (size_t i = 0; i < graph->n_nodes; i++) {
+        if ((closure & (1u << i)) && graph->result[i] != ESP_OK) {
+            ESP_LOGE(TAG, "%s failed (%s)", graph->nodes[i].name, esp_err_to_name(graph->result[i]));
+            return graph->result[i];
+        }
+    }
+    return ESP_OK;
+}
+
+void init_graph_report(init_graph_t *graph)
+{
+    xSemaphoreTake(graph->lock, portMAX_DELAY);
+    for (size_t i = 0; i < graph->n_nodes; i++) {
+        uint32_t bit = 1u << i;
+        const char *name = graph->nodes[i].name;
+        if (!(graph->wanted & bit)) {
+            ESP_LOGI(TAG, "%-8s skipped", name);
+        } else if (!(graph->started & bit)) {
+            ESP_LOGI(TAG, "%-8s waiting for its dependencies", name);
+        } else if (!(graph->done & bit)) {
+            ESP_LOGI(TAG, "%-8s at +%lld us, still running", name, (long long)graph->start_us[i]);
+        } else {
+            ESP_LOGI(TAG, "%-8s at +%lld us, %lld us, %s", name, (long long)graph->start_us[i],
+                     (long long)graph->elapsed_us[i], esp_err_to_name(graph->result[i]));
+        }
+    }
+    ESP_LOGI(TAG, "%lld us since the graph was created", (long long)(esp_timer_get_time() - graph->t0));
+    xSemaphoreGive(graph->lock);
+}
@@ -0,0 +1,71 @@
+#ifndef INIT_GRAPH_H
+#define INIT_GRAPH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+
+/*
+ * Subsystem bring-up as a dependency graph.
+ *
+ * Each node names the nodes it needs up first. Starting a set of nodes
+ * also starts their dependencies; every node whose dependencies are done
+ * runs on its own short-lived task, so independent subsystems come up
+ * side by side and overlap their waits on buses and supplies. A node
+ * whose dependency failed is failed without running. Nodes nobody asks
+ * for are never started, and the report lists them as skipped.
+ */
+
+#define INIT_GRAPH_MAX_NODES 16
+#define INIT_GRAPH_STACK 4096
+#define INIT_GRAPH_PRIORITY 5
+
+typedef struct {
+    const char *name;
+    esp_err_t (*init)(void);
+    uint32_t deps;                      /*!< Mask of the nodes that must be up first */
+} init_graph_node_t;
+
+typedef struct init_graph init_graph_t;
+
+typedef struct {
+    init_graph_t *graph;
+    size_t index;
+} init_graph_job_t;
+
+struct init_graph {
+    const init_graph_node_t *nodes;
+    size_t n_nodes;
+    int64_t t0;                         /*!< esp_timer time of init_graph_create() */
+    uint32_t wanted;
+    uint32_t started;
+    uint32_t done;                      /*!< Finished, successfully or not */
+    uint32_t failed;
+    int64_t start_us[INIT_GRAPH_MAX_NODES];
+    int64_t elapsed_us[INIT_GRAPH_MAX_NODES];
+    esp_err_t result[INIT_GRAPH_MAX_NODES];
+    init_graph_job_t jobs[INIT_GRAPH_MAX_NODES];
+    SemaphoreHandle_t lock;
+    EventGroupHandle_t events;          /*!< One bit per node, set once it is done */
+};
+
+esp_err_t init_graph_create(init_graph_t *graph, const init_graph_node_t *nodes, size_t n_nodes);
+
+/* Start the nodes in mask and their dependencies without waiting for them */
+void init_graph_start(init_graph_t *graph, uint32_t mask);
+
+/**
+ * @brief Start the nodes in mask if needed and wait until they are done
+ *
+ * @return ESP_OK, or the error of the first node in mask or its
+ *         dependencies that failed
+ */
+esp_err_t init_graph_require(init_graph_t *graph, uint32_t mask);
+
+/* Log the start offset, duration and result of every node, and which were skipped */
+void init_graph_report(init_graph_t *graph);
+
+#endif // INIT_GRAPH_H
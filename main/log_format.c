@@ -0,0 +1,323 @@
+#include "log_format.h"
+#include <string.h>
+#include "crc32.h"
+
+static const uint8_t log_format_magic[3] = {'D', 'L', 'G'};
+static const uint8_t log_format_sync[4] = {0x00, 0xA5, 0x5A, 0xC3};
+static const uint8_t log_format_checkpoint_marker[4] = {0x00, 0xA5, 0x5A, 0x3C};
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static size_t put_varint(uint8_t *p, uint32_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+/* Bytes consumed, 0 if buf ends first, -1 if longer than a uint32_t */
+static int get_varint(const uint8_t *p, size_t len, uint32_t *v)
+{
+    uint32_t result = 0;
+    for (size_t i = 0; i < LOG_FORMAT_VARINT_MAX; i++) {
+        if (i >= len) {
+            return 0;
+        }
+        result |= (uint32_t)(p[i] & 0x7F) << (7 * i);
+        if (!(p[i] & 0x80)) {
+            *v = result;
+            return (int)i + 1;
+        }
+    }
+    return -1;
+}
+
+/* Fixed part of the header, before the channel table */
+static size_t log_format_base_len(uint8_t version)
+{
+    return version == 1 ? 20 : 24;
+}
+
+size_t log_format_write_header(uint8_t *buf, const log_format_header_t *hdr)
+{
+    size_t len = log_format_base_len(LOG_FORMAT_VERSION) + (size_t)hdr->n_channels * (2 + LOG_FORMAT_NAME_LEN);
+
+    memcpy(buf, log_format_magic, sizeof(log_format_magic));
+    buf[3] = LOG_FORMAT_VERSION;
+    put_u16(&buf[4], (uint16_t)len);
+    memcpy(&buf[6], hdr->machine_id, LOG_FORMAT_ID_LEN);
+    put_u32(&buf[14], hdr->cal_id);
+    buf[18] = hdr->n_channels;
+    buf[19] = 0;
+    put_u32(&buf[LOG_FORMAT_DATA_END_OFFSET], hdr->data_end);
+
+    uint8_t *p = &buf[log_format_base_len(LOG_FORMAT_VERSION)];
+    for (size_t ch = 0; ch < hdr->n_channels; ch++) {
+        p[0] = hdr->channels[ch].adc_channel;
+        p[1] = hdr->channels[ch].atten;
+        memcpy(&p[2], hdr->channels[ch].name, LOG_FORMAT_NAME_LEN);
+        p += 2 + LOG_FORMAT_NAME_LEN;
+    }
+    return len;
+}
+
+void log_format_write_data_end(uint8_t *buf, uint32_t data_end)
+{
+    put_u32(buf, data_end);
+}
+
+int log_format_read_header(const uint8_t *buf, size_t len, log_format_header_t *hdr)
+{
+    if (len < 20) {
+        return 0;
+    }
+    uint8_t version = buf[3];
+    if (memcmp(buf, log_format_magic, sizeof(log_format_magic)) != 0 ||
+        version < 1 || version > LOG_FORMAT_VERSION) {
+        return -1;
+    }
+    size_t base_len = log_format_base_len(version);
+    uint16_t header_len = get_u16(&buf[4]);
+    uint8_t n_channels = buf[18];
+    if (n_channels == 0 || n_channels > LOG_FORMAT_MAX_CHANNELS ||
+        header_len < base_len + n_channels * (2 + LOG_FORMAT_NAME_LEN)) {
+        return -1;
+    }
+    if (len < header_len) {
+        return 0;
+    }
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->version = version;
+    memcpy(hdr->machine_id, &buf[6], LOG_FORMAT_ID_LEN);
+    hdr->cal_id = get_u32(&buf[14]);
+    hdr->data_end = version >= 2 ? get_u32(&buf[LOG_FORMAT_DATA_END_OFFSET]) : 0;
+    hdr->n_channels = n_channels;
+    const uint8_t *p = &buf[base_len];
+    for (size_t ch = 0; ch < n_channels; ch++) {
+        hdr->channels[ch].adc_channel = p[0];
+        hdr->channels[ch].atten = p[1];
+        memcpy(hdr->channels[ch].name, &p[2], LOG_FORMAT_NAME_LEN);
+        p += 2 + LOG_FORMAT_NAME_LEN;
+    }
+    // Later versions may append fields, header_len skips them
+    return header_len;
+}
+
+void log_format_reset(log_format_state_t *state, uint8_t n_channels)
+{
+    memset(state, 0, sizeof(*state));
+    state->n_channels = n_channels;
+}
+
+size_t log_format_encode(log_format_state_t *state, uint32_t t, const int32_t *v, uint8_t *out)
+{
+    size_t n = 0;
+
+    if (!state->synced || state->since_sync >= LOG_FORMAT_SYNC_INTERVAL) {
+        memcpy(out, log_format_sync, sizeof(log_format_sync));
+        n = sizeof(log_format_sync);
+        put_u32(&out[n], t);
+        n += 4;
+        for (size_t ch = 0; ch < state->n_channels; ch++) {
+            n += put_varint(&out[n], zigzag(v[ch]));
+        }
+        state->synced = true;
+        state->since_sync = 0;
+    } else {
+        n += put_varint(&out[n], zigzag((int32_t)(t - state->t)) + 1);
+        for (size_t ch = 0; ch < state->n_channels; ch++) {
+            n += put_varint(&out[n], zigzag(v[ch] - state->v[ch]));
+        }
+        state->since_sync++;
+    }
+
+    state->t = t;
+    memcpy(state->v, v, state->n_channels * sizeof(int32_t));
+    state->segment_crc = crc32_update(state->segment_crc, out, n);
+    state->segment_len += n;
+    return n;
+}
+
+int log_format_decode(log_format_state_t *state, const uint8_t *buf, size_t len)
+{
+    uint32_t t;
+    int32_t v[LOG_FORMAT_MAX_CHANNELS];
+    size_t n = 0;
+    uint32_t u;
+    int used;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    bool sync = buf[0] == log_format_sync[0];
+    if (sync) {
+        if (len < sizeof(log_format_sync) + 4) {
+            // Check what is there so garbage is not mistaken for a short read
+            return memcmp(buf, log_format_sync, len) == 0 ? 0 : -1;
+        }
+        if (memcmp(buf, log_format_sync, sizeof(log_format_sync)) != 0) {
+            return -1;
+        }
+        n = sizeof(log_format_sync);
+        t = get_u32(&buf[n]);
+        n += 4;
+    } else {
+        if (!state->synced) {
+            return -1;
+        }
+        used = get_varint(buf, len, &u);
+        if (used <= 0) {
+            return used;
+        }
+        if (u == 0) {
+            // A padded zero, only a sync record may start with 0x00
+            return -1;
+        }
+        n += used;
+        t = state->t + (uint32_t)unzigzag(u - 1);
+    }
+
+    for (size_t ch = 0; ch < state->n_channels; ch++) {
+        used = get_varint(&buf[n], len - n, &u);
+        if (used <= 0) {
+            return used;
+        }
+        n += used;
+        v[ch] = sync ? unzigzag(u) : state->v[ch] + unzigzag(u);
+    }
+
+    state->synced = true;
+    state->t = t;
+    memcpy(state->v, v, state->n_channels * sizeof(int32_t));
+    return (int)n;
+}
+
+long log_format_find_sync(const uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i + sizeof(log_format_sync) <= len; i++) {
+        if (memcmp(&buf[i], log_format_sync, sizeof(log_format_sync)) == 0) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+bool log_format_checkpoint_due(const log_format_state_t *state)
+{
+    return state->segment_len + LOG_FORMAT_RECORD_MAX > LOG_FORMAT_SEGMENT_MAX;
+}
+
+size_t log_format_checkpoint(log_format_state_t *state, uint8_t *out)
+{
+    if (state->segment_len == 0) {
+        return 0;
+    }
+    memcpy(out, log_format_checkpoint_marker, sizeof(log_format_checkpoint_marker));
+    put_u32(&out[4], ++state->checkpoint_seq);
+    put_u16(&out[8], (uint16_t)state->segment_len);
+    put_u32(&out[10], state->segment_crc);
+    state->segment_len = 0;
+    state->segment_crc = 0;
+    return LOG_FORMAT_CHECKPOINT_LEN;
+}
+
+int log_format_read_checkpoint(const uint8_t *buf, size_t len, uint32_t *seq, uint32_t *segment_len, uint32_t *crc)
+{
+    size_t n = len < sizeof(log_format_checkpoint_marker) ? len : sizeof(log_format_checkpoint_marker);
+    if (memcmp(buf, log_format_checkpoint_marker, n) != 0) {
+        return -1;
+    }
+    if (len < LOG_FORMAT_CHECKPOINT_LEN) {
+        return 0;
+    }
+    *seq = get_u32(&buf[4]);
+    *segment_len = get_u16(&buf[8]);
+    *crc = get_u32(&buf[10]);
+    return LOG_FORMAT_CHECKPOINT_LEN;
+}
+
+/* Length of the intact segment closed by a checkpoint at pos, 0 if there is none */
+static size_t log_format_intact_segment(const uint8_t *buf, size_t len, size_t pos, uint32_t *seq)
+{
+    uint32_t segment_len;
+    uint32_t crc;
+
+    if (log_format_read_checkpoint(&buf[pos], len - pos, seq, &segment_len, &crc) <= 0 ||
+        segment_len == 0 || segment_len > pos ||
+        crc32_update(0, &buf[pos - segment_len], segment_len) != crc) {
+        return 0;
+    }
+    return segment_len;
+}
+
+long log_format_recover(const uint8_t *buf, size_t len, size_t hint, bool from_start, uint32_t *seq)
+{
+    size_t end = 0;
+    bool found = from_start;
+    uint32_t s;
+
+    *seq = 0;
+
+    // The last intact segment that data_end covers
+    for (size_t pos = 0; pos + LOG_FORMAT_CHECKPOINT_LEN <= len && pos + LOG_FORMAT_CHECKPOINT_LEN <= hint; pos++) {
+        if (log_format_intact_segment(buf, len, pos, &s) != 0) {
+            end = pos + LOG_FORMAT_CHECKPOINT_LEN;
+            *seq = s;
+            found = true;
+        }
+    }
+    if (!found) {
+        return -1;
+    }
+
+    // Segments committed after it whose data_end update was lost
+    size_t pos = end;
+    while (pos + LOG_FORMAT_CHECKPOINT_LEN <= len && pos - end <= LOG_FORMAT_SEGMENT_MAX) {
+        size_t segment_len = log_format_intact_segment(buf, len, pos, &s);
+        if (segment_len != 0 && segment_len == pos - end && s == *seq + 1) {
+            end = pos + LOG_FORMAT_CHECKPOINT_LEN;
+            *seq = s;
+            pos = end;
+        } else {
+            pos++;
+        }
+    }
+    return (long)end;
+}
@@ -0,0 +1,144 @@
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Binary day file format, version 3. All integers little endian.
+ *
+ * File header, written when the file is created:
+ *     "DLG" version:1 header_len:2 machine_id:8 cal_id:4 n_channels:1 0:1
+ *     data_end:4 n_channels * (adc_channel:1 atten:1 name:8)
+ * cal_id is the checksum of the ADC calibration table, 0 when the mV values
+ * come from the uncalibrated fallback. Channel names are unique within a
+ * file, the firmware writes "ch3" for ADC channel 3. data_end is the
+ * logical end of the records. Day files are preallocated, so whatever
+ * follows it is stale card content; it is rewritten after every sync.
+ * Version 1 headers lack the field, records run to the end of the file.
+ *
+ * Followed by records. Each writer session, and every
+ * LOG_FORMAT_SYNC_INTERVAL records within one, starts with a sync record
+ * carrying absolute values:
+ *     0x00 0xA5 0x5A 0xC3 t:4 n_channels * zigzag varint mV
+ * Records in between only store differences to the previous record:
+ *     varint (zigzag dt + 1) n_channels * zigzag varint delta mV
+ * A delta record never starts with 0x00, so both kinds are told apart by
+ * their first byte, and a reader that lost its place can scan for the
+ * marker. At two channels and a steady signal a delta record takes three
+ * bytes, against 19 for the CSV line "HH:MM:SS,mV,mV\n".
+ *
+ * Since version 3 the records are cut into segments of at most
+ * LOG_FORMAT_SEGMENT_MAX bytes, each closed by a checkpoint:
+ *     0x00 0xA5 0x5A 0x3C seq:4 segment_len:2 crc32:4
+ * seq counts the file's checkpoints from 1, the CRC covers the segment_len
+ * bytes before the checkpoint. Every commit ends with one, so a torn or
+ * damaged tail is found by reading the last two segments only, see
+ * log_format_recover().
+ *
+ * Plain C without ESP-IDF dependencies, tools/log2csv.c builds it on the
+ * host.
+ */
+
+#define LOG_FORMAT_VERSION 3
+#define LOG_FORMAT_FILE_EXT ".dlg"
+#define LOG_FORMAT_MAX_CHANNELS 8
+#define LOG_FORMAT_ID_LEN 8
+#define LOG_FORMAT_NAME_LEN 8
+#define LOG_FORMAT_SYNC_INTERVAL 64
+#define LOG_FORMAT_HEADER_MAX (24 + LOG_FORMAT_MAX_CHANNELS * (2 + LOG_FORMAT_NAME_LEN))
+#define LOG_FORMAT_DATA_END_OFFSET 20
+#define LOG_FORMAT_VARINT_MAX 5
+#define LOG_FORMAT_RECORD_MAX (4 + 4 + LOG_FORMAT_MAX_CHANNELS * LOG_FORMAT_VARINT_MAX)
+#define LOG_FORMAT_CHECKPOINT_LEN 14
+#define LOG_FORMAT_SEGMENT_MAX 4096
+
+typedef struct {
+    uint8_t adc_channel;
+    uint8_t atten;
+    char name[LOG_FORMAT_NAME_LEN];     /*!< Zero padded, not necessarily terminated */
+} log_format_channel_t;
+
+typedef struct {
+    uint8_t version;
+    char machine_id[LOG_FORMAT_ID_LEN]; /*!< Zero padded, not necessarily terminated */
+    uint32_t cal_id;                    /*!< Checksum of the calibration that produced the mV values, 0 if uncalibrated */
+    uint32_t data_end;                  /*!< Logical end of the records, 0 if they run to the file end */
+    uint8_t n_channels;
+    log_format_channel_t channels[LOG_FORMAT_MAX_CHANNELS];
+} log_format_header_t;
+
+typedef struct {
+    uint8_t n_channels;
+    bool synced;                        /*!< false until a sync record was written or read */
+    uint32_t since_sync;
+    uint32_t t;
+    int32_t v[LOG_FORMAT_MAX_CHANNELS];
+    uint32_t checkpoint_seq;            /*!< Of the last checkpoint written */
+    uint32_t segment_len;               /*!< Bytes encoded since then */
+    uint32_t segment_crc;
+} log_format_state_t;
+
+/* Serialise hdr into buf, which needs LOG_FORMAT_HEADER_MAX bytes; returns the length */
+size_t log_format_write_header(uint8_t *buf, const log_format_header_t *hdr);
+
+/* Serialise data_end into the 4 bytes stored at LOG_FORMAT_DATA_END_OFFSET */
+void log_format_write_data_end(uint8_t *buf, uint32_t data_end);
+
+/**
+ * @brief Parse a file header, version 1 to 3
+ *
+ * @return Header length, 0 if more bytes are needed, -1 if buf does not
+ *         start with a header this code understands
+ */
+int log_format_read_header(const uint8_t *buf, size_t len, log_format_header_t *hdr);
+
+/* Start a session, the next record is a sync record; checkpoints count from 1 again */
+void log_format_reset(log_format_state_t *state, uint8_t n_channels);
+
+/* Encode one record into out, which needs LOG_FORMAT_RECORD_MAX bytes; returns the length */
+size_t log_format_encode(log_format_state_t *state, uint32_t t, const int32_t *v, uint8_t *out);
+
+/**
+ * @brief Decode the record at the start of buf
+ *
+ * On success t and v are left in state.
+ *
+ * @return Bytes consumed, 0 if buf ends inside the record, -1 if the bytes
+ *         are not a valid record here (resume with log_format_find_sync())
+ */
+int log_format_decode(log_format_state_t *state, const uint8_t *buf, size_t len);
+
+/* Offset of the next sync record in buf, or -1 */
+long log_format_find_sync(const uint8_t *buf, size_t len);
+
+/* True once the next record could take the segment past LOG_FORMAT_SEGMENT_MAX */
+bool log_format_checkpoint_due(const log_format_state_t *state);
+
+/* Close the segment into out, LOG_FORMAT_CHECKPOINT_LEN bytes; returns 0 if it is empty */
+size_t log_format_checkpoint(log_format_state_t *state, uint8_t *out);
+
+/**
+ * @brief Parse the checkpoint at the start of buf
+ *
+ * @return LOG_FORMAT_CHECKPOINT_LEN, 0 if buf ends inside it, -1 if buf
+ *         does not start with one
+ */
+int log_format_read_checkpoint(const uint8_t *buf, size_t len, uint32_t *seq, uint32_t *segment_len, uint32_t *crc);
+
+/**
+ * @brief Find the end of the last intact segment in the tail of a file
+ *
+ * buf holds the file from two segments before the recorded data_end, at
+ * offset hint in buf, up to a segment past it; or from the end of the
+ * header if from_start is set. The search anchors on the last checkpoint
+ * up to hint whose CRC matches, then follows checkpoints past hint that
+ * continue the chain, as data_end may lag the last commit.
+ *
+ * @param[out] seq Sequence number of that checkpoint, 0 for none
+ * @return Offset in buf just past it, -1 if nothing up to hint is intact
+ */
+long log_format_recover(const uint8_t *buf, size_t len, size_t hint, bool from_start, uint32_t *seq);
+
+#endif // LOG_FORMAT_H
@@ -0,0 +1,112 @@
+#include "log_stage.h"
+#include <string.h>
+
+static uint16_t log_stage_checksum(const uint8_t *p, size_t len)
+{
+    uint32_t sum1 = 0xFF;
+    uint32_t sum2 = 0xFF;
+
+    for (size_t i = 0; i < len; i++) {
+        sum1 = (sum1 + p[i]) % 0xFF;
+        sum2 = (sum2 + sum1) % 0xFF;
+    }
+    return (uint16_t)((sum2 << 8) | sum1);
+}
+
+static size_t log_stage_record_size(uint8_t n_channels)
+{
+    return LOG_STAGE_RECORD_LEN((size_t)n_channels);
+}
+
+/* Size of the record at offset, or 0 if it is truncated or fails its check */
+static size_t log_stage_check_record(const log_stage_t *stage, size_t offset, size_t limit)
+{
+    if (offset >= limit) {
+        return 0;
+    }
+    uint8_t n = stage->data[offset];
+    size_t size = log_stage_record_size(n);
+    if (n == 0 || n > LOG_STAGE_MAX_CHANNELS || offset + size > limit) {
+        return 0;
+    }
+
+    const uint8_t *rec = &stage->data[offset];
+    uint16_t stored = (uint16_t)(rec[size - 2] | (rec[size - 1] << 8));
+    return stored == log_stage_checksum(rec, size - 2) ? size : 0;
+}
+
+void log_stage_reset(log_stage_t *stage)
+{
+    stage->used = 0;
+    stage->magic = LOG_STAGE_MAGIC;
+}
+
+size_t log_stage_recover(log_stage_t *stage)
+{
+    if (stage->magic != LOG_STAGE_MAGIC || stage->used > LOG_STAGE_BYTES) {
+        log_stage_reset(stage);
+        return 0;
+    }
+
+    size_t offset = 0;
+    size_t count = 0;
+    size_t size;
+    while ((size = log_stage_check_record(stage, offset, stage->used)) != 0) {
+        offset += size;
+        count++;
+    }
+    stage->used = offset;
+    return count;
+}
+
+bool log_stage_append(log_stage_t *stage, uint32_t t, const int *mv, size_t n_channels)
+{
+    if (n_channels == 0 || n_channels > LOG_STAGE_MAX_CHANNELS) {
+        return false;
+    }
+    size_t size = log_stage_record_size((uint8_t)n_channels);
+    if (stage->used + size > LOG_STAGE_BYTES) {
+        return false;
+    }
+
+    uint8_t *rec = &stage->data[stage->used];
+    rec[0] = (uint8_t)n_channels;
+    for (int i = 0; i < 4; i++) {
+        rec[1 + i] = (uint8_t)(t >> (8 * i));
+    }
+    for (size_t ch = 0; ch < n_channels; ch++) {
+        uint16_t v = (uint16_t)(int16_t)mv[ch];
+        rec[5 + 2 * ch] = (uint8_t)v;
+        rec[6 + 2 * ch] = (uint8_t)(v >> 8);
+    }
+    uint16_t check = log_stage_checksum(rec, size - 2);
+    rec[size - 2] = (uint8_t)check;
+    rec[size - 1] = (uint8_t)(check >> 8);
+
+    // Publishing the record is a single aligned store
+    __atomic_store_n(&stage->used, stage->used + size, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool log_stage_needs_flush(const log_stage_t *stage)
+{
+    return stage->used >= LOG_STAGE_HIGH_WATER;
+}
+
+bool log_stage_next(const log_stage_t *stage, size_t *offset, log_stage_record_t *record)
+{
+    size_t size = log_stage_check_record(stage, *offset, stage->used);
+    if (size == 0) {
+        return false;
+    }
+
+    const uint8_t *rec = &stage->data[*offset];
+    record->n_channels = rec[0];
+    record->t = (uint32_t)rec[1] | ((uint32_t)rec[2] << 8) | ((uint32_t)rec[3] << 16) | ((uint32_t)rec[4] << 24);
+    for (size_t ch = 0; ch < record->n_channels; ch++) {
+        record->mv[ch] = (int16_t)(rec[5 + 2 * ch] | (rec[6 + 2 * ch] << 8));
+    }
+
+    *offset += size;
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef LOG_STAGE_H
+#define LOG_STAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Record staging area kept in RTC memory across deep sleep, so the SD card
+ * is only brought up once enough records have piled up.
+ *
+ * Records are packed back to back as
+ *     [n_channels:1][t:4][mv:2 * n_channels][fletcher16:2]
+ * little endian, and `used` is only advanced once a record is complete. A
+ * reset in the middle of an append leaves the previous records intact.
+ *
+ * Placed in RTC_NOINIT memory the area also survives panics, watchdog and
+ * software resets; log_stage_recover() replays whatever passes the record
+ * checks. A brownout or power loss may corrupt or wipe RTC memory, so up to
+ * one full buffer of records can be lost then. Records are also written at
+ * least once rather than exactly once: a reset between the SD write and
+ * log_stage_reset() replays them a second time.
+ */
+
+#define LOG_STAGE_BYTES 1536
+#define LOG_STAGE_HIGH_WATER (LOG_STAGE_BYTES * 3 / 4)  /*!< Flush to SD once this much is used */
+#define LOG_STAGE_MAX_CHANNELS 8
+#define LOG_STAGE_RECORD_LEN(n_channels) (1 + 4 + 2 * (n_channels) + 2)
+#define LOG_STAGE_RECORD_MAX LOG_STAGE_RECORD_LEN(LOG_STAGE_MAX_CHANNELS)
+#define LOG_STAGE_MAGIC 0x53544731u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t used;              /*!< Bytes of complete records in data */
+    uint8_t data[LOG_STAGE_BYTES];
+} log_stage_t;
+
+typedef struct {
+    uint32_t t;                 /*!< Seconds since 1970-01-01 UTC */
+    uint8_t n_channels;
+    int16_t mv[LOG_STAGE_MAX_CHANNELS];
+} log_stage_record_t;
+
+void log_stage_reset(log_stage_t *stage);
+
+/**
+ * @brief Validate the area after boot
+ *
+ * Keeps every record up to the first one failing its check and drops the
+ * rest; resets the area if the header itself is not recognised.
+ *
+ * @return Number of records kept
+ */
+size_t log_stage_recover(log_stage_t *stage);
+
+/* false if the record does not fit, the area is left unchanged */
+bool log_stage_append(log_stage_t *stage, uint32_t t, const int *mv, size_t n_channels);
+
+bool log_stage_needs_flush(const log_stage_t *stage);
+
+static inline bool log_stage_is_empty(const log_stage_t *stage)
+{
+    return stage->used == 0;
+}
+
+/**
+ * @brief Iterate over the staged records, oldest first
+ *
+ * @param offset Start with 0, advanced past each record returned
+ * @return false once all records were returned
+ */
+bool log_stage_next(const log_stage_t *stage, size_t *offset, log_stage_record_t *record);
+
+#endif // LOG_STAGE_H
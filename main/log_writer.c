@@ -0,0 +1,240 @@
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "log_writer.h"
+
+static const char *TAG = "LOG_WRITER";
+
+void log_writer_init(log_writer_t *writer, log_writer_sync_t sync)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = -1;
+    writer->sync = sync;
+}
+
+/* Bytes the buffer may hold before the file end reaches a sector boundary */
+static size_t log_writer_room(const log_writer_t *writer)
+{
+    return LOG_WRITER_BUF_SIZE - writer->file_size % LOG_WRITER_BUF_SIZE;
+}
+
+static esp_err_t log_writer_write_out(log_writer_t *writer)
+{
+    if (writer->len == 0) {
+        return ESP_OK;
+    }
+
+    ssize_t written = write(writer->fd, writer->buf, writer->len);
+    if (written != (ssize_t)writer->len) {
+        ESP_LOGE(TAG, "Failed to write %s: %s", writer->path, strerror(errno));
+        return ESP_FAIL;
+    }
+    writer->file_size += writer->len;
+    writer->len = 0;
+    writer->n_writes++;
+
+    if (writer->sync == LOG_WRITER_SYNC_BLOCK) {
+        if (fsync(writer->fd) != 0) {
+            ESP_LOGE(TAG, "Failed to sync %s: %s", writer->path, strerror(errno));
+            return ESP_FAIL;
+        }
+        writer->n_syncs++;
+    }
+    return ESP_OK;
+}
+
+/* end < 0 appends at the file end */
+static esp_err_t log_writer_open_file(log_writer_t *writer, const char *path, long end)
+{
+    if (log_writer_is_open(writer) && strcmp(writer->path, path) == 0) {
+        return ESP_OK;
+    }
+    if (strlen(path) >= sizeof(writer->path)) {
+        ESP_LOGE(TAG, "Path too long: %s", path);
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = log_writer_close(writer);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "Opening file %s", path);
+    int fd = open(path, O_WRONLY | O_CREAT | (end < 0 ? O_APPEND : 0), 0666);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Failed to open %s: %s", path, strerror(errno));
+        return ESP_FAIL;
+    }
+
+    if (end < 0) {
+        struct stat st;
+        writer->file_size = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+    } else {
+        if (lseek(fd, end, SEEK_SET) != end) {
+            ESP_LOGE(TAG, "Failed to seek %s to %ld: %s", path, end, strerror(errno));
+            close(fd);
+            return ESP_FAIL;
+        }
+        writer->file_size = (size_t)end;
+    }
+    writer->fd = fd;
+    writer->len = 0;
+    snprintf(writer->path, sizeof(writer->path), "%s", path);
+    return ESP_OK;
+}
+
+esp_err_t log_writer_open(log_writer_t *writer, const char *path)
+{
+    return log_writer_open_file(writer, path, -1);
+}
+
+esp_err_t log_writer_open_at(log_writer_t *writer, const char *path, size_t end)
+{
+    return log_writer_open_file(writer, path, (long)end);
+}
+
+esp_err_t log_writer_patch(log_writer_t *writer, size_t offset, const void *data, size_t len)
+{
+    if (!log_writer_is_open(writer)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (offset + len > writer->file_size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (pwrite(writer->fd, data, len, offset) != (ssize_t)len) {
+        ESP_LOGE(TAG, "Failed to patch %s at %u: %s", writer->path, (unsigned)offset, strerror(errno));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t log_writer_append(log_writer_t *writer, const void *data, size_t len)
+{
+    if (!log_writer_is_open(writer)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    const uint8_t *p = data;
+    while (len > 0) {
+        size_t room = log_writer_room(writer) - writer->len;
+        size_t n = len < room ? len : room;
+        memcpy(writer->buf + writer->len, p, n);
+        writer->len += n;
+        p += n;
+        len -= n;
+
+        if (writer->len == log_writer_room(writer)) {
+            esp_err_t ret = log_writer_write_out(writer);
+            if (ret != ESP_OK) {
+                return ret;
+            }
+        }
+    }
+    writer->n_records++;
+    return ESP_OK;
+}
+
+esp_err_t log_writer_sync(log_writer_t *writer)
+{
+    if (!log_writer_is_open(writer)) {
+        return ESP_OK;
+    }
+
+    esp_err_t ret = log_writer_write_out(writer);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (fsync(writer->fd) != 0) {
+        ESP_LOGE(TAG, "Failed to sync %s: %s", writer->path, strerror(errno));
+        return ESP_FAIL;
+    }
+    writer->n_syncs++;
+    return ESP_OK;
+}
+
+esp_err_t log_writer_close(log_writer_t *writer)
+{
+    if (!log_writer_is_open(writer)) {
+        return ESP_OK;
+    }
+
+    esp_err_t ret = log_writer_write_out(writer);
+    if (close(writer->fd) != 0 && ret == ESP_OK) {
+        ESP_LOGE(TAG, "Failed to close %s: %s", writer->path, strerror(errno));
+        ret = ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Closed %s, %" PRIu32 " records in %" PRIu32 " writes",
+             writer->path, writer->n_records, writer->n_writes);
+    writer->fd = -1;
+    writer->len = 0;
+    writer->path[0] = '\0';
+    return ret;
+}
+
+#if LOG_WRITER_BENCHMARK
+#include "esp_timer.h"
+#include "SD.h"
+#include "sd_io.h"
+
+#define BENCH_RECORDS 200
+
+static const char bench_record[] = "12:34:56,1234,2345\n";
+
+static uint32_t bench_sectors_written(void)
+{
+    sd_io_stats_t stats;
+    sd_io_get_stats(&stats);
+    return stats.n_sectors_written;
+}
+
+static void bench_report(const char *name, int64_t elapsed_us, uint32_t sectors)
+{
+    ESP_LOGI(TAG, "%s: %d records in %lld ms, %lld records/s, %" PRIu32 " sectors, %" PRIu32 ".%02" PRIu32 " sectors/record",
+             name, BENCH_RECORDS, (long long)(elapsed_us / 1000),
+             (long long)(BENCH_RECORDS * 1000000LL / (elapsed_us > 0 ? elapsed_us : 1)),
+             sectors, sectors / BENCH_RECORDS, sectors * 100 / BENCH_RECORDS % 100);
+}
+
+void log_writer_benchmark(sdmmc_card_t *card)
+{
+    static log_writer_t writer;
+    const char *path_fopen = MOUNT_POINT "/bench_a.csv";
+    const char *path_writer = MOUNT_POINT "/bench_b.csv";
+    unlink(path_fopen);
+    unlink(path_writer);
+
+    // Current path: one fopen/fprintf/fclose per record
+    uint32_t sectors = bench_sectors_written();
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_RECORDS; i++) {
+        FILE *f = fopen(path_fopen, "a");
+        if (f == NULL) {
+            ESP_LOGE(TAG, "Benchmark failed to open %s", path_fopen);
+            break;
+        }
+        fputs(bench_record, f);
+        fclose(f);
+    }
+    bench_report("fopen/fclose", esp_timer_get_time() - start, bench_sectors_written() - sectors);
+
+    // Writer session, synced once at the end like a stage flush
+    sectors = bench_sectors_written();
+    start = esp_timer_get_time();
+    log_writer_init(&writer, LOG_WRITER_SYNC_EXPLICIT);
+    if (log_writer_open(&writer, path_writer) == ESP_OK) {
+        for (int i = 0; i < BENCH_RECORDS; i++) {
+            log_writer_append(&writer, bench_record, sizeof(bench_record) - 1);
+        }
+        log_writer_close(&writer);
+    }
+    bench_report("log_writer", esp_timer_get_time() - start, bench_sectors_written() - sectors);
+
+    unlink(path_fopen);
+    unlink(path_writer);
+}
+#endif // LOG_WRITER_BENCHMARK
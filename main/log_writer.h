@@ -0,0 +1,84 @@
+#ifndef LOG_WRITER_H
+#define LOG_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "sdmmc_cmd.h"
+
+/*
+ * Append session on one log file.
+ *
+ * The file stays open while the device is awake and records are collected
+ * in a sector-sized buffer. Writes to the card are always whole sectors of
+ * the file: the first one is cut short so the file end lands on a sector
+ * boundary. Switching to another path, log_writer_sync() and
+ * log_writer_close() write out what is pending.
+ *
+ * Data written but not yet synced is lost on a reset, since FAT only
+ * updates the directory entry on fsync or close. Close the writer before
+ * esp_deep_sleep_start().
+ */
+
+#define LOG_WRITER_BUF_SIZE 4096    /*!< One FAT sector, CONFIG_FATFS_SECTOR_4096 */
+#define LOG_WRITER_PATH_MAX 48      /*!< Day file paths, see FILE_PATH_MAX in DS3231.h */
+#define LOG_WRITER_BENCHMARK 0      /*!< Set to 1 to compare against fopen/fclose per record on every mount */
+
+typedef enum {
+    LOG_WRITER_SYNC_EXPLICIT,       /*!< Only log_writer_sync() and log_writer_close() */
+    LOG_WRITER_SYNC_BLOCK,          /*!< Also after every sector written */
+} log_writer_sync_t;
+
+typedef struct {
+    int fd;                         /*!< -1 while closed */
+    char path[LOG_WRITER_PATH_MAX];
+    size_t file_size;               /*!< Append position, not counting the buffer */
+    size_t len;                     /*!< Bytes in buf */
+    log_writer_sync_t sync;
+    uint32_t n_records;
+    uint32_t n_writes;
+    uint32_t n_syncs;
+    uint8_t buf[LOG_WRITER_BUF_SIZE];
+} log_writer_t;
+
+void log_writer_init(log_writer_t *writer, log_writer_sync_t sync);
+
+/* Make path the current file, a no-op if it already is */
+esp_err_t log_writer_open(log_writer_t *writer, const char *path);
+
+/**
+ * @brief Like log_writer_open(), but append at offset end instead of the file end
+ *
+ * For preallocated files, whose size is the reserved extent rather than
+ * the data written so far.
+ */
+esp_err_t log_writer_open_at(log_writer_t *writer, const char *path, size_t end);
+
+/* Overwrite bytes before the append position, e.g. a header field; not synced */
+esp_err_t log_writer_patch(log_writer_t *writer, size_t offset, const void *data, size_t len);
+
+/* Buffer one record, writing out every sector it completes */
+esp_err_t log_writer_append(log_writer_t *writer, const void *data, size_t len);
+
+/* Write out the buffer and fsync, so everything appended survives a reset */
+esp_err_t log_writer_sync(log_writer_t *writer);
+
+esp_err_t log_writer_close(log_writer_t *writer);
+
+static inline bool log_writer_is_open(const log_writer_t *writer)
+{
+    return writer->fd >= 0;
+}
+
+#if LOG_WRITER_BENCHMARK
+/**
+ * @brief Append the same records through fopen/fclose and through a writer
+ *
+ * Logs records per second and SD sectors written per record for both.
+ * Needs the card mounted at MOUNT_POINT.
+ */
+void log_writer_benchmark(sdmmc_card_t *card);
+#endif
+
+#endif // LOG_WRITER_H
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "SD.h"
+#include "phase_stats.h"
+#include "phase_prof.h"
+
+#if PHASE_PROF_ENABLE
+static const char *TAG = "PHASE_PROF";
+
+#define PHASE_PROF_MAGIC 0x50524631u        /* "PRF1" */
+
+static const char *const phase_names[PHASE_COUNT] = {
+    [PHASE_BOOT] = "boot",
+    [PHASE_WAKE_CHECKER] = "wake_checker",
+    [PHASE_ADC_INIT] = "adc_init",
+    [PHASE_I2C_INIT] = "i2c_init",
+    [PHASE_SD_MOUNT] = "sd_mount",
+    [PHASE_LOG_DATA] = "log_data",
+    [PHASE_SLEEP_ENTRY] = "sleep_entry",
+    [PHASE_AWAKE] = "awake",
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t wakes_since_dump;
+    phase_stats_t stats[PHASE_COUNT];
+} phase_prof_t;
+
+static RTC_DATA_ATTR phase_prof_t s_prof;
+// Phases may run on different tasks, each has its own start
+static int64_t s_start_us[PHASE_COUNT];
+
+static void phase_prof_add(phase_t phase, int64_t us)
+{
+    phase_stats_add(&s_prof.stats[phase], us > UINT32_MAX ? UINT32_MAX : (uint32_t)us);
+}
+
+void phase_prof_wake(void)
+{
+    int64_t now = esp_timer_get_time();
+    if (s_prof.magic != PHASE_PROF_MAGIC) {
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            phase_stats_reset(&s_prof.stats[i]);
+        }
+        s_prof.wakes_since_dump = 0;
+        s_prof.magic = PHASE_PROF_MAGIC;
+    }
+    s_prof.wakes_since_dump++;
+    phase_prof_add(PHASE_BOOT, now);
+}
+
+void phase_prof_begin(phase_t phase)
+{
+    s_start_us[phase] = esp_timer_get_time();
+}
+
+void phase_prof_end(phase_t phase)
+{
+    phase_prof_add(phase, esp_timer_get_time() - s_start_us[phase]);
+}
+
+void phase_prof_sleep(void)
+{
+    phase_prof_add(PHASE_AWAKE, esp_timer_get_time());
+}
+
+esp_err_t phase_prof_dump(bool force)
+{
+    char line[80];
+
+    if (!force && s_prof.wakes_since_dump < PHASE_PROF_DUMP_WAKES) {
+        return ESP_OK;
+    }
+    FILE *f = fopen(MOUNT_POINT "/" PHASE_PROF_FILE, "w");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", PHASE_PROF_FILE);
+        return ESP_FAIL;
+    }
+    fputs(PHASE_STATS_CSV_HEADER, f);
+    if (force) {
+        printf("%s", PHASE_STATS_CSV_HEADER);
+    }
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        phase_stats_format(&s_prof.stats[i], phase_names[i], line, sizeof(line));
+        fputs(line, f);
+        if (force) {
+            printf("%s", line);
+        }
+    }
+    if (fclose(f) != 0) {
+        ESP_LOGE(TAG, "Failed to write %s", PHASE_PROF_FILE);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Phase statistics written to %s", PHASE_PROF_FILE);
+    s_prof.wakes_since_dump = 0;
+    return ESP_OK;
+}
+#endif // PHASE_PROF_ENABLE
@@ -0,0 +1,61 @@
+#ifndef PHASE_PROF_H
+#define PHASE_PROF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/*
+ * Where each wake spends its time, accumulated across deep sleep.
+ *
+ * Every phase keeps a phase_stats_t in RTC memory, so min, mean, p99 and
+ * max build up over thousands of wakes until the next cold boot. The
+ * boot phase is esp_timer's reading when app_main starts: it counts from
+ * the chip reset, so that covers ROM, bootloader and startup. The table
+ * goes to PHASE_PROF_FILE on the card every PHASE_PROF_DUMP_WAKES wakes
+ * that mount it, and on every extraction wake, which also prints it.
+ */
+
+#define PHASE_PROF_ENABLE 1
+#define PHASE_PROF_FILE "diag.csv"
+#define PHASE_PROF_DUMP_WAKES 256
+
+typedef enum {
+    PHASE_BOOT,                 /*!< Reset to app_main */
+    PHASE_WAKE_CHECKER,
+    PHASE_ADC_INIT,
+    PHASE_I2C_INIT,
+    PHASE_SD_MOUNT,
+    PHASE_LOG_DATA,
+    PHASE_SLEEP_ENTRY,          /*!< Commit, close and power off before esp_deep_sleep_start() */
+    PHASE_AWAKE,                /*!< Reset to esp_deep_sleep_start() */
+    PHASE_COUNT,
+} phase_t;
+
+#if PHASE_PROF_ENABLE
+/* Call first thing in app_main, records PHASE_BOOT */
+void phase_prof_wake(void);
+
+void phase_prof_begin(phase_t phase);
+
+/* Add the time since phase_prof_begin() to the phase */
+void phase_prof_end(phase_t phase);
+
+/* Record PHASE_AWAKE; call right before esp_deep_sleep_start() */
+void phase_prof_sleep(void);
+
+/**
+ * @brief Write the table to PHASE_PROF_FILE if due, or always with force
+ *
+ * Needs the card mounted at MOUNT_POINT. A forced dump is also printed.
+ */
+esp_err_t phase_prof_dump(bool force);
+#else
+static inline void phase_prof_wake(void) {}
+static inline void phase_prof_begin(phase_t phase) { (void)phase; }
+static inline void phase_prof_end(phase_t phase) { (void)phase; }
+static inline void phase_prof_sleep(void) {}
+static inline esp_err_t phase_prof_dump(bool force) { (void)force; return ESP_OK; }
+#endif
+
+#endif // PHASE_PROF_H
@@ -0,0 +1,86 @@
+#include "phase_stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+/* Values below 4 get a bucket each, above that two mantissa bits per octave */
+static unsigned bucket_of(uint32_t us)
+{
+    if (us < 4) {
+        return us;
+    }
+    unsigned octave = 31 - (unsigned)__builtin_clz(us);
+    unsigned bucket = 4 * (octave - 1) + ((us >> (octave - 2)) & 3);
+    return bucket < PHASE_STATS_BUCKETS ? bucket : PHASE_STATS_BUCKETS - 1;
+}
+
+/* Largest value that falls into bucket */
+static uint32_t bucket_upper(unsigned bucket)
+{
+    if (bucket < 4) {
+        return bucket;
+    }
+    unsigned octave = bucket / 4 + 1;
+    uint32_t lower = (uint32_t)(4 + bucket % 4) << (octave - 2);
+    return lower + (1u << (octave - 2)) - 1;
+}
+
+void phase_stats_reset(phase_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void phase_stats_add(phase_stats_t *stats, uint32_t us)
+{
+    if (stats->count == 0 || us < stats->min_us) {
+        stats->min_us = us;
+    }
+    if (us > stats->max_us) {
+        stats->max_us = us;
+    }
+    stats->count++;
+    stats->sum_us += us;
+
+    unsigned bucket = bucket_of(us);
+    if (stats->hist[bucket] == UINT16_MAX) {
+        for (unsigned i = 0; i < PHASE_STATS_BUCKETS; i++) {
+            stats->hist[i] = (uint16_t)((stats->hist[i] + 1) / 2);
+        }
+    }
+    stats->hist[bucket]++;
+}
+
+uint32_t phase_stats_mean(const phase_stats_t *stats)
+{
+    return stats->count ? (uint32_t)(stats->sum_us / stats->count) : 0;
+}
+
+uint32_t phase_stats_percentile(const phase_stats_t *stats, unsigned pct)
+{
+    uint32_t total = 0;
+    for (unsigned i = 0; i < PHASE_STATS_BUCKETS; i++) {
+        total += stats->hist[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    // Smallest bucket with at least pct % of the samples at or below it
+    uint32_t rank = (total * pct + 99) / 100;
+    uint32_t seen = 0;
+    for (unsigned i = 0; i < PHASE_STATS_BUCKETS; i++) {
+        seen += stats->hist[i];
+        if (seen >= rank && seen > 0) {
+            uint32_t upper = bucket_upper(i);
+            return upper < stats->max_us ? upper : stats->max_us;
+        }
+    }
+    return stats->max_us;
+}
+
+int phase_stats_format(const phase_stats_t *stats, const char *name, char *buf, size_t len)
+{
+    return snprintf(buf, len, "%s,%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 "\n",
+                    name, stats->count, stats->min_us, phase_stats_mean(stats),
+                    phase_stats_percentile(stats, 99), stats->max_us);
+}
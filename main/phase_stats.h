@@ -0,0 +1,48 @@
+#ifndef PHASE_STATS_H
+#define PHASE_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Running statistics of one timed phase, small enough to keep in RTC
+ * memory for thousands of wakes.
+ *
+ * Besides count, min, max and sum, durations go into a log-scale
+ * histogram with four buckets per power of two, so a percentile comes
+ * out within 25 % of the true value. Counts are 16 bit; when one would
+ * overflow, all of them are halved, which keeps their ratios and lets
+ * recent wakes weigh a little more. Halving rounds up, so a bucket that
+ * saw a rare slow wake keeps it; with at least 32768 counts left after a
+ * halving, the few such buckets cannot move p99.
+ *
+ * Nothing here depends on ESP-IDF, it builds and runs on the host;
+ * tools/phasecheck.c checks the percentiles after many halvings.
+ */
+
+#define PHASE_STATS_BUCKETS 92          /*!< Up to 2^24 us, about 16.8 s; longer durations share the last */
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint16_t hist[PHASE_STATS_BUCKETS];
+} phase_stats_t;
+
+void phase_stats_reset(phase_stats_t *stats);
+
+void phase_stats_add(phase_stats_t *stats, uint32_t us);
+
+/* 0 while empty */
+uint32_t phase_stats_mean(const phase_stats_t *stats);
+
+/* Upper edge of the bucket holding the pct-th percentile, capped at max; 0 while empty */
+uint32_t phase_stats_percentile(const phase_stats_t *stats, unsigned pct);
+
+/* "name,count,min_us,mean_us,p99_us,max_us\n" into buf; returns the length as snprintf does */
+int phase_stats_format(const phase_stats_t *stats, const char *name, char *buf, size_t len);
+
+#define PHASE_STATS_CSV_HEADER "phase,count,min_us,mean_us,p99_us,max_us\n"
+
+#endif // PHASE_STATS_H
@@ -17,6 +17,7 @@
 #include <string.h>
 #include <assert.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <dirent.h>
 #include <inttypes.h>
 #include "sdkconfig.h"
@@ -43,6 +44,20 @@
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "deep_sleep_example.h"
+#include "ulp_sampler.h"
+#include "adc_trigger.h"
+#include "trend_compress.h"
+#include "clock_sync.h"
+#include "log_stage.h"
+#include "SD.h"
+#include "sd_io.h"
+#include "wake_stub.h"
+#include "init_graph.h"
+#include "phase_prof.h"
+#include "wake_sched.h"
+#include "shutdown.h"
+#include "log_writer.h"
+#include "log_format.h"
 #if SOC_RTC_FAST_MEM_SUPPORTED
 static RTC_DATA_ATTR struct timeval sleep_enter_time;
 #else
@@ -54,19 +69,72 @@ static struct timeval sleep_enter_time;
 static const char *TAG = "example";
 #define EXAMPLE_MAX_CHAR_SIZE 32
 static RTC_DATA_ATTR esp_sleep_wakeup_cause_t wakeup_reason;
-#define MOUNT_POINT "/sdcard"
+// The compressor carries its open segment across deep sleep, NOINIT so
+// its pending record survives a reset along with the stage
+static RTC_NOINIT_ATTR trend_compressor_t log_compressor;
+// Records wait here between SD flushes, NOINIT so they also survive a reset
+static RTC_NOINIT_ATTR log_stage_t log_stage;
+// Day file kept open while awake, closed before deep sleep
+static log_writer_t day_writer;
+_Static_assert(FILE_PATH_MAX <= LOG_WRITER_PATH_MAX, "the day writer holds any day file path");
 #define MNT_PATH "/usb"
 #define APP_QUIT_PIN GPIO_NUM_0
 #define BUFFER_SIZE 4096
-// Pin assignments can be set in menuconfig, see "SD SPI Example Configuration" menu.
-// You can also change the pin assignments here by changing the following 4 lines.
-#define PIN_NUM_MISO 14
-#define PIN_NUM_MOSI 13
-#define PIN_NUM_CLK 12
-#define PIN_NUM_CS 11
+// Optional compression stage between the ADC scan and the SD card,
+// TREND_MODE_OFF writes every record
+#define LOG_COMPRESS_MODE TREND_MODE_OFF
+#define LOG_COMPRESS_TOLERANCE_MV 10
+// Day files in the binary log_format (.dlg, see tools/log2csv.c), 0 for CSV lines
+#define LOG_FILE_BINARY 1
+// Most a CSV file is read back on open to cut a torn last line
+#define LOG_FILE_TAIL_BLOCK 4096
+#if LOG_FILE_BINARY
+// Encoder state of the day writer's current session
+static log_format_state_t day_format;
+// Contiguous extent reserved for a new day file, about a day of records at 1 s
+#define LOG_FILE_PREALLOC_BYTES (64 * 1024)
+#endif
+static esp_err_t log_file_commit(void);
+// Timer wakes follow per-channel deadlines; the ULP and the DS3231 alarm
+// keep their own cadence and sample every channel
+#define LOG_SCHED_ENABLE (!ULP_SAMPLER_ENABLE && !DS3231_ALARM_WAKE_ENABLE)
+// Channels without an interval_s of their own in adc_reader_channels[]
+#define LOG_INTERVAL_S WAKE_STUB_PERIOD_S
+// A channel due this soon is sampled on the current wake
+#define LOG_SCHED_MERGE_MS 250
+#define LOG_SCHED_MIN_SLEEP_MS 100
+// Bound of the learned head start for boot time
+#define LOG_SCHED_MAX_LEAD_MS 2000
+#if LOG_SCHED_ENABLE
+// One task per ADC channel, deadlines on the corrected clock
+static RTC_DATA_ATTR wake_sched_t log_sched;
+#endif
+#if WAKE_STUB_ENABLE
+// The stub sampled since the last full boot, its deadlines are not late
+static bool log_wake_stub_drained;
+#endif
+static void example_deep_sleep_register_rtc_timer_wakeup(void);
+// Last reading of every channel, records repeat it for channels not due
+static RTC_DATA_ATTR int log_held_mv[ADC_READER_MAX_CHANNELS];
+#if SD_RING_ENABLE
+// Flushes go to the raw ring, day files are exported from it on an extraction wake
+static sd_ring_t log_ring;
+static sd_ring_reader_t log_ring_reader;
+static bool log_ring_mounted;
+// Ring head at the last flush, spares scanning the whole ring on the next wake
+static RTC_DATA_ATTR uint32_t log_ring_hint = SD_RING_NO_HINT;
+#endif
 
 static bool dev_present = false;
 
+// Work deep sleep waits for, see shutdown.h
+enum
+{
+    APP_WORK_LOG, // This wake's sample, up to staged or flushed
+    APP_WORK_I2C, // DS3231 clock read and alarm
+    APP_WORK_USB, // USB host installed for an extraction
+};
+
 /**
  * @brief Application Queue and its messages ID
  */
@@ -158,6 +226,7 @@ static void print_device_info(msc_host_device_info_t *info)
 }
 static void usb_task(void *args)
 {
+    shutdown_hold(BIT(APP_WORK_USB));
     const usb_host_config_t host_config = {.intr_flags = ESP_INTR_FLAG_LEVEL1};
     ESP_ERROR_CHECK(usb_host_install(&host_config));
 
@@ -193,6 +262,7 @@ static void usb_task(void *args)
     vTaskDelay(10); // Give clients some time to uninstall
     ESP_LOGI(TAG, "Deinitializing USB");
     ESP_ERROR_CHECK(usb_host_uninstall());
+    shutdown_release(BIT(APP_WORK_USB));
     vTaskDelete(NULL);
 }
 
@@ -279,9 +349,7 @@ static void deep_sleep_task(void *args)
     nvs_get_i32(nvs_handle, "slp_enter_usec", (int32_t *)&sleep_enter_time.tv_usec);
 #endif
 
-    
-
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
+    phase_prof_begin(PHASE_SLEEP_ENTRY);
 
 #if CONFIG_IDF_TARGET_ESP32
     // Isolate GPIO12 pin from external circuits. This is needed for modules
@@ -303,9 +371,34 @@ static void deep_sleep_task(void *args)
     nvs_close(nvs_handle);
 #endif
 
+    // Unsynced records would be lost with the RAM
+    log_file_commit();
+    log_writer_close(&day_writer);
+    sd_card_power_off();
+#if WAKE_STUB_ENABLE
+    wake_stub_arm();
+#endif
+#if LOG_SCHED_ENABLE
+    // Armed last, so the time spent awake does not stretch the period
+    example_deep_sleep_register_rtc_timer_wakeup();
+#endif
+    phase_prof_end(PHASE_SLEEP_ENTRY);
+    phase_prof_sleep();
+
     // enter deep sleep
     esp_deep_sleep_start();
 }
+static void schedule_deep_sleep(void)
+{
+#if ADC_TRIGGER_MODE_ENABLE
+    // Trigger mode stays awake waiting for threshold events
+    printf("Trigger mode, not entering deep sleep\n");
+#else
+    // Runs deep_sleep_task() once the logging path and any transfers are done
+    shutdown_request(deep_sleep_task, NULL, SHUTDOWN_TIMEOUT_MS);
+#endif
+}
+
 static esp_err_t s_example_write_file(const char *path, char *data)
 {
     ESP_LOGI(TAG, "Opening file %s", path);
@@ -322,12 +415,46 @@ static esp_err_t s_example_write_file(const char *path, char *data)
     return ESP_OK;
 }
 
+#if LOG_SCHED_ENABLE
+_Static_assert(ADC_READER_MAX_CHANNELS <= WAKE_SCHED_MAX_TASKS, "a schedule task per ADC channel");
+
+static int64_t log_sched_now_us(void)
+{
+    struct timeval now;
+    clock_sync_gettimeofday(&now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+#endif
+
 static void example_deep_sleep_register_rtc_timer_wakeup(void)
 {
-    const int wakeup_time_sec = 30;
-    printf("Enabling timer wakeup, %ds\n", wakeup_time_sec);
-    ESP_ERROR_CHECK(esp_sleep_enable_timer_wakeup(wakeup_time_sec * 1000000));
+    int64_t sleep_us = LOG_INTERVAL_S * 1000000LL;
+#if LOG_SCHED_ENABLE
+    if (wake_sched_valid(&log_sched, adc_reader_channel_count))
+    {
+        sleep_us = wake_sched_sleep_us(&log_sched, log_sched_now_us());
+    }
+#endif
+    printf("Enabling timer wakeup, %lldms\n", (long long)(sleep_us / 1000));
+    ESP_ERROR_CHECK(esp_sleep_enable_timer_wakeup(sleep_us));
 }
+#if DS3231_ALARM_WAKE_ENABLE && !ULP_SAMPLER_ENABLE
+static void schedule_rtc_alarm(void)
+{
+    struct timeval now;
+    clock_sync_gettimeofday(&now);
+    time_t next = ds3231_next_aligned(now.tv_sec, DS3231_ALARM_PERIOD_S, DS3231_ALARM_GUARD_S);
+
+    esp_err_t ret = ds3231_set_alarm1(next);
+    if (ret != ESP_OK)
+    {
+        // Without the alarm the INT line may never fall, keep the timer as a fallback
+        ESP_LOGW(TAG, "Failed to program the DS3231 alarm (%s), falling back to the timer", esp_err_to_name(ret));
+        example_deep_sleep_register_rtc_timer_wakeup();
+    }
+}
+#endif // DS3231_ALARM_WAKE_ENABLE
+
 // static esp_err_t transfer_data()
 // {
 //     FILE *fptr1, *fptr2;
@@ -400,10 +527,405 @@ static void example_deep_sleep_register_rtc_timer_wakeup(void)
 
 //     return ESP_OK;
 // }
-void log_data()
+#if LOG_FILE_BINARY
+/* Schema of the reader channels and the calibration in use, for new files */
+static size_t log_file_header(uint8_t *buf, size_t n_channels)
+{
+    const adc_cal_lut_t *lut = adc_reader_get_cal_lut();
+    log_format_header_t hdr = {
+        .cal_id = lut ? lut->checksum : 0,
+        .n_channels = n_channels,
+    };
+    strncpy(hdr.machine_id, LOG_MACHINE_ID, sizeof(hdr.machine_id));
+    for (size_t i = 0; i < n_channels && i < adc_reader_channel_count; i++)
+    {
+        hdr.channels[i].adc_channel = adc_reader_channels[i].channel;
+        hdr.channels[i].atten = adc_reader_channels[i].atten;
+        // The display names do not fit the field, the channel number is unique
+        snprintf(hdr.channels[i].name, sizeof(hdr.channels[i].name), "ch%d", (int)adc_reader_channels[i].channel);
+    }
+    size_t len = log_format_write_header(buf, &hdr);
+    // No records yet
+    log_format_write_data_end(buf + LOG_FORMAT_DATA_END_OFFSET, len);
+    return len;
+}
+
+// Reach of the tail scan: two segments before data_end and one after it
+#define LOG_RECOVER_SPAN (LOG_FORMAT_SEGMENT_MAX + LOG_FORMAT_CHECKPOINT_LEN)
+static uint8_t log_recover_buf[3 * LOG_RECOVER_SPAN];
+
+/**
+ * @brief Find where appending resumes in an existing version 3 day file
+ *
+ * Reads at most three segments around data_end rather than the file, and
+ * drops whatever follows the last segment whose CRC matches.
+ */
+static size_t log_day_file_recover(int fd, size_t header_len, size_t data_end, size_t file_size, uint32_t *seq)
 {
-    char output_path[32];
+    size_t from = data_end > header_len + 2 * LOG_RECOVER_SPAN ? data_end - 2 * LOG_RECOVER_SPAN : header_len;
+    size_t to = file_size < data_end + LOG_RECOVER_SPAN ? file_size : data_end + LOG_RECOVER_SPAN;
 
+    ssize_t n = pread(fd, log_recover_buf, to - from, from);
+    if (n < 0)
+    {
+        *seq = 0;
+        return data_end;
+    }
+    long end = log_format_recover(log_recover_buf, n, data_end - from, from == header_len, seq);
+    // Damage reaching back two whole segments, keep what the header says
+    return end < 0 ? data_end : from + (size_t)end;
+}
+
+/**
+ * @brief Open a day file at the logical end of its records
+ *
+ * A new file is created with a contiguous LOG_FILE_PREALLOC_BYTES extent,
+ * so appends during the day never have to extend the FAT chain, and gets
+ * its header. If the card has no room for the extent the file grows as
+ * usual. An existing file resumes after its last intact segment.
+ *
+ * @param[out] checkpoint_seq Last checkpoint in the file, 0 for none
+ */
+static esp_err_t log_day_file_open(const char *path, size_t n_channels, uint32_t *checkpoint_seq)
+{
+    uint8_t buf[LOG_FORMAT_HEADER_MAX];
+    struct stat st;
+
+    *checkpoint_seq = 0;
+    if (stat(path, &st) == 0)
+    {
+        size_t end = st.st_size;
+        int fd = open(path, O_RDONLY);
+        if (fd >= 0)
+        {
+            log_format_header_t hdr;
+            ssize_t n = read(fd, buf, sizeof(buf));
+            int header_len = n > 0 ? log_format_read_header(buf, n, &hdr) : -1;
+            // Version 1 files and a damaged header fall back to the file size
+            if (header_len > 0 && hdr.data_end >= (uint32_t)header_len && hdr.data_end <= (uint32_t)st.st_size)
+            {
+                end = hdr.data_end;
+                if (hdr.version >= 3)
+                {
+                    end = log_day_file_recover(fd, header_len, end, st.st_size, checkpoint_seq);
+                }
+                if (end != hdr.data_end)
+                {
+                    ESP_LOGW(TAG, "%s: records end at %u, header said %u", path, (unsigned)end, (unsigned)hdr.data_end);
+                }
+            }
+            close(fd);
+        }
+        return log_writer_open_at(&day_writer, path, end);
+    }
+
+    esp_err_t ret = esp_vfs_fat_create_contiguous_file(MOUNT_POINT, path, LOG_FILE_PREALLOC_BYTES, true);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to preallocate %s (%s), growing it instead", path, esp_err_to_name(ret));
+    }
+    ret = log_writer_open_at(&day_writer, path, 0);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+    size_t len = log_file_header(buf, n_channels);
+    return log_writer_append(&day_writer, buf, len);
+}
+#else
+// "HH:MM:SS" plus ",<mV>" per channel and the newline
+#define LOG_RECORD_MAX_LEN (16 + ADC_READER_MAX_CHANNELS * 8)
+
+static int format_record(char *buf, size_t size, int seconds_of_day, const int *voltages, size_t n_channels)
+{
+    int len = snprintf(buf, size, "%02d:%02d:%02d",
+                       seconds_of_day / 3600,
+                       (seconds_of_day / 60) % 60,
+                       seconds_of_day % 60);
+    for (size_t i = 0; i < n_channels; i++)
+    {
+        len += snprintf(buf + len, size - len, ",%d", voltages[i]);
+    }
+    len += snprintf(buf + len, size - len, "\n");
+    return len;
+}
+#endif // LOG_FILE_BINARY
+
+/**
+ * @brief Cut a line torn by a reset or brownout off the end of a CSV file
+ *
+ * Only the last block is read, whatever the file size.
+ */
+static void log_csv_recover(const char *path)
+{
+    static char tail[LOG_FILE_TAIL_BLOCK];
+    struct stat st;
+
+    if (stat(path, &st) != 0 || st.st_size == 0)
+    {
+        return;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+    off_t from = st.st_size > LOG_FILE_TAIL_BLOCK ? st.st_size - LOG_FILE_TAIL_BLOCK : 0;
+    ssize_t n = pread(fd, tail, st.st_size - from, from);
+    close(fd);
+    if (n <= 0 || tail[n - 1] == '\n')
+    {
+        return;
+    }
+
+    ssize_t i = n - 1;
+    while (i >= 0 && tail[i] != '\n')
+    {
+        i--;
+    }
+    off_t end = from + i + 1;
+    ESP_LOGW(TAG, "%s: dropping a torn line of %ld bytes", path, (long)(st.st_size - end));
+    if (truncate(path, end) != 0)
+    {
+        ESP_LOGE(TAG, "Failed to truncate %s: %s", path, strerror(errno));
+    }
+}
+
+/**
+ * @brief Make everything appended to the day writer's file durable
+ *
+ * A binary day file gets a checkpoint closing the segment first. The
+ * header's data_end is then moved past the records, synced separately so
+ * it never points at data not yet on the card.
+ */
+static esp_err_t log_file_commit(void)
+{
+    esp_err_t ret = ESP_OK;
+#if LOG_FILE_BINARY
+    size_t n = strlen(day_writer.path);
+    bool binary = n > 4 && strcmp(day_writer.path + n - 4, LOG_FORMAT_FILE_EXT) == 0;
+    if (log_writer_is_open(&day_writer) && binary)
+    {
+        uint8_t checkpoint[LOG_FORMAT_CHECKPOINT_LEN];
+        size_t len = log_format_checkpoint(&day_format, checkpoint);
+        if (len > 0)
+        {
+            ret = log_writer_append(&day_writer, checkpoint, len);
+        }
+    }
+#endif
+    if (ret == ESP_OK)
+    {
+        ret = log_writer_sync(&day_writer);
+    }
+#if LOG_FILE_BINARY
+    if (ret == ESP_OK && log_writer_is_open(&day_writer) && binary)
+    {
+        uint8_t field[4];
+        log_format_write_data_end(field, day_writer.file_size);
+        ret = log_writer_patch(&day_writer, LOG_FORMAT_DATA_END_OFFSET, field, sizeof(field));
+        if (ret == ESP_OK)
+        {
+            ret = log_writer_sync(&day_writer);
+        }
+    }
+#endif
+    return ret;
+}
+
+/* Make the day file for date the open one */
+static esp_err_t log_day_file_select(const struct tm *date, size_t n_channels)
+{
+    char output_path[FILE_PATH_MAX];
+    esp_err_t ret = get_file_path(output_path, sizeof(output_path), date);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+#if LOG_FILE_BINARY
+    strcpy(strrchr(output_path, '.'), LOG_FORMAT_FILE_EXT);
+    if (log_writer_is_open(&day_writer) && strcmp(day_writer.path, output_path) == 0)
+    {
+        return ESP_OK;
+    }
+    // The file being left keeps the end of what was written to it
+    uint32_t checkpoint_seq = 0;
+    ret = log_file_commit();
+    if (ret == ESP_OK)
+    {
+        ret = log_day_file_open(output_path, n_channels, &checkpoint_seq);
+    }
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+    // Every session starts with a sync record, checkpoints keep counting
+    log_format_reset(&day_format, n_channels);
+    day_format.checkpoint_seq = checkpoint_seq;
+    return ESP_OK;
+#else
+    if (strcmp(day_writer.path, output_path) != 0)
+    {
+        log_csv_recover(output_path);
+    }
+    return log_writer_open(&day_writer, output_path);
+#endif
+}
+
+/**
+ * @brief Append one record to the day file of its timestamp
+ *
+ * The day writer keeps the file open, so a run of records from the same
+ * day costs one open.
+ */
+static esp_err_t log_record(time_t t, const int *voltages, size_t n_channels)
+{
+    struct tm date;
+    gmtime_r(&t, &date);
+    esp_err_t ret = log_day_file_select(&date, n_channels);
+    if (ret == ESP_FAIL)
+    {
+        // The path cache skips creating directories it made before on this
+        // card; if they were removed since, make them again and retry once
+        ESP_LOGW(TAG, "Failed to open the day file, creating its directories again");
+        get_file_path_invalidate();
+        ret = log_day_file_select(&date, n_channels);
+    }
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+#if LOG_FILE_BINARY
+    uint8_t buf[LOG_FORMAT_CHECKPOINT_LEN + LOG_FORMAT_RECORD_MAX];
+    size_t len = 0;
+    if (log_format_checkpoint_due(&day_format))
+    {
+        len = log_format_checkpoint(&day_format, buf);
+    }
+    int32_t values[LOG_FORMAT_MAX_CHANNELS];
+    for (size_t i = 0; i < n_channels; i++)
+    {
+        values[i] = voltages[i];
+    }
+    len += log_format_encode(&day_format, (uint32_t)t, values, buf + len);
+    return log_writer_append(&day_writer, buf, len);
+#else
+    char line[LOG_RECORD_MAX_LEN];
+    int seconds_of_day = date.tm_hour * 3600 + date.tm_min * 60 + date.tm_sec;
+    int len = format_record(line, sizeof(line), seconds_of_day, voltages, n_channels);
+    return log_writer_append(&day_writer, line, len);
+#endif
+}
+
+/* Stage one record released by the compressor */
+static void log_compressed_stage(const trend_point_t *point, size_t n_channels)
+{
+    int kept_voltages[TREND_MAX_CHANNELS];
+    for (size_t i = 0; i < n_channels; i++)
+    {
+        kept_voltages[i] = point->v[i];
+    }
+    if (!log_stage_append(&log_stage, (uint32_t)point->t, kept_voltages, n_channels))
+    {
+        ESP_LOGE(TAG, "Staging area full, record dropped");
+    }
+}
+
+/**
+ * @brief Stage the record the compressor holds back, if any
+ *
+ * Ends the open segment, so the day file is complete up to the last
+ * sample. Deep sleep keeps the compressor in RTC memory, flushing before
+ * every sleep would end a segment on each wake and keep every record.
+ */
+static void log_compress_flush(void)
+{
+    trend_point_t pending;
+    if (log_compressor.magic == TREND_MAGIC && trend_compress_flush(&log_compressor, &pending))
+    {
+        log_compressed_stage(&pending, log_compressor.n_channels);
+    }
+}
+
+/**
+ * @brief Pass a record through the compression stage into the staging area
+ *
+ * Stages zero, one or two records: the compressor may hold this one back
+ * and release the previous one as the end point of a segment. A record of
+ * a new UTC day starts a new series, so every day file begins and ends
+ * with a kept record.
+ */
+static void log_compressed(time_t t, const int *voltages, size_t n_channels)
+{
+    int32_t tolerance[TREND_MAX_CHANNELS];
+    int32_t values[TREND_MAX_CHANNELS];
+    for (size_t i = 0; i < n_channels; i++)
+    {
+        tolerance[i] = LOG_COMPRESS_TOLERANCE_MV;
+        values[i] = voltages[i];
+    }
+
+    if (!trend_compress_matches(&log_compressor, LOG_COMPRESS_MODE, n_channels, tolerance))
+    {
+        // A pending record from another configuration still belongs in its file
+        log_compress_flush();
+        trend_compress_init(&log_compressor, LOG_COMPRESS_MODE, n_channels, tolerance);
+    }
+    else if (log_compressor.has_pending && log_compressor.pending.t / 86400 != t / 86400)
+    {
+        log_compress_flush();
+        trend_compress_init(&log_compressor, LOG_COMPRESS_MODE, n_channels, tolerance);
+    }
+
+    trend_point_t kept[TREND_MAX_EMIT];
+    int n_kept = trend_compress_push(&log_compressor, t, values, kept);
+    for (int k = 0; k < n_kept; k++)
+    {
+        log_compressed_stage(&kept[k], n_channels);
+    }
+    printf("Compression kept %" PRIu32 " of %" PRIu32 " records\n",
+           log_compressor.n_out, log_compressor.n_in);
+}
+
+/**
+ * @brief Channels to sample on this wake, bit n for adc_reader_channels[n]
+ *
+ * Sets the schedule up on the first wake, where every channel is due.
+ */
+static uint32_t log_sched_due(void)
+{
+#if LOG_SCHED_ENABLE
+    if (!wake_sched_valid(&log_sched, adc_reader_channel_count))
+    {
+        wake_sched_init(&log_sched, LOG_SCHED_MERGE_MS * 1000LL, LOG_SCHED_MIN_SLEEP_MS * 1000LL,
+                        LOG_SCHED_MAX_LEAD_MS * 1000LL);
+        for (size_t i = 0; i < adc_reader_channel_count; i++)
+        {
+            uint32_t interval_s = adc_reader_channels[i].interval_s ? adc_reader_channels[i].interval_s : LOG_INTERVAL_S;
+            wake_sched_add(&log_sched, interval_s * 1000000LL);
+        }
+    }
+    int64_t now_us = log_sched_now_us();
+    bool timer_wake = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER;
+#if WAKE_STUB_ENABLE
+    if (log_wake_stub_drained)
+    {
+        // The stub met the deadlines since the last full boot; this boot
+        // is its high-water mark or another cause, not a planned deadline
+        wake_sched_cover(&log_sched, now_us);
+        timer_wake = false;
+    }
+#endif
+    return wake_sched_due(&log_sched, now_us, timer_wake);
+#else
+    return UINT32_MAX;
+#endif
+}
+
+void log_data()
+{
     //     char dir_path[64];
     //     char file_path[256];
     //     const char *dir_name = "mydir/jeeldata";
@@ -431,28 +953,26 @@ void log_data()
 
     // ds3231_get_datetime();
 
-    int voltage1 = adc_reader_get_value1();
-    int voltage2 = adc_reader_get_value2();
-
-    printf("ADC1 Channel 3: %d mV\n", voltage1);
-    printf("ADC1 Channel 4: %d mV\n", voltage2);
+    uint32_t due = log_sched_due();
+    if (due == 0)
+    {
+        printf("No channel due yet\n");
+        return;
+    }
 
-    ds3231_time_t current_time = ds3231_get_time();
-    char time_str[20];
-    snprintf(time_str, sizeof(time_str), "%02d:%02d:%02d",
-             bcd_to_dec(current_time.hours),
-             bcd_to_dec(current_time.minutes),
-             bcd_to_dec(current_time.seconds));
-    printf("Time: %s, Voltage1: %d, Voltage2: %d\n", time_str, voltage1, voltage2);
-    char test_string[32];
-    snprintf(test_string, 32, "%s,%d,%d\n", time_str, voltage1, voltage2);
-    printf("%s\n", test_string);
+    struct timeval now;
+    clock_sync_gettimeofday(&now);
 
-    get_file_path(output_path);
-    printf("%s \n", output_path);
-    // printf("%s \n", log_data);
+    size_t n_channels = adc_reader_scan_mask(due, NULL, log_held_mv, ADC_READER_MAX_CHANNELS);
+    int voltages[ADC_READER_MAX_CHANNELS];
+    for (size_t i = 0; i < n_channels; i++)
+    {
+        voltages[i] = log_held_mv[i];
+        printf("%s: %d mV%s\n", adc_reader_channels[i].name, voltages[i], (due & BIT(i)) ? "" : " (held)");
+    }
 
-    s_example_write_file(output_path, test_string);
+    log_compressed(now.tv_sec, voltages, n_channels);
+    printf("Staged %" PRIu32 " of %d bytes\n", log_stage.used, LOG_STAGE_BYTES);
 
     // ESP_LOGI(TAG, "Opening file %s", output_path);
     // FILE *f = fopen(output_path, "a");
@@ -467,6 +987,327 @@ void log_data()
     // ESP_LOGI(TAG, "File written");
 }
 
+#if SD_RING_ENABLE
+static esp_err_t log_ring_open(void)
+{
+    if (log_ring_mounted)
+    {
+        return ESP_OK;
+    }
+    sd_ring_dev_t dev;
+    esp_err_t ret = sd_card_ring_dev(&dev);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+    if (sd_ring_mount(&log_ring, &dev, log_ring_hint) != 0)
+    {
+        ESP_LOGE(TAG, "Failed to mount the record ring");
+        return ESP_FAIL;
+    }
+    log_ring_mounted = true;
+    return ESP_OK;
+}
+
+/* One ring record: t:4 then an int16 mV per channel, little endian (tools/ringdump.c) */
+static esp_err_t log_ring_record(time_t t, const int *voltages, size_t n_channels)
+{
+    uint8_t rec[4 + 2 * LOG_STAGE_MAX_CHANNELS];
+    uint32_t t32 = (uint32_t)t;
+
+    for (int i = 0; i < 4; i++)
+    {
+        rec[i] = (uint8_t)(t32 >> (8 * i));
+    }
+    for (size_t i = 0; i < n_channels; i++)
+    {
+        rec[4 + 2 * i] = (uint8_t)voltages[i];
+        rec[5 + 2 * i] = (uint8_t)(voltages[i] >> 8);
+    }
+    return sd_ring_append(&log_ring, rec, 4 + 2 * n_channels) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t log_ring_commit(void)
+{
+    if (sd_ring_flush(&log_ring) != 0)
+    {
+        return ESP_FAIL;
+    }
+    log_ring_hint = sd_ring_head(&log_ring);
+    return ESP_OK;
+}
+
+/**
+ * @brief Write the ring records added since the last export to the day files
+ *
+ * The export mark only moves once the day files are committed, so an
+ * interrupted export is repeated from the same place.
+ */
+static esp_err_t log_ring_export(void)
+{
+    uint8_t rec[SD_RING_RECORD_MAX];
+    size_t len;
+    unsigned long n_records = 0;
+    int ret;
+
+    esp_err_t err = log_ring_open();
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    sd_ring_read_begin(&log_ring, &log_ring_reader);
+    while ((ret = sd_ring_read_next(&log_ring, &log_ring_reader, rec, &len)) > 0)
+    {
+        if (len < 6 || (len - 4) / 2 > LOG_STAGE_MAX_CHANNELS)
+        {
+            continue;
+        }
+        size_t n_channels = (len - 4) / 2;
+        int voltages[LOG_STAGE_MAX_CHANNELS];
+        for (size_t i = 0; i < n_channels; i++)
+        {
+            voltages[i] = (int16_t)(rec[4 + 2 * i] | (rec[5 + 2 * i] << 8));
+        }
+        time_t t = (time_t)((uint32_t)rec[0] | ((uint32_t)rec[1] << 8) |
+                            ((uint32_t)rec[2] << 16) | ((uint32_t)rec[3] << 24));
+        err = log_record(t, voltages, n_channels);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        n_records++;
+    }
+    if (ret < 0)
+    {
+        ESP_LOGE(TAG, "Failed to read the record ring");
+        return ESP_FAIL;
+    }
+
+    err = log_file_commit();
+    if (err == ESP_OK && sd_ring_mark_exported(&log_ring, &log_ring_reader) != 0)
+    {
+        err = ESP_FAIL;
+    }
+    printf("Exported %lu ring records, %" PRIu32 " damaged segments skipped, %" PRIu32 " overwritten unexported\n",
+           n_records, log_ring_reader.n_skipped, log_ring.n_overwritten);
+    return err;
+}
+#endif // SD_RING_ENABLE
+
+/**
+ * @brief Write the staged records to their day files, or the ring, and empty the stage
+ */
+static esp_err_t log_stage_flush(void)
+{
+    log_stage_record_t record;
+    size_t offset = 0;
+    esp_err_t ret = ESP_OK;
+
+    // The card gets everything sampled so far, not all but the last record
+    log_compress_flush();
+
+#if SD_RING_ENABLE
+    ret = log_ring_open();
+#endif
+    while (ret == ESP_OK && log_stage_next(&log_stage, &offset, &record))
+    {
+        int voltages[LOG_STAGE_MAX_CHANNELS];
+        for (size_t i = 0; i < record.n_channels; i++)
+        {
+            voltages[i] = record.mv[i];
+        }
+#if SD_RING_ENABLE
+        ret = log_ring_record(record.t, voltages, record.n_channels);
+#else
+        ret = log_record(record.t, voltages, record.n_channels);
+#endif
+    }
+    // The stage is only dropped once the records are on the card for good
+    if (ret == ESP_OK)
+    {
+#if SD_RING_ENABLE
+        ret = log_ring_commit();
+#else
+        ret = log_file_commit();
+#endif
+    }
+
+    // Keep the records for the next flush if any write failed
+    if (ret == ESP_OK)
+    {
+        printf("Flushed %u staged bytes to SD\n", (unsigned)offset);
+        log_stage_reset(&log_stage);
+    }
+    return ret;
+}
+
+#if ULP_SAMPLER_ENABLE
+/**
+ * @brief Stage everything the ULP sampled while the main core slept
+ *
+ * The ULP has no clock, so sample times are reconstructed backwards from the
+ * synced system time using the fixed ULP period. The sets go through the
+ * compressor before this wake's record, so the files stay in time order.
+ * A full ring holds more than the stage, which is flushed whenever it
+ * reaches its high-water mark; the card must be up.
+ */
+static void log_ulp_batch(void)
+{
+    static ulp_ring_sample_t batch[ULP_RING_CAPACITY];
+
+    size_t n = ulp_sampler_drain(batch, ULP_RING_CAPACITY);
+    if (n == 0)
+    {
+        return;
+    }
+    printf("Staging %u samples buffered by the ULP\n", (unsigned)n);
+
+    // Flushes here come before app_main hands out the card
+    sdmmc_card_t *card;
+    sd_card_mount(&card);
+    get_file_path_set_card(card->cid.serial);
+
+    struct timeval tv;
+    clock_sync_gettimeofday(&tv);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        time_t t = tv.tv_sec - (time_t)(n - 1 - i) * ULP_SAMPLER_PERIOD_S;
+        int voltages[ULP_RING_CHANNELS];
+        for (int ch = 0; ch < ULP_RING_CHANNELS; ch++)
+        {
+            voltages[ch] = adc_reader_raw_to_mv(batch[i].raw[ch]);
+        }
+        log_compressed(t, voltages, ULP_RING_CHANNELS);
+        if (log_stage_needs_flush(&log_stage) && log_stage_flush() != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to flush staged records, keeping them for the next wake");
+        }
+    }
+}
+#endif // ULP_SAMPLER_ENABLE
+
+#if WAKE_STUB_ENABLE
+_Static_assert(2 * (WAKE_STUB_HIGH_WATER + 2) * LOG_STAGE_RECORD_LEN(WAKE_STUB_CHANNELS) <= LOG_STAGE_BYTES,
+               "the stage holds two full boots' worth of stub records");
+
+/**
+ * @brief True if the stage has to be flushed on this wake to make room for the stub
+ *
+ * The card is decided on before the stub's batch is staged, and the stage
+ * is only flushed after it. What is left has to take this wake's batch
+ * and record, the record the compressor releases on a flush, and the
+ * largest batch the next full boot can bring, or records are dropped.
+ */
+static bool log_wake_stub_needs_flush(void)
+{
+    size_t n_channels = adc_reader_channel_count > WAKE_STUB_CHANNELS ? adc_reader_channel_count : WAKE_STUB_CHANNELS;
+    size_t record = LOG_STAGE_RECORD_LEN(n_channels);
+    size_t this_wake = (wake_stub_pending() + 2) * record;
+    size_t next_wake = (WAKE_STUB_HIGH_WATER + 2) * record;
+    return log_stage.used + this_wake + next_wake > LOG_STAGE_BYTES;
+}
+
+/**
+ * @brief Stage the samples the wake stub took since the last full boot
+ *
+ * Each record carries its age on the RTC counter, so its time comes from
+ * the synced system time rather than from the nominal period.
+ */
+static void log_wake_stub_batch(void)
+{
+    static wake_stub_sample_t batch[WAKE_STUB_CAPACITY];
+
+    size_t n = wake_stub_drain(batch, WAKE_STUB_CAPACITY);
+    if (n == 0)
+    {
+        return;
+    }
+    printf("Staging %u samples taken by the wake stub\n", (unsigned)n);
+    log_wake_stub_drained = true;
+
+    struct timeval tv;
+    clock_sync_gettimeofday(&tv);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        time_t t = tv.tv_sec - (time_t)((batch[i].age_us + 500000) / 1000000);
+        int voltages[WAKE_STUB_CHANNELS];
+        for (int ch = 0; ch < WAKE_STUB_CHANNELS; ch++)
+        {
+            voltages[ch] = adc_reader_raw_to_mv(batch[i].raw[ch]);
+        }
+        log_compressed(t, voltages, WAKE_STUB_CHANNELS);
+    }
+}
+#endif // WAKE_STUB_ENABLE
+
+#if ADC_TRIGGER_MODE_ENABLE
+/**
+ * @brief Append one burst frame to the day's trigger file
+ *
+ * Bursts go next to the day's CSV with a .trg extension, one
+ * "timestamp_us,channel,mV" line per conversion.
+ */
+static void log_burst_frame(const adc_frame_t *frame)
+{
+    static char burst_lines[ADC_FRAME_MAX_SAMPLES * 24];
+    int mv[ADC_FRAME_MAX_SAMPLES];
+    char output_path[FILE_PATH_MAX];
+    struct timeval now;
+    struct tm date;
+
+    clock_sync_gettimeofday(&now);
+    gmtime_r(&now.tv_sec, &date);
+    if (get_file_path(output_path, sizeof(output_path), &date) != ESP_OK)
+    {
+        return;
+    }
+    strcpy(strrchr(output_path, '.'), ".trg");
+
+    adc_cal_lut_convert_frame(adc_reader_get_cal_lut(), ADC_ATTEN_DB_12, frame, mv, SOC_ADC_DIGI_MAX_BITWIDTH);
+
+    size_t len = 0;
+    for (size_t i = 0; i < frame->n_samples; i++)
+    {
+        int64_t t = frame->timestamp_us + (int64_t)i * frame->conv_period_ns / 1000;
+        len += snprintf(burst_lines + len, sizeof(burst_lines) - len, "%lld,%d,%d\n",
+                        (long long)t, frame->samples[i].channel, mv[i]);
+    }
+    // One sync per frame, bursts are rare and each one should survive a reset
+    if (strcmp(day_writer.path, output_path) != 0)
+    {
+        log_file_commit();
+        log_csv_recover(output_path);
+    }
+    if (log_writer_open(&day_writer, output_path) == ESP_OK &&
+        log_writer_append(&day_writer, burst_lines, len) == ESP_OK)
+    {
+        log_writer_sync(&day_writer);
+    }
+}
+
+static void trigger_mode_run(void)
+{
+    adc_stream_config_t stream_config = ADC_STREAM_CONFIG_DEFAULT();
+    stream_config.gated = true;
+    adc_trigger_config_t trigger_config = ADC_TRIGGER_CONFIG_DEFAULT();
+
+    // ADC1 moves from the oneshot driver to the continuous one
+    adc_reader_deinit();
+    ESP_ERROR_CHECK(adc_trigger_start(&stream_config, &trigger_config));
+
+    while (true)
+    {
+        const adc_frame_t *frame = adc_stream_peek_frame(1000);
+        if (frame)
+        {
+            log_burst_frame(frame);
+            adc_stream_release_frame();
+        }
+    }
+}
+#endif // ADC_TRIGGER_MODE_ENABLE
 
 void wake_checker()
 {
@@ -480,10 +1321,19 @@ void wake_checker()
     {
         printf("Wake up from timer. Time spent in deep sleep: %dms\n", sleep_time_ms);
         printf("sleeping after logging data \n");
-        xTaskCreate(deep_sleep_task, "deep_sleep_task", 4096, NULL, 6, NULL);
+        schedule_deep_sleep();
         break;
     }
 
+#if ULP_SAMPLER_ENABLE
+    case ESP_SLEEP_WAKEUP_ULP:
+    {
+        printf("Wake up from ULP, sample ring reached its high-water mark\n");
+        schedule_deep_sleep();
+        break;
+    }
+#endif // ULP_SAMPLER_ENABLE
+
 #if CONFIG_EXAMPLE_GPIO_WAKEUP
     case ESP_SLEEP_WAKEUP_GPIO:
     {
@@ -501,7 +1351,16 @@ void wake_checker()
     }
 #endif // CONFIG_EXAMPLE_GPIO_WAKEUP
 
-#if CONFIG_EXAMPLE_EXT0_WAKEUP
+#if DS3231_ALARM_WAKE_ENABLE
+    case ESP_SLEEP_WAKEUP_EXT0:
+    {
+        // The alarm flag is cleared when the next alarm is programmed
+        printf("Wake up from DS3231 alarm. Time spent in deep sleep: %dms\n", sleep_time_ms);
+        printf("sleeping after logging data \n");
+        schedule_deep_sleep();
+        break;
+    }
+#elif CONFIG_EXAMPLE_EXT0_WAKEUP
     case ESP_SLEEP_WAKEUP_EXT0:
     {
         printf("Wake up from ext0\n");
@@ -538,152 +1397,276 @@ void wake_checker()
     case ESP_SLEEP_WAKEUP_UNDEFINED:
     default:
         printf("Not a deep sleep reset\n");
-        xTaskCreate(deep_sleep_task, "deep_sleep_task", 4096, NULL, 6, NULL);
+        schedule_deep_sleep();
     }
 }
-void app_main(void)
-{   wake_checker();
-    example_deep_sleep_register_rtc_timer_wakeup();
+static esp_err_t app_init_adc(void)
+{
+#if ULP_SAMPLER_ENABLE
+    // The ULP must release ADC1 before the main core configures it
+    ulp_sampler_stop();
+#endif
+    phase_prof_begin(PHASE_ADC_INIT);
+    adc_reader_init();
+    phase_prof_end(PHASE_ADC_INIT);
+    return ESP_OK;
+}
 
-    /* Enable wakeup from deep sleep by ext1 */
-    example_deep_sleep_register_ext1_wakeup();
+static esp_err_t app_init_rtc(void)
+{
+    shutdown_hold(BIT(APP_WORK_I2C));
+    phase_prof_begin(PHASE_I2C_INIT);
+    esp_err_t ret = i2c_master_init();
+    phase_prof_end(PHASE_I2C_INIT);
+    if (ret != ESP_OK)
+    {
+        shutdown_release(BIT(APP_WORK_I2C));
+        return ret;
+    }
+    // One DS3231 read per wake at most, samples take their time from the system clock
+    ret = clock_sync_wake();
+    if (ret != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Clock sync failed (%s), using the free-running system clock", esp_err_to_name(ret));
+    }
+#if DS3231_ALARM_WAKE_ENABLE && !ULP_SAMPLER_ENABLE
+    schedule_rtc_alarm();
+#endif
+    shutdown_release(BIT(APP_WORK_I2C));
+    return ESP_OK;
+}
 
-    // Log the previous wakeup reason if this is not the first boot
-    if (wakeup_reason != ESP_SLEEP_WAKEUP_UNDEFINED)
+static esp_err_t app_init_nvs(void)
+{
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
     {
-        printf("Previous wakeup reason: %d\n", wakeup_reason);
+        // NVS partition was truncated and needs to be erased
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
     }
-    adc_reader_init();
-    app_queue = xQueueCreate(5, sizeof(app_message_t));
-    assert(app_queue);
+    return err;
+}
 
-    BaseType_t task_created = xTaskCreate(usb_task, "usb_task", 4096, NULL, 2, NULL);
-    assert(task_created);
+static esp_err_t app_init_sd(void)
+{
+    phase_prof_begin(PHASE_SD_MOUNT);
+    esp_err_t ret = sd_card_mount(NULL);
+    phase_prof_end(PHASE_SD_MOUNT);
+    return ret;
+}
 
-    // Init BOOT button: Pressing the button simulates app request to exit
-    // It will disconnect the USB device and uninstall the MSC driver and USB Host Lib
+static esp_err_t app_init_usb(void)
+{
+    app_queue = xQueueCreate(5, sizeof(app_message_t));
+    if (app_queue == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(usb_task, "usb_task", 4096, NULL, 2, NULL) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Waiting for USB flash drive to be connected");
+    return ESP_OK;
+}
+
+// Init BOOT button: Pressing the button simulates app request to exit
+// It will disconnect the USB device and uninstall the MSC driver and USB Host Lib
+static esp_err_t app_init_button(void)
+{
     const gpio_config_t input_pin = {
         .pin_bit_mask = BIT64(APP_QUIT_PIN),
         .mode = GPIO_MODE_INPUT,
         .pull_up_en = GPIO_PULLUP_ENABLE,
         .intr_type = GPIO_INTR_NEGEDGE,
     };
-    ESP_ERROR_CHECK(gpio_config(&input_pin));
-    ESP_ERROR_CHECK(gpio_install_isr_service(ESP_INTR_FLAG_LEVEL1));
-    ESP_ERROR_CHECK(gpio_isr_handler_add(APP_QUIT_PIN, gpio_cb, NULL));
+    esp_err_t ret = gpio_config(&input_pin);
+    if (ret == ESP_OK)
+    {
+        ret = gpio_install_isr_service(ESP_INTR_FLAG_LEVEL1);
+    }
+    if (ret == ESP_OK)
+    {
+        ret = gpio_isr_handler_add(APP_QUIT_PIN, gpio_cb, NULL);
+    }
+    return ret;
+}
+
+// What app_main may bring up and what each needs first. The SD clock is
+// stored in NVS, and the button posts to the USB task's queue.
+enum
+{
+    APP_INIT_ADC,
+    APP_INIT_RTC,
+    APP_INIT_NVS,
+    APP_INIT_SD,
+    APP_INIT_USB,
+    APP_INIT_BUTTON,
+    APP_INIT_COUNT,
+};
+
+static const init_graph_node_t app_init_nodes[APP_INIT_COUNT] = {
+    [APP_INIT_ADC] = {"adc", app_init_adc, 0},
+    [APP_INIT_RTC] = {"rtc", app_init_rtc, 0},
+    [APP_INIT_NVS] = {"nvs", app_init_nvs, 0},
+    [APP_INIT_SD] = {"sd", app_init_sd, BIT(APP_INIT_NVS)},
+    [APP_INIT_USB] = {"usb", app_init_usb, 0},
+    [APP_INIT_BUTTON] = {"button", app_init_button, BIT(APP_INIT_USB)},
+};
+
+static init_graph_t app_init;
+
+void app_main(void)
+{
+    phase_prof_wake();
+    // Deep sleep, requested by wake_checker(), waits until this wake's
+    // record is staged or flushed
+    ESP_ERROR_CHECK(shutdown_init());
+    shutdown_hold(BIT(APP_WORK_LOG));
+    phase_prof_begin(PHASE_WAKE_CHECKER);
+    wake_checker();
+    phase_prof_end(PHASE_WAKE_CHECKER);
+#if ULP_SAMPLER_ENABLE
+    // The ULP sets the cadence, app_init_adc() stops it while awake
+#elif DS3231_ALARM_WAKE_ENABLE
+    // The DS3231 crystal sets the cadence, the ESP timer stays off
+    example_deep_sleep_register_rtc_alarm_wakeup();
+#else
+    // deep_sleep_task() arms the timer for the next deadline
+#endif
+
+    /* Enable wakeup from deep sleep by ext1 */
+    example_deep_sleep_register_ext1_wakeup();
+
+    // Log the previous wakeup reason if this is not the first boot
+    if (wakeup_reason != ESP_SLEEP_WAKEUP_UNDEFINED)
+    {
+        printf("Previous wakeup reason: %d\n", wakeup_reason);
+    }
+    ESP_ERROR_CHECK(init_graph_create(&app_init, app_init_nodes, APP_INIT_COUNT));
 
-    ESP_LOGI(TAG, "Waiting for USB flash drive to be connected");
     msc_host_device_handle_t msc_device = NULL;
     msc_host_vfs_handle_t vfs_handle = NULL;
     esp_err_t ret;
 
-    // Options for mounting the filesystem.
-    // If format_if_mount_failed is set to true, SD card will be partitioned and
-    // formatted in case when mounting fails.
-    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-#ifdef CONFIG_EXAMPLE_FORMAT_IF_MOUNT_FAILED
-        .format_if_mount_failed = true,
-#else
-        .format_if_mount_failed = false,
-#endif // EXAMPLE_FORMAT_IF_MOUNT_FAILED
-        .max_files = 5,
-        .allocation_unit_size = 16 * 1024};
-    sdmmc_card_t *card;
-    const char mount_point[] = MOUNT_POINT;
-    ESP_LOGI(TAG, "Initializing SD card");
-
-    // Use settings defined above to initialize SD card and mount FAT filesystem.
-    // Note: esp_vfs_fat_sdmmc/sdspi_mount is all-in-one convenience functions.
-    // Please check its source code and implement error recovery when developing
-    // production applications.
-    ESP_LOGI(TAG, "Using SPI peripheral");
-
-    // By default, SD card frequency is initialized to SDMMC_FREQ_DEFAULT (20MHz)
-    // For setting a specific frequency, use host.max_freq_khz (range 400kHz - 20MHz for SDSPI)
-    // Example: for fixed frequency of 10MHz, use host.max_freq_khz = 10000;
-    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
-
-    // For SoCs where the SD power can be supplied both via an internal or external (e.g. on-board LDO) power supply.
-    // When using specific IO pins (which can be used for ultra high-speed SDMMC) to connect to the SD card
-    // and the internal LDO power supply, we need to initialize the power supply first.
-#if CONFIG_EXAMPLE_SD_PWR_CTRL_LDO_INTERNAL_IO
-    sd_pwr_ctrl_ldo_config_t ldo_config = {
-        .ldo_chan_id = CONFIG_EXAMPLE_SD_PWR_CTRL_LDO_IO_ID,
-    };
-    sd_pwr_ctrl_handle_t pwr_ctrl_handle = NULL;
+    log_writer_init(&day_writer, LOG_WRITER_SYNC_EXPLICIT);
 
-    ret = sd_pwr_ctrl_new_on_chip_ldo(&ldo_config, &pwr_ctrl_handle);
-    if (ret != ESP_OK)
+    // Keep whatever survived a reset, drop a torn tail
+    size_t recovered = log_stage_recover(&log_stage);
+    if (recovered > 0)
     {
-        ESP_LOGE(TAG, "Failed to create a new on-chip LDO power control driver");
-        return;
+        printf("%u staged records pending\n", (unsigned)recovered);
     }
-    host.pwr_ctrl_handle = pwr_ctrl_handle;
+
+    // The card only comes up when the stage is due, on first boot, on an
+    // extraction wake, or for the modes that write straight to it. Known
+    // that early, it comes up alongside the clock read and the sampling.
+    // Only an extraction wake serves the USB drive.
+    esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+    bool need_sd = log_stage_needs_flush(&log_stage) ||
+                   cause == ESP_SLEEP_WAKEUP_UNDEFINED ||
+                   cause == ESP_SLEEP_WAKEUP_EXT1 ||
+                   ULP_SAMPLER_ENABLE || ADC_TRIGGER_MODE_ENABLE;
+#if WAKE_STUB_ENABLE
+    need_sd = need_sd || log_wake_stub_needs_flush();
 #endif
+    uint32_t wake_nodes = BIT(APP_INIT_ADC) | BIT(APP_INIT_RTC);
+    if (need_sd)
+    {
+        // A gated card ramps its supply while the graph starts the rest
+        sd_card_power_on();
+        wake_nodes |= BIT(APP_INIT_SD);
+    }
+    if (cause == ESP_SLEEP_WAKEUP_EXT1)
+    {
+        wake_nodes |= BIT(APP_INIT_BUTTON);
+    }
+    init_graph_start(&app_init, wake_nodes);
+    ESP_ERROR_CHECK(init_graph_require(&app_init, BIT(APP_INIT_ADC) | BIT(APP_INIT_RTC)));
 
-    spi_bus_config_t bus_cfg = {
-        .mosi_io_num = PIN_NUM_MOSI,
-        .miso_io_num = PIN_NUM_MISO,
-        .sclk_io_num = PIN_NUM_CLK,
-        .quadwp_io_num = -1,
-        .quadhd_io_num = -1,
-        .max_transfer_sz = 4000,
-    };
+#if WAKE_STUB_ENABLE
+    log_wake_stub_batch();
+#endif
+#if ULP_SAMPLER_ENABLE
+    // The ULP's sets are older than this wake's record and may not fit the
+    // stage, so the card is waited for before the record is taken
+    if (init_graph_require(&app_init, BIT(APP_INIT_SD)) == ESP_OK)
+    {
+        log_ulp_batch();
+    }
+#endif
+    phase_prof_begin(PHASE_LOG_DATA);
+    log_data();
+    phase_prof_end(PHASE_LOG_DATA);
 
-    ret = spi_bus_initialize(host.slot, &bus_cfg, SDSPI_DEFAULT_DMA);
-    if (ret != ESP_OK)
+    // This wake's record may have filled the stage
+    need_sd = need_sd || log_stage_needs_flush(&log_stage);
+    if (!need_sd)
     {
-        ESP_LOGE(TAG, "Failed to initialize bus.");
+        init_graph_report(&app_init);
+        shutdown_release(BIT(APP_WORK_LOG));
         return;
     }
 
-    // This initializes the slot without card detect (CD) and write protect (WP) signals.
-    // Modify slot_config.gpio_cd and slot_config.gpio_wp if your board has these signals.
-    sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
-    slot_config.gpio_cs = PIN_NUM_CS;
-    slot_config.host_id = host.slot;
-
-    ESP_LOGI(TAG, "Mounting filesystem");
-    ret = esp_vfs_fat_sdspi_mount(mount_point, &host, &slot_config, &mount_config, &card);
-
+    ret = init_graph_require(&app_init, BIT(APP_INIT_SD));
+    init_graph_report(&app_init);
     if (ret != ESP_OK)
     {
-        if (ret == ESP_FAIL)
-        {
-            ESP_LOGE(TAG, "Failed to mount filesystem. "
-                          "If you want the card to be formatted, set the CONFIG_EXAMPLE_FORMAT_IF_MOUNT_FAILED menuconfig option.");
-        }
-        else
-        {
-            ESP_LOGE(TAG, "Failed to initialize the card (%s). "
-                          "Make sure SD card lines have pull-up resistors in place.",
-                     esp_err_to_name(ret));
-#ifdef CONFIG_EXAMPLE_DEBUG_PIN_CONNECTIONS
-            check_sd_card_pins(&config, pin_count);
-#endif
-        }
+        shutdown_release(BIT(APP_WORK_LOG));
         return;
     }
-    ESP_LOGI(TAG, "Filesystem mounted");
+    // Already mounted by the graph, this only hands out the card
+    sdmmc_card_t *card;
+    sd_card_mount(&card);
 
     // Card has been initialized, print its properties
     sdmmc_card_print_info(stdout, card);
+#if LOG_WRITER_BENCHMARK
+    log_writer_benchmark(card);
+#endif
+#if SD_IO_BENCHMARK
+    sd_io_benchmark();
+#endif
+    // A different card invalidates the cached day file and directories
+    get_file_path_set_card(card->cid.serial);
 
     // Use POSIX and C standard library functions to work with files.
 
-    // First create a file.
-    const char *file_hello = MOUNT_POINT "/hello.csv";
-    char data[EXAMPLE_MAX_CHAR_SIZE];
-    snprintf(data, EXAMPLE_MAX_CHAR_SIZE, "%s %s!\n", "Hello from ESP32", card->cid.name);
-    ret = s_example_write_file("/sdcard/jeel.csv", data);
-    if (ret != ESP_OK)
+    // First create a file. Only on a cold boot, a flush wake has no use
+    // for another line in it
+    if (cause == ESP_SLEEP_WAKEUP_UNDEFINED)
     {
-        return;
+        char data[EXAMPLE_MAX_CHAR_SIZE];
+        snprintf(data, EXAMPLE_MAX_CHAR_SIZE, "%s %s!\n", "Hello from ESP32", card->cid.name);
+        ret = s_example_write_file("/sdcard/jeel.csv", data);
+        if (ret != ESP_OK)
+        {
+            shutdown_release(BIT(APP_WORK_LOG));
+            return;
+        }
     }
-    ESP_ERROR_CHECK(i2c_master_init());
 
-    log_data();
-    wake_checker();
+    if (log_stage_flush() != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to flush staged records, keeping them for the next wake");
+    }
+    // Extraction wakes always refresh and print the phase statistics
+    phase_prof_dump(cause == ESP_SLEEP_WAKEUP_EXT1);
+#if SD_RING_ENABLE
+    if (cause == ESP_SLEEP_WAKEUP_EXT1 && log_ring_export() != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Ring export incomplete, it resumes on the next extraction wake");
+    }
+#endif
+#if ADC_TRIGGER_MODE_ENABLE
+    trigger_mode_run();
+#endif
+#if ULP_SAMPLER_ENABLE
+    adc_reader_deinit();
+    ESP_ERROR_CHECK(ulp_sampler_start(ULP_SAMPLER_PERIOD_S));
+#endif
+    shutdown_release(BIT(APP_WORK_LOG));
     
 
     
@@ -0,0 +1,218 @@
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "SD.h"
+#include "sd_clock.h"
+
+static const char *TAG = "SD_CLOCK";
+
+#define SD_CLOCK_N_STEPS (sizeof(sd_clock_steps_khz) / sizeof(sd_clock_steps_khz[0]))
+#define SD_CLOCK_TEST_SECTORS 8     /*!< Per write, one multi-block transfer */
+#define SD_CLOCK_TEST_ROUNDS 4
+
+static const uint32_t sd_clock_steps_khz[] = SD_CLOCK_STEPS_KHZ;
+
+// Clock and key of the card of the last mount, reapplied after deep sleep
+// when the same card comes back, whether resumed or probed after a power cut
+static RTC_DATA_ATTR uint32_t s_clock_khz;
+static RTC_DATA_ATTR char s_clock_key[16];
+static sdmmc_card_t *s_card;
+
+/* NVS key of a card, manufacturer and serial number */
+static void sd_clock_key(const sdmmc_card_t *card, char *key, size_t size)
+{
+    snprintf(key, size, "%02x%08" PRIx32, card->cid.mfg_id & 0xFF, (uint32_t)card->cid.serial);
+}
+
+static esp_err_t sd_clock_nvs_open(nvs_handle_t *handle)
+{
+    // Nothing else brings NVS up on chips with RTC memory
+    esp_err_t ret = nvs_flash_init();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    return nvs_open(SD_CLOCK_NVS_NAMESPACE, NVS_READWRITE, handle);
+}
+
+/* Stored clock of the card, 0 if it was never tuned */
+static uint32_t sd_clock_load(const sdmmc_card_t *card)
+{
+    nvs_handle_t handle;
+    char key[16];
+    uint32_t khz = 0;
+
+    if (sd_clock_nvs_open(&handle) != ESP_OK) {
+        return 0;
+    }
+    sd_clock_key(card, key, sizeof(key));
+    if (nvs_get_u32(handle, key, &khz) != ESP_OK) {
+        khz = 0;
+    }
+    nvs_close(handle);
+    return khz;
+}
+
+static void sd_clock_store(const sdmmc_card_t *card, uint32_t khz)
+{
+    nvs_handle_t handle;
+    char key[16];
+
+    esp_err_t ret = sd_clock_nvs_open(&handle);
+    if (ret == ESP_OK) {
+        sd_clock_key(card, key, sizeof(key));
+        ret = nvs_set_u32(handle, key, khz);
+        if (ret == ESP_OK) {
+            ret = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to store the card clock (%s)", esp_err_to_name(ret));
+    }
+}
+
+/* Fastest step at or below khz, the slowest below that, 0 for 0 */
+static uint32_t sd_clock_step_at_most(uint32_t khz)
+{
+    for (size_t step = SD_CLOCK_N_STEPS; step-- > 0;) {
+        if (sd_clock_steps_khz[step] <= khz) {
+            return sd_clock_steps_khz[step];
+        }
+    }
+    return khz == 0 ? 0 : sd_clock_steps_khz[0];
+}
+
+static esp_err_t sd_clock_set(uint32_t khz)
+{
+    esp_err_t ret = s_card->host.set_card_clk(s_card->host.slot, khz);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    s_card->max_freq_khz = khz;
+    s_card->real_freq_khz = khz;
+    if (s_card->host.get_real_freq) {
+        s_card->host.get_real_freq(s_card->host.slot, &s_card->real_freq_khz);
+    }
+    s_clock_khz = khz;
+    return ESP_OK;
+}
+
+/**
+ * @brief Step the clock up while a written pattern reads back intact
+ *
+ * CRC checking is on in SPI mode, so a corrupted transfer fails with
+ * ESP_ERR_INVALID_CRC before the compare even runs.
+ *
+ * @return Fastest passing step, 0 if none passed
+ */
+static uint32_t sd_clock_tune(void)
+{
+    uint32_t first;
+    uint32_t count;
+    uint32_t best = 0;
+
+    if (sd_card_file_sectors(SD_CLOCK_SCRATCH_FILE, SD_CLOCK_SCRATCH_BYTES, &first, &count) != ESP_OK ||
+        count < SD_CLOCK_TEST_SECTORS) {
+        return 0;
+    }
+    size_t len = SD_CLOCK_TEST_SECTORS * s_card->csd.sector_size;
+    uint8_t *tx = heap_caps_malloc(len, MALLOC_CAP_DMA);
+    uint8_t *rx = heap_caps_malloc(len, MALLOC_CAP_DMA);
+    if (tx == NULL || rx == NULL) {
+        heap_caps_free(tx);
+        heap_caps_free(rx);
+        return 0;
+    }
+
+    for (size_t step = 0; step < SD_CLOCK_N_STEPS; step++) {
+        uint32_t khz = sd_clock_steps_khz[step];
+        bool ok = sd_clock_set(khz) == ESP_OK;
+
+        for (uint32_t round = 0; ok && round < SD_CLOCK_TEST_ROUNDS; round++) {
+            // A new pattern per step and round, so stale sectors never match
+            uint32_t x = khz * 2654435761u + round + 1;
+            for (size_t i = 0; i < len; i++) {
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                tx[i] = (uint8_t)x;
+            }
+            uint32_t sector = first + (round * SD_CLOCK_TEST_SECTORS) % (count - SD_CLOCK_TEST_SECTORS + 1);
+            ok = sdmmc_write_sectors(s_card, tx, sector, SD_CLOCK_TEST_SECTORS) == ESP_OK &&
+                 sdmmc_read_sectors(s_card, rx, sector, SD_CLOCK_TEST_SECTORS) == ESP_OK &&
+                 memcmp(tx, rx, len) == 0;
+        }
+        ESP_LOGI(TAG, "%" PRIu32 " kHz (%d kHz real): %s", khz, s_card->real_freq_khz, ok ? "ok" : "failed");
+        if (!ok) {
+            break;
+        }
+        best = khz;
+    }
+
+    heap_caps_free(tx);
+    heap_caps_free(rx);
+    return best;
+}
+
+bool sd_clock_back_off(void)
+{
+    for (size_t step = SD_CLOCK_N_STEPS; step-- > 0;) {
+        if (sd_clock_steps_khz[step] < s_clock_khz) {
+            ESP_LOGW(TAG, "CRC error at %" PRIu32 " kHz, stepping down to %" PRIu32 " kHz",
+                     s_clock_khz, sd_clock_steps_khz[step]);
+            if (sd_clock_set(sd_clock_steps_khz[step]) != ESP_OK) {
+                return false;
+            }
+            sd_clock_store(s_card, s_clock_khz);
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t sd_clock_init(sdmmc_card_t *card, bool resumed)
+{
+    s_card = card;
+
+    char key[sizeof(s_clock_key)];
+    sd_clock_key(card, key, sizeof(key));
+    uint32_t khz = resumed || strcmp(key, s_clock_key) == 0 ? s_clock_khz : 0;
+    s_clock_key[0] = '\0';
+    if (khz == 0) {
+        khz = sd_clock_load(card);
+        uint32_t step = sd_clock_step_at_most(khz);
+        if (step != khz) {
+            // Stored by a build that tried steps out of spec
+            ESP_LOGW(TAG, "Stored clock %" PRIu32 " kHz is not a step, using %" PRIu32 " kHz", khz, step);
+            khz = step;
+            sd_clock_store(card, khz);
+        }
+    }
+    if (khz == 0) {
+        ESP_LOGI(TAG, "New card, tuning the clock");
+        khz = sd_clock_tune();
+        if (khz == 0) {
+            ESP_LOGW(TAG, "No clock passed the read-back test");
+            khz = sd_clock_steps_khz[0];
+        }
+        sd_clock_store(card, khz);
+    }
+
+    esp_err_t ret = sd_clock_set(khz);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    strcpy(s_clock_key, key);
+    ESP_LOGI(TAG, "Card clock %" PRIu32 " kHz (%d kHz real)", khz, card->real_freq_khz);
+    return ESP_OK;
+}
+
+uint32_t sd_clock_get_khz(void)
+{
+    return s_clock_khz;
+}
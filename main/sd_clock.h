@@ -0,0 +1,43 @@
+#ifndef SD_CLOCK_H
+#define SD_CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdmmc_cmd.h"
+
+/*
+ * SPI clock of the SD card, tuned per card instead of the fixed 20 MHz
+ * of SDSPI_HOST_DEFAULT().
+ *
+ * The first time a card is seen its clock is stepped up through
+ * SD_CLOCK_STEPS_KHZ with a CRC-checked write and read-back of a scratch
+ * file at each step. The fastest step that passes is stored in NVS under
+ * the card's manufacturer and serial number. The steps end at 20 MHz:
+ * default speed allows up to 25 MHz, and nothing here switches the card
+ * to high speed with CMD6. A clock stored above the fastest step is
+ * lowered to it. A CRC error at runtime steps the clock down, see
+ * sd_io.h.
+ */
+
+#define SD_CLOCK_TUNE_ENABLE 1
+#define SD_CLOCK_STEPS_KHZ {5000, 10000, 15000, 20000}
+#define SD_CLOCK_SCRATCH_FILE "sdclock.bin"
+#define SD_CLOCK_SCRATCH_BYTES (16 * 1024)
+#define SD_CLOCK_NVS_NAMESPACE "sd_clock"
+
+/**
+ * @brief Set the card clock, tuning it first for a card not seen before
+ *
+ * Call with the FAT volume mounted. The NVS lookup is skipped when the
+ * card was resumed, or is the card of the previous wake probed again.
+ */
+esp_err_t sd_clock_init(sdmmc_card_t *card, bool resumed);
+
+/* Drop to the next slower step after a CRC error and store it; false once at the slowest */
+bool sd_clock_back_off(void);
+
+/* Current card clock in kHz */
+uint32_t sd_clock_get_khz(void);
+
+#endif // SD_CLOCK_H
@@ -0,0 +1,219 @@
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_memory_utils.h"
+#include "sdmmc_defs.h"
+#include "diskio_impl.h"
+#include "diskio_sdmmc.h"
+#include "sd_clock.h"
+#include "sd_io.h"
+
+static const char *TAG = "SD_IO";
+
+static sdmmc_card_t *s_card;
+static sd_io_stats_t s_stats;
+static DMA_ATTR uint8_t s_dma_buf[SD_IO_DMA_BUF_BYTES];
+
+// The sdmmc disk I/O functions FatFs is registered with for the card
+DSTATUS ff_sdmmc_initialize(BYTE pdrv);
+DSTATUS ff_sdmmc_status(BYTE pdrv);
+DRESULT ff_sdmmc_ioctl(BYTE pdrv, BYTE cmd, void *buff);
+
+static bool sd_io_dma_ready(const void *buf)
+{
+    return esp_ptr_dma_capable(buf) && ((uintptr_t)buf & 3) == 0;
+}
+
+/* Whether a failed transfer is worth another try at a slower clock */
+static bool sd_io_retry(esp_err_t ret)
+{
+#if SD_CLOCK_TUNE_ENABLE
+    if (ret == ESP_ERR_INVALID_CRC && sd_clock_back_off()) {
+        s_stats.n_crc_retries++;
+        return true;
+    }
+#endif
+    return false;
+}
+
+static esp_err_t sd_io_command(uint32_t opcode, uint32_t arg)
+{
+    sdmmc_command_t cmd = {
+        .opcode = opcode,
+        .arg = arg,
+        .flags = SCF_RSP_R1,
+    };
+    esp_err_t ret = s_card->host.do_transaction(s_card->host.slot, &cmd);
+    return ret == ESP_OK ? cmd.error : ret;
+}
+
+static esp_err_t sd_io_write_blocks(const void *buf, uint32_t sector, uint32_t count)
+{
+    if (count > 1) {
+        // Pre-erase is only a hint, a card that rejects it still takes the write
+        esp_err_t ret = sd_io_command(MMC_APP_CMD, MMC_ARG_RCA(s_card->rca));
+        if (ret == ESP_OK) {
+            ret = sd_io_command(SD_APP_SET_WR_BLK_ERASE_COUNT, count);
+        }
+        if (ret != ESP_OK) {
+            ESP_LOGD(TAG, "ACMD23 failed (%s)", esp_err_to_name(ret));
+        }
+        s_stats.n_multi++;
+    }
+    s_stats.n_writes++;
+    return sdmmc_write_sectors(s_card, buf, sector, count);
+}
+
+static DRESULT sd_io_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count)
+{
+    const size_t sector_size = s_card->csd.sector_size;
+    bool staged = !sd_io_dma_ready(buff);
+    UINT chunk = staged ? SD_IO_DMA_BUF_BYTES / sector_size : count;
+
+    while (count > 0) {
+        UINT n = count < chunk ? count : chunk;
+        esp_err_t ret;
+        do {
+            ret = sdmmc_read_sectors(s_card, staged ? s_dma_buf : buff, sector, n);
+        } while (ret != ESP_OK && sd_io_retry(ret));
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "sdmmc_read_sectors failed (%s)", esp_err_to_name(ret));
+            return RES_ERROR;
+        }
+        if (staged) {
+            memcpy(buff, s_dma_buf, n * sector_size);
+            s_stats.n_staged++;
+        }
+        buff += n * sector_size;
+        sector += n;
+        count -= n;
+    }
+    return RES_OK;
+}
+
+static DRESULT sd_io_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count)
+{
+    const size_t sector_size = s_card->csd.sector_size;
+    bool staged = !sd_io_dma_ready(buff);
+    UINT chunk = staged ? SD_IO_DMA_BUF_BYTES / sector_size : count;
+
+    while (count > 0) {
+        UINT n = count < chunk ? count : chunk;
+        if (staged) {
+            memcpy(s_dma_buf, buff, n * sector_size);
+            s_stats.n_staged++;
+        }
+        esp_err_t ret;
+        do {
+            ret = sd_io_write_blocks(staged ? s_dma_buf : buff, sector, n);
+        } while (ret != ESP_OK && sd_io_retry(ret));
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "sdmmc_write_sectors failed (%s)", esp_err_to_name(ret));
+            return RES_ERROR;
+        }
+        s_stats.n_sectors_written += n;
+        buff += n * sector_size;
+        sector += n;
+        count -= n;
+    }
+    return RES_OK;
+}
+
+static const ff_diskio_impl_t sd_io_diskio = {
+    .init = &ff_sdmmc_initialize,
+    .status = &ff_sdmmc_status,
+    .read = &sd_io_read,
+    .write = &sd_io_write,
+    .ioctl = &ff_sdmmc_ioctl,
+};
+
+void sd_io_register(uint8_t pdrv, sdmmc_card_t *card)
+{
+    // Leaves the card where ff_sdmmc_initialize/status/ioctl look it up
+    ff_diskio_register_sdmmc(pdrv, card);
+    s_card = card;
+    ff_diskio_register(pdrv, &sd_io_diskio);
+}
+
+void sd_io_get_stats(sd_io_stats_t *stats)
+{
+    *stats = s_stats;
+}
+
+#if SD_IO_BENCHMARK
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "SD.h"
+
+#define BENCH_FLUSHES 32
+#define BENCH_FLUSH_MAX (64 * 1024)
+
+static const size_t bench_sizes[] = {4 * 1024, 16 * 1024, BENCH_FLUSH_MAX};
+
+static int bench_compare(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void sd_io_benchmark(void)
+{
+    static int64_t latency[BENCH_FLUSHES];
+    const char *path = MOUNT_POINT "/bench_io.bin";
+
+    uint8_t *buf = heap_caps_malloc(BENCH_FLUSH_MAX, MALLOC_CAP_DMA);
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "Benchmark needs %d bytes of DMA memory", BENCH_FLUSH_MAX);
+        return;
+    }
+    memset(buf, 0xA5, BENCH_FLUSH_MAX);
+
+    for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++) {
+        size_t size = bench_sizes[i];
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
+            ESP_LOGE(TAG, "Benchmark failed to open %s", path);
+            break;
+        }
+
+        sd_io_stats_t before;
+        sd_io_stats_t after;
+        sd_io_get_stats(&before);
+        int n = 0;
+        int64_t total_us = 0;
+        for (; n < BENCH_FLUSHES; n++) {
+            int64_t start = esp_timer_get_time();
+            if (write(fd, buf, size) != (ssize_t)size || fsync(fd) != 0) {
+                ESP_LOGE(TAG, "Benchmark write failed after %d flushes", n);
+                break;
+            }
+            latency[n] = esp_timer_get_time() - start;
+            total_us += latency[n];
+        }
+        close(fd);
+        sd_io_get_stats(&after);
+        if (n == 0) {
+            continue;
+        }
+
+        qsort(latency, n, sizeof(latency[0]), bench_compare);
+        // Bytes per microsecond is MB/s
+        long long centi_mbps = (long long)(size * n) * 100 / (total_us > 0 ? total_us : 1);
+        ESP_LOGI(TAG, "%u KiB flushes: %d, %lld.%02lld MB/s, latency p50 %lld us, p90 %lld us, p99 %lld us, max %lld us",
+                 (unsigned)(size / 1024), n, centi_mbps / 100, centi_mbps % 100,
+                 (long long)latency[(n - 1) * 50 / 100], (long long)latency[(n - 1) * 90 / 100],
+                 (long long)latency[(n - 1) * 99 / 100], (long long)latency[n - 1]);
+        ESP_LOGI(TAG, "%" PRIu32 " commands, %" PRIu32 " multi-block, %" PRIu32 " sectors, %" PRIu32 " staged",
+                 after.n_writes - before.n_writes, after.n_multi - before.n_multi,
+                 after.n_sectors_written - before.n_sectors_written, after.n_staged - before.n_staged);
+    }
+
+    unlink(path);
+    heap_caps_free(buf);
+}
+#endif // SD_IO_BENCHMARK
@@ -0,0 +1,47 @@
+#ifndef SD_IO_H
+#define SD_IO_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdmmc_cmd.h"
+
+/*
+ * FatFs disk I/O for the SD card, in place of ff_diskio_register_sdmmc().
+ *
+ * The stock driver already sends a write of several sectors from a DMA
+ * capable buffer as one CMD25 transfer. Here such a write is announced
+ * with ACMD23 first, so the card can erase the blocks ahead. For a buffer
+ * DMA cannot reach or that is not word aligned, sdmmc_read/write_sectors()
+ * fall back to one block per command; such buffers are instead staged
+ * through a static DMA buffer of SD_IO_DMA_BUF_BYTES, so they go out
+ * multi-block as well. With SD_CLOCK_TUNE_ENABLE, a CRC error steps the
+ * card clock down and retries the transfer.
+ */
+
+#define SD_IO_DMA_BUF_BYTES 4096    /*!< One FAT sector, CONFIG_FATFS_SECTOR_4096 */
+#define SD_IO_BENCHMARK 0           /*!< Set to 1 to time 4, 16 and 64 KiB flushes on every mount */
+
+typedef struct {
+    uint32_t n_writes;              /*!< Commands, multi-block or single */
+    uint32_t n_multi;               /*!< Of them CMD25 */
+    uint32_t n_sectors_written;
+    uint32_t n_staged;              /*!< Writes and reads copied through the DMA buffer */
+    uint32_t n_crc_retries;
+} sd_io_stats_t;
+
+/* Route FatFs disk I/O on pdrv to card through this module */
+void sd_io_register(uint8_t pdrv, sdmmc_card_t *card);
+
+void sd_io_get_stats(sd_io_stats_t *stats);
+
+#if SD_IO_BENCHMARK
+/**
+ * @brief Write a file in flushes of 4, 16 and 64 KiB, each followed by fsync
+ *
+ * Logs MB/s and the 50th, 90th and 99th percentile and maximum latency of
+ * a flush for each size. Needs the card mounted at MOUNT_POINT.
+ */
+void sd_io_benchmark(void);
+#endif
+
+#endif // SD_IO_H
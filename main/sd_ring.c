@@ -0,0 +1,355 @@
+#include "sd_ring.h"
+#include <string.h>
+#include "crc32.h"
+
+#define SD_RING_SUPER_MAGIC 0x53524C44u     /* "DLRS" */
+#define SD_RING_SEGMENT_MAGIC 0x47534C44u   /* "DLSG" */
+#define SD_RING_VERSION 1
+#define SD_RING_SUPER_LEN 28                /* Superblock fields before the CRC */
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t sd_ring_segment_sector(uint32_t seg)
+{
+    return SD_RING_FIRST_SEGMENT + seg * SD_RING_SEGMENT_SECTORS;
+}
+
+/* Write the next superblock generation over the older of the two copies */
+static int sd_ring_write_super(sd_ring_t *ring)
+{
+    uint8_t sector[SD_RING_SECTOR_SIZE] = {0};
+    uint32_t generation = ring->generation + 1;
+
+    put_u32(&sector[0], SD_RING_SUPER_MAGIC);
+    put_u32(&sector[4], SD_RING_VERSION);
+    put_u32(&sector[8], generation);
+    put_u32(&sector[12], SD_RING_SEGMENT_SECTORS);
+    put_u32(&sector[16], ring->n_segments);
+    put_u32(&sector[20], ring->exported_seq);
+    put_u32(&sector[24], ring->exported_pos);
+    put_u32(&sector[SD_RING_SUPER_LEN], crc32_update(0, sector, SD_RING_SUPER_LEN));
+
+    if (ring->dev.write(ring->dev.ctx, generation & 1, sector, 1) != 0) {
+        return -1;
+    }
+    ring->generation = generation;
+    return 0;
+}
+
+/* 1 if a superblock copy matches the geometry, 0 if none does, -1 on a device error */
+static int sd_ring_read_super(sd_ring_t *ring)
+{
+    uint8_t sector[SD_RING_SECTOR_SIZE];
+    int found = 0;
+
+    for (uint32_t copy = 0; copy < 2; copy++) {
+        if (ring->dev.read(ring->dev.ctx, copy, sector, 1) != 0) {
+            return -1;
+        }
+        if (get_u32(&sector[0]) != SD_RING_SUPER_MAGIC ||
+            get_u32(&sector[4]) != SD_RING_VERSION ||
+            get_u32(&sector[SD_RING_SUPER_LEN]) != crc32_update(0, sector, SD_RING_SUPER_LEN) ||
+            get_u32(&sector[12]) != SD_RING_SEGMENT_SECTORS ||
+            get_u32(&sector[16]) != ring->n_segments) {
+            continue;
+        }
+        uint32_t generation = get_u32(&sector[8]);
+        if (found && generation <= ring->generation) {
+            continue;
+        }
+        ring->generation = generation;
+        ring->exported_seq = get_u32(&sector[20]);
+        ring->exported_pos = get_u32(&sector[24]);
+        found = 1;
+    }
+    return found;
+}
+
+static int sd_ring_format(sd_ring_t *ring)
+{
+    uint8_t sector[SD_RING_SECTOR_SIZE] = {0};
+
+    // Headers left by an earlier ring on the same sectors would look valid
+    for (uint32_t seg = 0; seg < ring->n_segments; seg++) {
+        if (ring->dev.write(ring->dev.ctx, sd_ring_segment_sector(seg), sector, 1) != 0) {
+            return -1;
+        }
+    }
+    ring->generation = 0;
+    ring->exported_seq = 0;
+    ring->exported_pos = 0;
+    if (sd_ring_write_super(ring) != 0 || sd_ring_write_super(ring) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Sequence number from a segment's first sector, 0 if it holds no segment header */
+static uint32_t sd_ring_header_seq(const uint8_t *buf)
+{
+    if (get_u32(&buf[0]) != SD_RING_SEGMENT_MAGIC) {
+        return 0;
+    }
+    return get_u32(&buf[4]);
+}
+
+/* Payload length of a whole segment in buf, or -1 if it is not segment seq */
+static long sd_ring_check_segment(const uint8_t *buf, uint32_t seq)
+{
+    uint32_t len = get_u32(&buf[8]);
+
+    if (sd_ring_header_seq(buf) != seq || seq == 0 || len > SD_RING_PAYLOAD) {
+        return -1;
+    }
+    uint32_t crc = crc32_update(0, &buf[4], 8);
+    crc = crc32_update(crc, &buf[SD_RING_SEGMENT_HEADER], len);
+    return crc == get_u32(&buf[12]) ? (long)len : -1;
+}
+
+/* 1 with the sequence number of segment seg, 0 if it has no header, -1 on a device error */
+static int sd_ring_peek(sd_ring_t *ring, uint32_t seg, uint32_t *seq)
+{
+    uint8_t sector[SD_RING_SECTOR_SIZE];
+
+    if (ring->dev.read(ring->dev.ctx, sd_ring_segment_sector(seg), sector, 1) != 0) {
+        return -1;
+    }
+    *seq = sd_ring_header_seq(sector);
+    return *seq != 0;
+}
+
+/* Segment with the highest sequence number, 0 if there is none, -1 on a device error */
+static int sd_ring_find_head(sd_ring_t *ring, uint32_t hint, uint32_t *head, uint32_t *seq)
+{
+    uint32_t s;
+    int ret;
+
+    if (hint < ring->n_segments) {
+        ret = sd_ring_peek(ring, hint, &s);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret) {
+            // Segments after the hint continue its sequence up to the head
+            *head = hint;
+            *seq = s;
+            for (uint32_t i = 1; i < ring->n_segments; i++) {
+                uint32_t next = (hint + i) % ring->n_segments;
+                ret = sd_ring_peek(ring, next, &s);
+                if (ret < 0) {
+                    return ret;
+                }
+                if (!ret || s != *seq + 1) {
+                    break;
+                }
+                *head = next;
+                *seq = s;
+            }
+            return 1;
+        }
+    }
+
+    int found = 0;
+    for (uint32_t seg = 0; seg < ring->n_segments; seg++) {
+        ret = sd_ring_peek(ring, seg, &s);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret && (!found || s > *seq)) {
+            *head = seg;
+            *seq = s;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+int sd_ring_mount(sd_ring_t *ring, const sd_ring_dev_t *dev, uint32_t hint)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->dev = *dev;
+    if (dev->n_sectors < SD_RING_FIRST_SEGMENT + 2 * SD_RING_SEGMENT_SECTORS) {
+        return -1;
+    }
+    ring->n_segments = (dev->n_sectors - SD_RING_FIRST_SEGMENT) / SD_RING_SEGMENT_SECTORS;
+
+    int ret = sd_ring_read_super(ring);
+    if (ret < 0) {
+        return -1;
+    }
+    if (ret == 0) {
+        ring->seq = 1;
+        return sd_ring_format(ring) == 0 ? 0 : -1;
+    }
+
+    uint32_t head = 0;
+    uint32_t seq = 0;
+    ret = sd_ring_find_head(ring, hint, &head, &seq);
+    if (ret < 0) {
+        return -1;
+    }
+    if (ret == 0) {
+        ring->seq = 1;
+        return 0;
+    }
+
+    ring->head = head;
+    ring->seq = seq;
+    if (dev->read(dev->ctx, sd_ring_segment_sector(head), ring->seg, SD_RING_SEGMENT_SECTORS) != 0) {
+        return -1;
+    }
+    long len = sd_ring_check_segment(ring->seg, seq);
+    // A torn head segment is started over under the same number
+    ring->len = len < 0 ? 0 : (uint32_t)len;
+    ring->flushed = ring->len;
+    memset(&ring->seg[SD_RING_SEGMENT_HEADER + ring->len], 0, SD_RING_PAYLOAD - ring->len);
+    return 0;
+}
+
+int sd_ring_flush(sd_ring_t *ring)
+{
+    if (ring->len == ring->flushed) {
+        return 0;
+    }
+
+    uint8_t *h = ring->seg;
+    put_u32(&h[0], SD_RING_SEGMENT_MAGIC);
+    put_u32(&h[4], ring->seq);
+    put_u32(&h[8], ring->len);
+    uint32_t crc = crc32_update(0, &h[4], 8);
+    crc = crc32_update(crc, &h[SD_RING_SEGMENT_HEADER], ring->len);
+    put_u32(&h[12], crc);
+
+    // Data sectors first, the header sector commits them
+    uint32_t base = sd_ring_segment_sector(ring->head);
+    uint32_t first = (SD_RING_SEGMENT_HEADER + ring->flushed) / SD_RING_SECTOR_SIZE;
+    uint32_t last = (SD_RING_SEGMENT_HEADER + ring->len - 1) / SD_RING_SECTOR_SIZE;
+    if (first == 0) {
+        first = 1;
+    }
+    if (last >= first &&
+        ring->dev.write(ring->dev.ctx, base + first, &h[first * SD_RING_SECTOR_SIZE], last - first + 1) != 0) {
+        return -1;
+    }
+    if (ring->dev.write(ring->dev.ctx, base, h, 1) != 0) {
+        return -1;
+    }
+    ring->flushed = ring->len;
+    return 0;
+}
+
+static void sd_ring_advance(sd_ring_t *ring)
+{
+    ring->head = (ring->head + 1) % ring->n_segments;
+    ring->seq++;
+    ring->len = 0;
+    ring->flushed = 0;
+    memset(ring->seg, 0, sizeof(ring->seg));
+
+    // The segment taken over held seq - n_segments
+    if (ring->seq > ring->n_segments && ring->seq - ring->n_segments >= ring->exported_seq) {
+        ring->n_overwritten++;
+    }
+}
+
+int sd_ring_append(sd_ring_t *ring, const void *data, size_t len)
+{
+    if (len == 0 || len > SD_RING_RECORD_MAX) {
+        return -1;
+    }
+    if (ring->len + 1 + len > SD_RING_PAYLOAD) {
+        if (sd_ring_flush(ring) != 0) {
+            return -1;
+        }
+        sd_ring_advance(ring);
+    }
+
+    uint8_t *p = &ring->seg[SD_RING_SEGMENT_HEADER + ring->len];
+    p[0] = (uint8_t)len;
+    memcpy(&p[1], data, len);
+    ring->len += 1 + (uint32_t)len;
+    return 0;
+}
+
+void sd_ring_read_begin(const sd_ring_t *ring, sd_ring_reader_t *reader)
+{
+    uint32_t oldest = ring->seq > ring->n_segments ? ring->seq - ring->n_segments + 1 : 1;
+    uint32_t seq = ring->exported_seq;
+    uint32_t pos = ring->exported_pos;
+
+    if (seq < oldest || seq > ring->seq) {
+        seq = oldest;
+        pos = 0;
+    }
+    reader->seq = seq;
+    reader->seg = (ring->head + ring->n_segments - (ring->seq - seq)) % ring->n_segments;
+    reader->pos = pos;
+    reader->len = 0;
+    reader->n_skipped = 0;
+    reader->loaded = false;
+}
+
+int sd_ring_read_next(sd_ring_t *ring, sd_ring_reader_t *reader, uint8_t *out, size_t *len)
+{
+    for (;;) {
+        const uint8_t *payload;
+        uint32_t end;
+
+        if (reader->seq == ring->seq) {
+            // The open segment, including records not flushed yet
+            payload = &ring->seg[SD_RING_SEGMENT_HEADER];
+            end = ring->len;
+        } else {
+            if (!reader->loaded) {
+                if (ring->dev.read(ring->dev.ctx, sd_ring_segment_sector(reader->seg),
+                                   reader->buf, SD_RING_SEGMENT_SECTORS) != 0) {
+                    return -1;
+                }
+                long n = sd_ring_check_segment(reader->buf, reader->seq);
+                if (n < 0) {
+                    reader->n_skipped++;
+                    n = 0;
+                }
+                reader->len = (uint32_t)n;
+                reader->loaded = true;
+            }
+            payload = &reader->buf[SD_RING_SEGMENT_HEADER];
+            end = reader->len;
+        }
+
+        if (reader->pos < end) {
+            uint8_t n = payload[reader->pos];
+            if (n != 0 && reader->pos + 1 + n <= end) {
+                memcpy(out, &payload[reader->pos + 1], n);
+                *len = n;
+                reader->pos += 1 + n;
+                return 1;
+            }
+            reader->pos = end;
+        }
+        if (reader->seq == ring->seq) {
+            return 0;
+        }
+        reader->seq++;
+        reader->seg = (reader->seg + 1) % ring->n_segments;
+        reader->pos = 0;
+        reader->loaded = false;
+    }
+}
+
+int sd_ring_mark_exported(sd_ring_t *ring, const sd_ring_reader_t *reader)
+{
+    ring->exported_seq = reader->seq;
+    ring->exported_pos = reader->pos;
+    return sd_ring_write_super(ring);
+}
@@ -0,0 +1,108 @@
+#ifndef SD_RING_H
+#define SD_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Log-structured record ring on a range of raw 512-byte sectors.
+ *
+ * Sectors 0 and 1 hold two copies of the superblock (geometry and how far
+ * the ring has been exported), written alternately with a generation
+ * count so a torn write leaves the other copy. The rest is cut into
+ * segments of SD_RING_SEGMENT_SECTORS, filled in order and reused
+ * oldest first once the ring wraps. Each segment starts with
+ *     magic:4 seq:4 len:4 crc32:4
+ * where seq counts up by one per segment and the CRC covers seq, len and
+ * the len payload bytes. The payload holds records as [len:1][data:len].
+ *
+ * The open segment is rewritten in place on every flush: its data sectors
+ * first, the sector carrying the header last. A power cut before the
+ * header lands leaves the previous header, whose CRC still matches the
+ * bytes it covers, so at most the records since the last flush are lost.
+ *
+ * Nothing here depends on ESP-IDF; on Linux the device can be a file.
+ */
+
+#define SD_RING_SECTOR_SIZE 512
+#define SD_RING_SEGMENT_SECTORS 8
+#define SD_RING_SEGMENT_SIZE (SD_RING_SECTOR_SIZE * SD_RING_SEGMENT_SECTORS)
+#define SD_RING_SEGMENT_HEADER 16
+#define SD_RING_PAYLOAD (SD_RING_SEGMENT_SIZE - SD_RING_SEGMENT_HEADER)
+#define SD_RING_RECORD_MAX 255
+#define SD_RING_FIRST_SEGMENT 2             /*!< Sector of segment 0, after the superblocks */
+#define SD_RING_NO_HINT UINT32_MAX
+
+typedef struct {
+    void *ctx;
+    uint32_t n_sectors;
+    /* Both return 0 on success */
+    int (*read)(void *ctx, uint32_t sector, void *buf, uint32_t count);
+    int (*write)(void *ctx, uint32_t sector, const void *buf, uint32_t count);
+} sd_ring_dev_t;
+
+typedef struct {
+    sd_ring_dev_t dev;
+    uint32_t n_segments;
+    uint32_t generation;                    /*!< Of the newest superblock copy */
+    uint32_t exported_seq;                  /*!< Export mark: segment and payload offset */
+    uint32_t exported_pos;
+    uint32_t head;                          /*!< Segment being filled */
+    uint32_t seq;                           /*!< Its sequence number */
+    uint32_t len;                           /*!< Payload bytes in seg */
+    uint32_t flushed;                       /*!< Payload bytes already on the device */
+    uint32_t n_overwritten;                 /*!< Segments reused before they were exported */
+    uint8_t seg[SD_RING_SEGMENT_SIZE];
+} sd_ring_t;
+
+typedef struct {
+    uint32_t seg;
+    uint32_t seq;
+    uint32_t pos;                           /*!< Payload offset of the next record */
+    uint32_t len;
+    uint32_t n_skipped;                     /*!< Segments that failed their check */
+    bool loaded;
+    uint8_t buf[SD_RING_SEGMENT_SIZE];
+} sd_ring_reader_t;
+
+/**
+ * @brief Find the newest segment and resume filling it
+ *
+ * Formats the device if neither superblock copy is valid for its size.
+ * With a hint, the segment index from sd_ring_head() before a reset or
+ * deep sleep, only the segments from there to the head are read;
+ * otherwise the header of every segment is.
+ *
+ * @return 0, or -1 on a device error or a device too small for two segments
+ */
+int sd_ring_mount(sd_ring_t *ring, const sd_ring_dev_t *dev, uint32_t hint);
+
+/* Add one record of 1 to SD_RING_RECORD_MAX bytes, closing the segment if it is full */
+int sd_ring_append(sd_ring_t *ring, const void *data, size_t len);
+
+/* Write what was appended since the last flush to the device */
+int sd_ring_flush(sd_ring_t *ring);
+
+static inline uint32_t sd_ring_head(const sd_ring_t *ring)
+{
+    return ring->head;
+}
+
+/* Start reading after the export mark, or at the oldest record still in the ring */
+void sd_ring_read_begin(const sd_ring_t *ring, sd_ring_reader_t *reader);
+
+/**
+ * @brief Return the next record, oldest first, up to the last one appended
+ *
+ * Segments failing their check are skipped and counted.
+ *
+ * @param out Needs SD_RING_RECORD_MAX bytes
+ * @return 1 with a record in out, 0 at the end, -1 on a device error
+ */
+int sd_ring_read_next(sd_ring_t *ring, sd_ring_reader_t *reader, uint8_t *out, size_t *len);
+
+/* Move the export mark to where reader stopped and write the superblock */
+int sd_ring_mark_exported(sd_ring_t *ring, const sd_ring_reader_t *reader);
+
+#endif // SD_RING_H
@@ -0,0 +1,114 @@
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "shutdown.h"
+
+static const char *TAG = "SHUTDOWN";
+
+#define SHUTDOWN_ALL ((1u << SHUTDOWN_MAX_WORK) - 1)
+
+static SemaphoreHandle_t s_lock;
+static EventGroupHandle_t s_idle;           // bit set while nobody holds that work
+static uint8_t s_holds[SHUTDOWN_MAX_WORK];
+static bool s_requested;
+static bool s_closing;
+static shutdown_fn_t s_fn;
+static void *s_arg;
+static uint32_t s_timeout_ms;
+
+esp_err_t shutdown_init(void)
+{
+    s_lock = xSemaphoreCreateMutex();
+    s_idle = xEventGroupCreate();
+    if (s_lock == NULL || s_idle == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    xEventGroupSetBits(s_idle, SHUTDOWN_ALL);
+    return ESP_OK;
+}
+
+bool shutdown_hold(uint32_t mask)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool ok = !s_closing;
+    if (ok) {
+        for (unsigned i = 0; i < SHUTDOWN_MAX_WORK; i++) {
+            if (mask & (1u << i)) {
+                s_holds[i]++;
+            }
+        }
+        xEventGroupClearBits(s_idle, mask & SHUTDOWN_ALL);
+    }
+    xSemaphoreGive(s_lock);
+    return ok;
+}
+
+void shutdown_release(uint32_t mask)
+{
+    uint32_t idle = 0;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (unsigned i = 0; i < SHUTDOWN_MAX_WORK; i++) {
+        if ((mask & (1u << i)) && s_holds[i] > 0 && --s_holds[i] == 0) {
+            idle |= 1u << i;
+        }
+    }
+    xEventGroupSetBits(s_idle, idle);
+    xSemaphoreGive(s_lock);
+}
+
+static void shutdown_task(void *arg)
+{
+    int64_t start = esp_timer_get_time();
+    int64_t deadline = start + (int64_t)s_timeout_ms * 1000;
+
+    while (true) {
+        int64_t left_us = deadline - esp_timer_get_time();
+        TickType_t ticks = left_us > 0 ? pdMS_TO_TICKS((left_us + 999) / 1000) : 0;
+        EventBits_t idle = xEventGroupWaitBits(s_idle, SHUTDOWN_ALL, pdFALSE, pdTRUE, ticks);
+
+        // The bits may change between the wait and here, decide under the lock
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        idle = xEventGroupGetBits(s_idle);
+        if ((idle & SHUTDOWN_ALL) == SHUTDOWN_ALL || esp_timer_get_time() >= deadline) {
+            s_closing = true;
+        }
+        xSemaphoreGive(s_lock);
+
+        if (s_closing) {
+            if ((idle & SHUTDOWN_ALL) == SHUTDOWN_ALL) {
+                ESP_LOGI(TAG, "Work drained after %lld ms", (long long)((esp_timer_get_time() - start) / 1000));
+            } else {
+                ESP_LOGW(TAG, "Timed out after %" PRIu32 " ms, work 0x%06" PRIx32 " still held",
+                         s_timeout_ms, (uint32_t)(~idle & SHUTDOWN_ALL));
+            }
+            break;
+        }
+    }
+
+    s_fn(s_arg);
+    vTaskDelete(NULL);
+}
+
+esp_err_t shutdown_request(shutdown_fn_t fn, void *arg, uint32_t timeout_ms)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool first = !s_requested;
+    s_requested = true;
+    xSemaphoreGive(s_lock);
+    if (!first) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    s_fn = fn;
+    s_arg = arg;
+    s_timeout_ms = timeout_ms;
+    if (xTaskCreate(shutdown_task, "shutdown", SHUTDOWN_STACK, NULL, SHUTDOWN_PRIORITY, NULL) != pdPASS) {
+        s_requested = false;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,45 @@
+#ifndef SHUTDOWN_H
+#define SHUTDOWN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/*
+ * Deep sleep as soon as the outstanding work has drained.
+ *
+ * Subsystems hold a work bit while they have something in flight that a
+ * sleep would cut off (the logging path, a USB transfer, an I2C
+ * transaction) and release it when done; the bits are the caller's, like
+ * init_graph's nodes, and holds of the same bit nest. shutdown_request()
+ * starts a task that waits until no bit is held and then runs the sleep
+ * function, which does not return. If the work has not drained within
+ * the timeout, it logs what is still held and goes down anyway.
+ *
+ * Once the task has decided to go down, shutdown_hold() refuses new work.
+ */
+
+#define SHUTDOWN_MAX_WORK 24                /*!< One event group bit each */
+#define SHUTDOWN_TIMEOUT_MS 15000           /*!< Default hard limit from the request to the sleep */
+#define SHUTDOWN_STACK 4096                 /*!< The sleep function runs on it */
+#define SHUTDOWN_PRIORITY 6
+
+typedef void (*shutdown_fn_t)(void *arg);
+
+esp_err_t shutdown_init(void);
+
+/* Mark the work in mask outstanding; false if the device is already going down */
+bool shutdown_hold(uint32_t mask);
+
+/* Undo one shutdown_hold() of each bit in mask */
+void shutdown_release(uint32_t mask);
+
+/**
+ * @brief Run fn once nothing is held, or after timeout_ms at the latest
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if a shutdown was already
+ *         requested (the first request stands), ESP_ERR_NO_MEM
+ */
+esp_err_t shutdown_request(shutdown_fn_t fn, void *arg, uint32_t timeout_ms);
+
+#endif // SHUTDOWN_H
@@ -0,0 +1,153 @@
+#include "trend_compress.h"
+#include <string.h>
+
+static void trend_set_point(trend_point_t *p, uint8_t n, int64_t t, const int32_t *v)
+{
+    p->t = t;
+    memcpy(p->v, v, n * sizeof(int32_t));
+}
+
+/* a <= b for fractions with positive denominators */
+static inline bool slope_le(trend_slope_t a, trend_slope_t b)
+{
+    return a.num * b.den <= b.num * a.den;
+}
+
+/* Start the feasible slope window of every channel from the archive through p */
+static void trend_open_doors(trend_compressor_t *c, const trend_point_t *p)
+{
+    int64_t dt = p->t - c->archive.t;
+    for (int ch = 0; ch < c->n_channels; ch++) {
+        int64_t dv = (int64_t)p->v[ch] - c->archive.v[ch];
+        c->lo[ch] = (trend_slope_t){dv - c->tolerance[ch], dt};
+        c->hi[ch] = (trend_slope_t){dv + c->tolerance[ch], dt};
+    }
+}
+
+/* True if the straight line from the archive to p stays within every door,
+ * i.e. p can extend the current segment. */
+static bool trend_doors_admit(const trend_compressor_t *c, const trend_point_t *p)
+{
+    int64_t dt = p->t - c->archive.t;
+    for (int ch = 0; ch < c->n_channels; ch++) {
+        trend_slope_t s = {(int64_t)p->v[ch] - c->archive.v[ch], dt};
+        if (!slope_le(c->lo[ch], s) || !slope_le(s, c->hi[ch])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Narrow every door by p's own tolerance band */
+static void trend_narrow_doors(trend_compressor_t *c, const trend_point_t *p)
+{
+    int64_t dt = p->t - c->archive.t;
+    for (int ch = 0; ch < c->n_channels; ch++) {
+        int64_t dv = (int64_t)p->v[ch] - c->archive.v[ch];
+        trend_slope_t lo = {dv - c->tolerance[ch], dt};
+        trend_slope_t hi = {dv + c->tolerance[ch], dt};
+        if (slope_le(c->lo[ch], lo)) {
+            c->lo[ch] = lo;
+        }
+        if (slope_le(hi, c->hi[ch])) {
+            c->hi[ch] = hi;
+        }
+    }
+}
+
+static bool trend_outside_deadband(const trend_compressor_t *c, const trend_point_t *p)
+{
+    for (int ch = 0; ch < c->n_channels; ch++) {
+        int64_t dv = (int64_t)p->v[ch] - c->archive.v[ch];
+        if (dv > c->tolerance[ch] || -dv > c->tolerance[ch]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void trend_compress_init(trend_compressor_t *c, trend_mode_t mode, uint8_t n_channels, const int32_t *tolerance)
+{
+    memset(c, 0, sizeof(*c));
+    c->magic = TREND_MAGIC;
+    c->mode = mode;
+    c->n_channels = n_channels > TREND_MAX_CHANNELS ? TREND_MAX_CHANNELS : n_channels;
+    memcpy(c->tolerance, tolerance, c->n_channels * sizeof(int32_t));
+}
+
+bool trend_compress_matches(const trend_compressor_t *c, trend_mode_t mode, uint8_t n_channels, const int32_t *tolerance)
+{
+    return c->magic == TREND_MAGIC && c->mode == mode && c->n_channels == n_channels
+           && memcmp(c->tolerance, tolerance, n_channels * sizeof(int32_t)) == 0;
+}
+
+int trend_compress_push(trend_compressor_t *c, int64_t t, const int32_t *v, trend_point_t out[TREND_MAX_EMIT])
+{
+    trend_point_t p;
+    int n = 0;
+
+    trend_set_point(&p, c->n_channels, t, v);
+    c->n_in++;
+
+    if (c->mode == TREND_MODE_OFF) {
+        out[0] = p;
+        c->n_out++;
+        return 1;
+    }
+
+    // Time went backwards (new day, clock set): close the series
+    int64_t last_t = c->has_pending ? c->pending.t : c->archive.t;
+    if (c->has_archive && t <= last_t) {
+        n = trend_compress_flush(c, &out[0]) ? 1 : 0;
+        c->has_archive = false;
+    }
+
+    if (!c->has_archive) {
+        c->archive = p;
+        c->has_archive = true;
+        c->has_pending = false;
+        out[n++] = p;
+        c->n_out++;
+        return n;
+    }
+
+    if (c->mode == TREND_MODE_DEADBAND) {
+        if (trend_outside_deadband(c, &p)) {
+            c->archive = p;
+            c->has_pending = false;
+            out[n++] = p;
+            c->n_out++;
+        } else {
+            c->pending = p;
+            c->has_pending = true;
+        }
+        return n;
+    }
+
+    if (!c->has_pending) {
+        trend_open_doors(c, &p);
+    } else if (trend_doors_admit(c, &p)) {
+        trend_narrow_doors(c, &p);
+    } else {
+        // p cannot extend the segment, so the previous record ends it
+        c->archive = c->pending;
+        out[n++] = c->pending;
+        c->n_out++;
+        trend_open_doors(c, &p);
+    }
+    c->pending = p;
+    c->has_pending = true;
+    return n;
+}
+
+bool trend_compress_flush(trend_compressor_t *c, trend_point_t *out)
+{
+    if (!c->has_pending) {
+        return false;
+    }
+    c->archive = c->pending;
+    c->has_pending = false;
+    *out = c->archive;
+    c->n_out++;
+    return true;
+}
@@ -0,0 +1,82 @@
+#ifndef TREND_COMPRESS_H
+#define TREND_COMPRESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Streaming compression of multi-channel records before they are written.
+ *
+ * TREND_MODE_SWINGING_DOOR keeps a record only when a straight line from the
+ * last kept record can no longer pass within tolerance of every record since,
+ * so linear interpolation between kept records reproduces each channel
+ * within its tolerance. TREND_MODE_DEADBAND keeps a record when any channel
+ * moved more than its tolerance from the last kept value, for sample-and-hold
+ * reconstruction.
+ *
+ * Channels share one timeline: a record is kept for all channels as soon as
+ * any channel needs it. Integer arithmetic only, the S2 has no FPU.
+ */
+
+#define TREND_MAX_CHANNELS 8
+#define TREND_MAX_EMIT 2        /*!< Records a single push can release */
+#define TREND_MAGIC 0x54524E44u
+
+typedef enum {
+    TREND_MODE_OFF,             /*!< Every record is kept */
+    TREND_MODE_DEADBAND,
+    TREND_MODE_SWINGING_DOOR,
+} trend_mode_t;
+
+typedef struct {
+    int64_t t;
+    int32_t v[TREND_MAX_CHANNELS];
+} trend_point_t;
+
+/* Slope as num/den with den > 0, so comparisons stay exact */
+typedef struct {
+    int64_t num;
+    int64_t den;
+} trend_slope_t;
+
+typedef struct {
+    uint32_t magic;
+    trend_mode_t mode;
+    uint8_t n_channels;
+    int32_t tolerance[TREND_MAX_CHANNELS];
+
+    bool has_archive;           /*!< archive holds the last kept record */
+    bool has_pending;           /*!< pending holds a record seen but not kept */
+    trend_point_t archive;
+    trend_point_t pending;
+    trend_slope_t lo[TREND_MAX_CHANNELS];   /*!< Feasible slopes from archive, swinging door only */
+    trend_slope_t hi[TREND_MAX_CHANNELS];
+
+    uint32_t n_in;              /*!< Records pushed */
+    uint32_t n_out;             /*!< Records kept */
+} trend_compressor_t;
+
+void trend_compress_init(trend_compressor_t *c, trend_mode_t mode, uint8_t n_channels, const int32_t *tolerance);
+
+/* True if c was initialised with this configuration, e.g. after deep sleep */
+bool trend_compress_matches(const trend_compressor_t *c, trend_mode_t mode, uint8_t n_channels, const int32_t *tolerance);
+
+/**
+ * @brief Feed one record
+ *
+ * Timestamps must increase; a timestamp at or before the previous one ends
+ * the series and starts a new one, releasing the pending endpoint first.
+ *
+ * @param out Receives the records to keep, oldest first
+ * @return Number of records written to out, at most TREND_MAX_EMIT
+ */
+int trend_compress_push(trend_compressor_t *c, int64_t t, const int32_t *v, trend_point_t out[TREND_MAX_EMIT]);
+
+/**
+ * @brief Emit the pending endpoint, e.g. before closing a file
+ *
+ * @return true if out was filled
+ */
+bool trend_compress_flush(trend_compressor_t *c, trend_point_t *out);
+
+#endif // TREND_COMPRESS_H
@@ -0,0 +1,79 @@
+#include "ulp_ring.h"
+
+#define ULP_RING_MASK (ULP_RING_CAPACITY - 1)
+
+static inline uint16_t ulp_ring_get(const uint32_t *mem, size_t off)
+{
+    return (uint16_t)(((volatile const uint32_t *)mem)[off] & 0xFFFF);
+}
+
+static inline void ulp_ring_set(uint32_t *mem, size_t off, uint16_t val)
+{
+    ((volatile uint32_t *)mem)[off] = val;
+}
+
+bool ulp_ring_is_valid(const uint32_t *mem)
+{
+    return ulp_ring_get(mem, ULP_RING_OFF_MAGIC) == ULP_RING_MAGIC
+           && ulp_ring_get(mem, ULP_RING_OFF_WR) < ULP_RING_CAPACITY
+           && ulp_ring_get(mem, ULP_RING_OFF_RD) < ULP_RING_CAPACITY;
+}
+
+void ulp_ring_init(uint32_t *mem, uint16_t high_water)
+{
+    if (high_water >= ULP_RING_CAPACITY) {
+        high_water = ULP_RING_CAPACITY - 1;
+    }
+    ulp_ring_set(mem, ULP_RING_OFF_WR, 0);
+    ulp_ring_set(mem, ULP_RING_OFF_RD, 0);
+    ulp_ring_set(mem, ULP_RING_OFF_HIGH_WATER, high_water);
+    ulp_ring_set(mem, ULP_RING_OFF_OVERFLOW, 0);
+    ulp_ring_set(mem, ULP_RING_OFF_MAGIC, ULP_RING_MAGIC);
+}
+
+size_t ulp_ring_fill(const uint32_t *mem)
+{
+    return (ulp_ring_get(mem, ULP_RING_OFF_WR) - ulp_ring_get(mem, ULP_RING_OFF_RD)) & ULP_RING_MASK;
+}
+
+bool ulp_ring_take_overflow(uint32_t *mem)
+{
+    bool overflow = ulp_ring_get(mem, ULP_RING_OFF_OVERFLOW) != 0;
+    ulp_ring_set(mem, ULP_RING_OFF_OVERFLOW, 0);
+    return overflow;
+}
+
+size_t ulp_ring_drain(uint32_t *mem, ulp_ring_sample_t *out, size_t max)
+{
+    // Snapshot the write index once; sets the ULP adds meanwhile wait for the next drain
+    uint16_t wr = ulp_ring_get(mem, ULP_RING_OFF_WR);
+    uint16_t rd = ulp_ring_get(mem, ULP_RING_OFF_RD);
+    size_t n = 0;
+
+    while (rd != wr && n < max) {
+        for (int ch = 0; ch < ULP_RING_CHANNELS; ch++) {
+            out[n].raw[ch] = ulp_ring_get(mem, ULP_RING_OFF_DATA + rd * ULP_RING_CHANNELS + ch);
+        }
+        rd = (rd + 1) & ULP_RING_MASK;
+        n++;
+    }
+    ulp_ring_set(mem, ULP_RING_OFF_RD, rd);
+    return n;
+}
+
+bool ulp_ring_push(uint32_t *mem, const ulp_ring_sample_t *sample)
+{
+    uint16_t wr = ulp_ring_get(mem, ULP_RING_OFF_WR);
+    uint16_t next = (wr + 1) & ULP_RING_MASK;
+
+    if (next == ulp_ring_get(mem, ULP_RING_OFF_RD)) {
+        ulp_ring_set(mem, ULP_RING_OFF_OVERFLOW, 1);
+        return true;
+    }
+    for (int ch = 0; ch < ULP_RING_CHANNELS; ch++) {
+        ulp_ring_set(mem, ULP_RING_OFF_DATA + wr * ULP_RING_CHANNELS + ch, sample->raw[ch]);
+    }
+    ulp_ring_set(mem, ULP_RING_OFF_WR, next);
+
+    return ulp_ring_fill(mem) >= ulp_ring_get(mem, ULP_RING_OFF_HIGH_WATER);
+}
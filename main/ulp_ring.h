@@ -0,0 +1,63 @@
+#ifndef ULP_RING_H
+#define ULP_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Sample ring shared between the ULP coprocessor and the main core.
+ *
+ * The region is an array of 32-bit RTC slow memory words. The ULP can only
+ * store 16 bits per word (the upper half receives the store PC), so every
+ * field and sample occupies the low half of its own word. The ULP owns the
+ * write index, the main core owns the read index, which keeps the ring safe
+ * to drain while the ULP keeps sampling.
+ *
+ * Nothing here depends on ESP-IDF; on Linux the region can be any
+ * uint32_t array standing in for RTC memory.
+ */
+
+#define ULP_RING_CHANNELS 2           /*!< ADC1 channel 3 and 4 per sample set */
+#define ULP_RING_CAPACITY 256         /*!< Sample sets, must be a power of two */
+#define ULP_RING_MAGIC 0x5552         /*!< "UR" */
+
+#define ULP_RING_OFF_MAGIC 0
+#define ULP_RING_OFF_WR 1             /*!< Written by the ULP only */
+#define ULP_RING_OFF_RD 2             /*!< Written by the main core only */
+#define ULP_RING_OFF_HIGH_WATER 3     /*!< Fill level at which the ULP wakes the main core */
+#define ULP_RING_OFF_OVERFLOW 4       /*!< Set by the ULP when a sample set was dropped */
+#define ULP_RING_OFF_DATA 8
+#define ULP_RING_WORDS (ULP_RING_OFF_DATA + ULP_RING_CAPACITY * ULP_RING_CHANNELS)
+
+typedef struct {
+    uint16_t raw[ULP_RING_CHANNELS];
+} ulp_ring_sample_t;
+
+/* True if the header carries the magic and sane indices */
+bool ulp_ring_is_valid(const uint32_t *mem);
+void ulp_ring_init(uint32_t *mem, uint16_t high_water);
+
+size_t ulp_ring_fill(const uint32_t *mem);
+
+/* Returns and clears the overflow flag */
+bool ulp_ring_take_overflow(uint32_t *mem);
+
+/**
+ * @brief Copy out up to max sample sets, oldest first, and free them
+ *
+ * @return Number of sample sets copied
+ */
+size_t ulp_ring_drain(uint32_t *mem, ulp_ring_sample_t *out, size_t max);
+
+/**
+ * @brief Append one sample set from the main core
+ *
+ * Same semantics as the ULP program: drops the set and raises the overflow
+ * flag when the ring is full.
+ *
+ * @return true if the ring has reached its high-water mark
+ */
+bool ulp_ring_push(uint32_t *mem, const ulp_ring_sample_t *sample);
+
+#endif // ULP_RING_H
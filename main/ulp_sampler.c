@@ -0,0 +1,127 @@
+#include "ulp_sampler.h"
+#include "sdkconfig.h"
+
+// Without the sampler the ULP and its RTC slow memory reservation stay off
+#if ULP_SAMPLER_ENABLE
+#if !defined(CONFIG_ULP_COPROC_ENABLED) || !defined(CONFIG_ULP_COPROC_TYPE_FSM)
+#error "ULP_SAMPLER_ENABLE needs the FSM ULP, build with sdkconfig.defaults.ulp"
+#endif
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "adc_read.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_adc/adc_oneshot.h"
+#include "soc/soc.h"
+#include "ulp.h"
+
+#define ULP_RING_BASE ULP_SAMPLER_PROG_WORDS
+#define ULP_RING_MEM (RTC_SLOW_MEM + ULP_RING_BASE)
+
+_Static_assert((ULP_RING_BASE + ULP_RING_WORDS) * 4 <= CONFIG_ULP_COPROC_RESERVE_MEM,
+               "ULP ring does not fit CONFIG_ULP_COPROC_RESERVE_MEM");
+_Static_assert(ULP_RING_CHANNELS == 2, "program addresses slots with a shift by one");
+
+static const char *TAG = "ULP_SAMPLER";
+static adc_oneshot_unit_handle_t ulp_adc_handle;
+
+enum {
+    LBL_FULL,
+    LBL_WAKE,
+    LBL_DONE,
+};
+
+esp_err_t ulp_sampler_start(uint32_t period_s)
+{
+    /* Mirrors ulp_ring_push(). R3 always points at the ring header. */
+    const ulp_insn_t program[] = {
+        I_MOVI(R3, ULP_RING_BASE),
+        I_LD(R0, R3, ULP_RING_OFF_WR),
+        I_LD(R2, R3, ULP_RING_OFF_RD),
+        I_ADDI(R1, R0, 1),
+        I_ANDI(R1, R1, ULP_RING_CAPACITY - 1),
+        I_SUBR(R1, R1, R2),
+        M_BXZ(LBL_FULL),                        // next == rd: ring full
+
+        I_LSHI(R0, R0, 1),                      // R0 = slot address
+        I_ADDR(R0, R0, R3),
+        I_ADC(R1, 0, ADC1_CHANNEL_3),
+        I_ST(R1, R0, ULP_RING_OFF_DATA),
+        I_ADC(R1, 0, ADC1_CHANNEL_2),
+        I_ST(R1, R0, ULP_RING_OFF_DATA + 1),
+
+        I_LD(R0, R3, ULP_RING_OFF_WR),          // publish the set
+        I_ADDI(R0, R0, 1),
+        I_ANDI(R0, R0, ULP_RING_CAPACITY - 1),
+        I_ST(R0, R3, ULP_RING_OFF_WR),
+
+        I_SUBR(R0, R0, R2),                     // fill = (wr - rd) & mask
+        I_ANDI(R0, R0, ULP_RING_CAPACITY - 1),
+        I_LD(R1, R3, ULP_RING_OFF_HIGH_WATER),
+        I_SUBR(R0, R0, R1),
+        M_BXF(LBL_DONE),                        // fill < high water
+        M_BX(LBL_WAKE),
+
+        M_LABEL(LBL_FULL),
+        I_MOVI(R0, 1),
+        I_ST(R0, R3, ULP_RING_OFF_OVERFLOW),
+        M_LABEL(LBL_WAKE),
+        I_WAKE(),
+        M_LABEL(LBL_DONE),
+        I_HALT(),
+    };
+
+    adc_oneshot_unit_init_cfg_t adc_config = {
+        .unit_id = ADC_UNIT_1,
+        .ulp_mode = ADC_ULP_MODE_FSM,
+    };
+    ESP_RETURN_ON_ERROR(adc_oneshot_new_unit(&adc_config, &ulp_adc_handle), TAG, "ADC1 busy");
+
+    adc_oneshot_chan_cfg_t channel_config = {
+        .atten = ADC_ATTEN_DB_12,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    ESP_RETURN_ON_ERROR(adc_oneshot_config_channel(ulp_adc_handle, ADC1_CHANNEL_3, &channel_config), TAG, "ch3");
+    ESP_RETURN_ON_ERROR(adc_oneshot_config_channel(ulp_adc_handle, ADC1_CHANNEL_2, &channel_config), TAG, "ch4");
+
+    size_t size = sizeof(program) / sizeof(ulp_insn_t);
+    ESP_RETURN_ON_ERROR(ulp_process_macros_and_load(0, program, &size), TAG, "load");
+    assert(size <= ULP_SAMPLER_PROG_WORDS);
+
+    // Keep whatever the ULP collected across resets, only a cold boot starts empty
+    if (!ulp_ring_is_valid(ULP_RING_MEM)) {
+        ESP_LOGI(TAG, "Initializing sample ring");
+        ulp_ring_init(ULP_RING_MEM, ULP_SAMPLER_HIGH_WATER);
+    }
+
+    ESP_RETURN_ON_ERROR(ulp_set_wakeup_period(0, period_s * 1000000), TAG, "period");
+    ESP_RETURN_ON_ERROR(esp_sleep_enable_ulp_wakeup(), TAG, "wakeup");
+    printf("Enabling ULP sampling, %" PRIu32 "s\n", period_s);
+
+    return ulp_run(0);
+}
+
+void ulp_sampler_stop(void)
+{
+    ulp_timer_stop();
+    if (ulp_adc_handle) {
+        ESP_ERROR_CHECK(adc_oneshot_del_unit(ulp_adc_handle));
+        ulp_adc_handle = NULL;
+    }
+}
+
+size_t ulp_sampler_drain(ulp_ring_sample_t *out, size_t max)
+{
+    if (!ulp_ring_is_valid(ULP_RING_MEM)) {
+        return 0;
+    }
+    if (ulp_ring_take_overflow(ULP_RING_MEM)) {
+        ESP_LOGW(TAG, "Sample ring overflowed, samples were dropped");
+    }
+    return ulp_ring_drain(ULP_RING_MEM, out, max);
+}
+
+#endif // ULP_SAMPLER_ENABLE
@@ -0,0 +1,35 @@
+#ifndef ULP_SAMPLER_H
+#define ULP_SAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "ulp_ring.h"
+
+/*
+ * Deep-sleep sampling on the ULP FSM coprocessor.
+ *
+ * The ULP wakes on its own timer, converts ADC1 channel 3 and 4 into the
+ * RTC slow memory ring and only wakes the main core once the ring reaches
+ * its high-water mark. The main core then drains the whole batch.
+ *
+ * The ULP and its 4 KiB of RTC slow memory are only configured when the
+ * sampler is used: set ULP_SAMPLER_ENABLE and build with
+ *     idf.py -D SDKCONFIG_DEFAULTS="sdkconfig.defaults;sdkconfig.defaults.ulp" build
+ */
+
+#define ULP_SAMPLER_ENABLE 0                 /*!< Set to 1 to sample from the ULP instead of the 30 s timer */
+#define ULP_SAMPLER_PERIOD_S 30
+#define ULP_SAMPLER_HIGH_WATER (ULP_RING_CAPACITY * 7 / 8)
+#define ULP_SAMPLER_PROG_WORDS 64            /*!< Words reserved for the program, the ring follows */
+
+/* Load the program, claim ADC1 for the ULP and start its timer */
+esp_err_t ulp_sampler_start(uint32_t period_s);
+
+/* Stop the ULP timer and hand ADC1 back to the main core */
+void ulp_sampler_stop(void);
+
+/* Copy out the buffered sample sets, oldest first */
+size_t ulp_sampler_drain(ulp_ring_sample_t *out, size_t max);
+
+#endif // ULP_SAMPLER_H
@@ -0,0 +1,135 @@
+#include "wake_sched.h"
+#include <string.h>
+
+/* First multiple of interval after t */
+static int64_t grid_after(int64_t t, int64_t interval)
+{
+    int64_t q = t / interval;
+    if (t % interval < 0) {
+        q--;
+    }
+    return (q + 1) * interval;
+}
+
+void wake_sched_init(wake_sched_t *sched, int64_t merge_us, int64_t min_sleep_us, int64_t max_lead_us)
+{
+    memset(sched, 0, sizeof(*sched));
+    sched->magic = WAKE_SCHED_MAGIC;
+    sched->merge_us = merge_us;
+    sched->min_sleep_us = min_sleep_us;
+    sched->max_lead_us = max_lead_us;
+}
+
+bool wake_sched_valid(const wake_sched_t *sched, unsigned n_tasks)
+{
+    return sched->magic == WAKE_SCHED_MAGIC && sched->n_tasks == n_tasks;
+}
+
+int wake_sched_add(wake_sched_t *sched, int64_t interval_us)
+{
+    if (sched->n_tasks >= WAKE_SCHED_MAX_TASKS || interval_us <= 0) {
+        return -1;
+    }
+    wake_sched_task_t *task = &sched->tasks[sched->n_tasks];
+    memset(task, 0, sizeof(*task));
+    task->interval_us = interval_us;
+    task->next_us = INT64_MIN;
+    return sched->n_tasks++;
+}
+
+int64_t wake_sched_next_us(const wake_sched_t *sched)
+{
+    int64_t next = INT64_MAX;
+    for (unsigned i = 0; i < sched->n_tasks; i++) {
+        if (sched->tasks[i].next_us < next) {
+            next = sched->tasks[i].next_us;
+        }
+    }
+    return next;
+}
+
+/* Move the lead by part of how late this wake came for the earliest deadline */
+static void wake_sched_track_lead(wake_sched_t *sched, int64_t now_us)
+{
+    int64_t shortest = INT64_MAX;
+    for (unsigned i = 0; i < sched->n_tasks; i++) {
+        if (sched->tasks[i].next_us == INT64_MIN) {
+            return;
+        }
+        if (sched->tasks[i].interval_us < shortest) {
+            shortest = sched->tasks[i].interval_us;
+        }
+    }
+
+    // Far off means a clock step or a wake that was not planned for this deadline
+    int64_t lateness = now_us - wake_sched_next_us(sched);
+    if (lateness > shortest / 2 || lateness < -shortest / 2) {
+        return;
+    }
+    sched->lead_us += lateness / WAKE_SCHED_LEAD_GAIN;
+    if (sched->lead_us > sched->max_lead_us) {
+        sched->lead_us = sched->max_lead_us;
+    }
+    if (sched->lead_us < 0) {
+        sched->lead_us = 0;
+    }
+}
+
+void wake_sched_cover(wake_sched_t *sched, int64_t now_us)
+{
+    int64_t horizon = now_us + sched->merge_us;
+    for (unsigned i = 0; i < sched->n_tasks; i++) {
+        wake_sched_task_t *task = &sched->tasks[i];
+        if (task->next_us == INT64_MIN || task->next_us > horizon) {
+            continue;
+        }
+        int64_t last = grid_after(horizon - task->interval_us, task->interval_us);
+        task->n_covered += (uint32_t)((last - task->next_us) / task->interval_us);
+        task->next_us = last;
+    }
+}
+
+uint32_t wake_sched_due(wake_sched_t *sched, int64_t now_us, bool timer_wake)
+{
+    if (timer_wake) {
+        wake_sched_track_lead(sched, now_us);
+    }
+    sched->n_wakes++;
+
+    int64_t horizon = now_us + sched->merge_us;
+    uint32_t due = 0;
+    for (unsigned i = 0; i < sched->n_tasks; i++) {
+        wake_sched_task_t *task = &sched->tasks[i];
+
+        // The clock was set back, start again from the grid around now
+        if (task->next_us > horizon + task->interval_us) {
+            task->next_us = grid_after(now_us, task->interval_us);
+        }
+        if (task->next_us > horizon) {
+            continue;
+        }
+
+        int64_t next = grid_after(horizon, task->interval_us);
+        if (task->next_us != INT64_MIN) {
+            task->n_missed += (uint32_t)((next - task->next_us) / task->interval_us - 1);
+        }
+        task->next_us = next;
+        task->n_served++;
+        due |= 1u << i;
+    }
+
+    if (due == 0) {
+        sched->n_idle++;
+    }
+    return due;
+}
+
+int64_t wake_sched_sleep_us(const wake_sched_t *sched, int64_t now_us)
+{
+    int64_t next = wake_sched_next_us(sched);
+    if (next == INT64_MAX || next == INT64_MIN) {
+        return sched->min_sleep_us;
+    }
+    int64_t sleep_us = next - sched->lead_us - now_us;
+    return sleep_us > sched->min_sleep_us ? sleep_us : sched->min_sleep_us;
+}
@@ -0,0 +1,92 @@
+#ifndef WAKE_SCHED_H
+#define WAKE_SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Absolute-deadline scheduler for periodic tasks served from deep sleep.
+ *
+ * Each task has an interval and its next deadline, both kept with the
+ * state in RTC memory. Deadlines sit on a fixed grid, whole multiples of
+ * the interval in the caller's time base, so time spent awake never adds
+ * to the period and tasks with commensurate intervals (5 s and 10 min)
+ * fall due on the same wake. A task due within merge_us of a wake is
+ * served on it as well rather than costing a wake of its own.
+ *
+ * The sleep is computed at sleep entry, to the earliest deadline less a
+ * lead that tracks how late timer wakes reach wake_sched_due(): boot
+ * time, and the part of the sleep timer's rate error that repeats from
+ * wake to wake. Deadlines that passed while the device was awake or
+ * asleep for another reason are skipped, not made up, and counted.
+ * Deadlines another sampler met while the main core slept, like the wake
+ * stub, are counted apart and do not count as skipped or late.
+ *
+ * Nothing here depends on ESP-IDF; tools/schedsim.c runs it on the host.
+ */
+
+#define WAKE_SCHED_MAX_TASKS 8
+#define WAKE_SCHED_MAGIC 0x53434844u
+#define WAKE_SCHED_LEAD_GAIN 8          /*!< The lead moves 1/8 of each measured lateness */
+
+typedef struct {
+    int64_t interval_us;
+    int64_t next_us;                    /*!< Deadline, a multiple of interval_us */
+    uint32_t n_served;
+    uint32_t n_missed;                  /*!< Deadlines skipped */
+    uint32_t n_covered;                 /*!< Deadlines another sampler met */
+} wake_sched_task_t;
+
+typedef struct {
+    uint32_t magic;
+    uint8_t n_tasks;
+    int64_t merge_us;
+    int64_t min_sleep_us;
+    int64_t max_lead_us;
+    int64_t lead_us;                    /*!< Wake this much before a deadline */
+    uint32_t n_wakes;
+    uint32_t n_idle;                    /*!< Wakes that found nothing due */
+    wake_sched_task_t tasks[WAKE_SCHED_MAX_TASKS];
+} wake_sched_t;
+
+/**
+ * @brief Start an empty schedule
+ *
+ * @param merge_us     Serve a task this early to share a wake; keep it
+ *                     below the shortest interval
+ * @param min_sleep_us Shortest sleep wake_sched_sleep_us() returns
+ * @param max_lead_us  Upper bound of the learned lead
+ */
+void wake_sched_init(wake_sched_t *sched, int64_t merge_us, int64_t min_sleep_us, int64_t max_lead_us);
+
+/* True if sched holds n_tasks tasks set up by an earlier wake */
+bool wake_sched_valid(const wake_sched_t *sched, unsigned n_tasks);
+
+/* Add a task, due on the first wake; returns its index or -1 if full or interval_us <= 0 */
+int wake_sched_add(wake_sched_t *sched, int64_t interval_us);
+
+/**
+ * @brief Take the tasks due at now_us and move their deadlines on
+ *
+ * @param timer_wake Set when the sleep timer caused this wake, only then
+ *                   does its lateness adjust the lead
+ * @return Bit n set for task n
+ */
+uint32_t wake_sched_due(wake_sched_t *sched, int64_t now_us, bool timer_wake);
+
+/**
+ * @brief Count the deadlines another sampler met up to now_us
+ *
+ * Moves each task on to its last deadline within the merge window of
+ * now_us, which the following wake_sched_due() serves. Call it before wake_sched_due(), and
+ * pass timer_wake false there: the wake was not planned for a deadline.
+ */
+void wake_sched_cover(wake_sched_t *sched, int64_t now_us);
+
+/* Earliest deadline of any task */
+int64_t wake_sched_next_us(const wake_sched_t *sched);
+
+/* Sleep that wakes the device for the earliest deadline, at least min_sleep_us */
+int64_t wake_sched_sleep_us(const wake_sched_t *sched, int64_t now_us);
+
+#endif // WAKE_SCHED_H
@@ -0,0 +1,143 @@
+#include <stdbool.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_wake_stub.h"
+#include "esp_private/esp_clk.h"
+#include "soc/rtc.h"
+#include "soc/rtc_cntl_reg.h"
+#include "soc/sens_reg.h"
+#include "soc/sens_struct.h"
+#include "adc_read.h"
+#include "ulp_sampler.h"
+#include "DS3231.h"
+#include "wake_stub.h"
+
+#if WAKE_STUB_ENABLE && (ULP_SAMPLER_ENABLE || DS3231_ALARM_WAKE_ENABLE)
+#error "The wake stub samples timer wakes, which the ULP sampler and the DS3231 alarm replace"
+#endif
+
+static const char *TAG = "WAKE_STUB";
+
+#define WAKE_STUB_MAGIC 0x57534b31u         /* "WSK1" */
+#define WAKE_STUB_ADC_TIMEOUT 10000         /* Polls of the done flag */
+
+/* RTC counter low word and one conversion per channel, 8 bytes */
+typedef struct {
+    uint32_t ticks;
+    uint16_t raw[WAKE_STUB_CHANNELS];
+} wake_stub_record_t;
+
+// The stub owns wr and the app owns rd; they never run at the same time
+typedef struct {
+    uint32_t magic;
+    uint16_t wr;
+    uint16_t rd;
+    uint16_t n_dropped;                     /*!< Conversions that timed out */
+    wake_stub_record_t records[WAKE_STUB_CAPACITY];
+} wake_stub_ring_t;
+
+_Static_assert((WAKE_STUB_CAPACITY & (WAKE_STUB_CAPACITY - 1)) == 0, "capacity must be a power of two");
+_Static_assert(WAKE_STUB_CHANNELS == 2, "stub converts ADC1_CHANNEL_3 and ADC1_CHANNEL_2");
+
+static RTC_DATA_ATTR wake_stub_ring_t s_ring;
+
+/* Same steps as the ULP's I_ADC, software controlled */
+static RTC_IRAM_ATTR bool wake_stub_adc(uint32_t channel, uint16_t *raw)
+{
+    SENS.sar_meas1_ctrl2.sar1_en_pad = 1 << channel;
+    SENS.sar_meas1_ctrl2.meas1_start_sar = 0;
+    SENS.sar_meas1_ctrl2.meas1_start_sar = 1;
+    for (int i = 0; i < WAKE_STUB_ADC_TIMEOUT; i++) {
+        if (SENS.sar_meas1_ctrl2.meas1_done_sar) {
+            *raw = SENS.sar_meas1_ctrl2.meas1_data_sar;
+            return true;
+        }
+    }
+    return false;
+}
+
+static RTC_IRAM_ATTR void wake_stub_entry(void)
+{
+    esp_default_wake_deep_sleep();
+
+    if (!(esp_wake_stub_get_wakeup_cause() & RTC_TIMER_TRIG_EN) || s_ring.magic != WAKE_STUB_MAGIC) {
+        return;
+    }
+    uint16_t fill = (uint16_t)(s_ring.wr - s_ring.rd);
+    if (fill >= WAKE_STUB_HIGH_WATER) {
+        return;
+    }
+
+    SET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_UPDATE);
+    wake_stub_record_t *rec = &s_ring.records[s_ring.wr & (WAKE_STUB_CAPACITY - 1)];
+    rec->ticks = READ_PERI_REG(RTC_CNTL_TIME_LOW0_REG);
+
+    SENS.sar_power_xpd_sar.force_xpd_sar = SENS_FORCE_XPD_SAR_PU;
+    SENS.sar_meas1_ctrl2.meas1_start_force = 1;
+    SENS.sar_meas1_ctrl2.sar1_en_pad_force = 1;
+    bool ok = wake_stub_adc(ADC1_CHANNEL_3, &rec->raw[0]) &&
+              wake_stub_adc(ADC1_CHANNEL_2, &rec->raw[1]);
+    SENS.sar_power_xpd_sar.force_xpd_sar = SENS_FORCE_XPD_SAR_FSM;
+
+    if (ok) {
+        s_ring.wr++;
+        fill++;
+    } else {
+        s_ring.n_dropped++;
+    }
+    // Boot now rather than on the next wake, so the app finds room left
+    if (fill >= WAKE_STUB_HIGH_WATER) {
+        return;
+    }
+
+    esp_wake_stub_set_wakeup_time(WAKE_STUB_PERIOD_S * 1000000ULL);
+    esp_wake_stub_sleep(&wake_stub_entry);
+}
+
+void wake_stub_arm(void)
+{
+    if (s_ring.magic != WAKE_STUB_MAGIC) {
+        s_ring.wr = 0;
+        s_ring.rd = 0;
+        s_ring.n_dropped = 0;
+        s_ring.magic = WAKE_STUB_MAGIC;
+    }
+    // The ADC1 setup and SAR calibration of this boot live in this domain
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+    esp_set_deep_sleep_wake_stub(&wake_stub_entry);
+}
+
+size_t wake_stub_pending(void)
+{
+    if (s_ring.magic != WAKE_STUB_MAGIC) {
+        return 0;
+    }
+    return (uint16_t)(s_ring.wr - s_ring.rd);
+}
+
+size_t wake_stub_drain(wake_stub_sample_t *out, size_t max)
+{
+    if (s_ring.magic != WAKE_STUB_MAGIC) {
+        return 0;
+    }
+    if (s_ring.n_dropped > 0) {
+        ESP_LOGW(TAG, "%u stub conversions timed out", (unsigned)s_ring.n_dropped);
+        s_ring.n_dropped = 0;
+    }
+
+    uint32_t now = (uint32_t)rtc_time_get();
+    uint32_t cal = esp_clk_slowclk_cal_get();
+    size_t n = 0;
+    while (s_ring.rd != s_ring.wr && n < max) {
+        const wake_stub_record_t *rec = &s_ring.records[s_ring.rd & (WAKE_STUB_CAPACITY - 1)];
+        // Unsigned difference, the low word only wraps after hours
+        out[n].age_us = (int64_t)rtc_time_slowclk_to_us(now - rec->ticks, cal);
+        for (int ch = 0; ch < WAKE_STUB_CHANNELS; ch++) {
+            out[n].raw[ch] = rec->raw[ch];
+        }
+        s_ring.rd++;
+        n++;
+    }
+    return n;
+}
@@ -0,0 +1,46 @@
+#ifndef WAKE_STUB_H
+#define WAKE_STUB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Deep-sleep wake stub sampling on timer wakes without a full boot.
+ *
+ * On a timer wake the ROM runs the stub from RTC fast memory before the
+ * bootloader. It converts ADC1 channel 3 and 4, reads the RTC counter,
+ * appends both to a ring in RTC memory and sleeps again, in well under a
+ * millisecond. Only a wake of another cause, or a ring at its high-water
+ * mark, goes on into the bootloader and app_main, which drains the ring.
+ *
+ * The stub converts through the RTC controller like the ULP sampler, so
+ * it needs ADC1 left configured by the last full boot and the RTC
+ * peripherals powered through sleep; wake_stub_arm() sees to the latter.
+ * Not for use together with ULP_SAMPLER_ENABLE or the DS3231 alarm wake.
+ */
+
+#define WAKE_STUB_ENABLE 0          /*!< Set to 1 to sample timer wakes from the stub */
+#define WAKE_STUB_PERIOD_S 30       /*!< Timer wake period of the stub, and the default sampling interval */
+#define WAKE_STUB_CHANNELS 2
+#define WAKE_STUB_CAPACITY 64       /*!< Records, must be a power of two */
+#define WAKE_STUB_HIGH_WATER (WAKE_STUB_CAPACITY * 3 / 4)
+
+typedef struct {
+    int64_t age_us;                 /*!< Time from the sample to the drain */
+    uint16_t raw[WAKE_STUB_CHANNELS];
+} wake_stub_sample_t;
+
+/* Install the stub and keep the RTC peripherals powered; call right before esp_deep_sleep_start() */
+void wake_stub_arm(void);
+
+/* Records the stub took that were not drained yet */
+size_t wake_stub_pending(void);
+
+/**
+ * @brief Copy out the records the stub took, oldest first, and free them
+ *
+ * @return Number of samples copied
+ */
+size_t wake_stub_drain(wake_stub_sample_t *out, size_t max);
+
+#endif // WAKE_STUB_H
@@ -0,0 +1,250 @@
+/*
+ * Feed synthetic DMA conversion frames through the continuous ADC frame
+ * parser and ring (main/adc_frame.h), check every decoded sample and
+ * report throughput.
+ *
+ * The producer thread does what adc_stream's reader task does on the
+ * target: every DMA frame takes a sequence number, is parsed into a
+ * claimed ring slot and published, or is dropped as an overrun when the
+ * ring is full. The consumer thread plays the logging task. A first run
+ * has the producer wait for a free slot instead, so every frame is
+ * decoded and checked; a second lets it run flat out and drop frames.
+ *
+ * Build on the host:
+ *     cc -O2 -pthread -I../main -o framebench framebench.c ../main/adc_frame.c
+ *
+ * Usage:
+ *     framebench [frames]           default 1000000
+ *
+ * Checks, exit status 1 if any fails:
+ *   - every stored sample has the raw value and channel that was encoded,
+ *     words of channels outside the pattern are counted in n_rejected,
+ *   - timestamp_us puts the first conversion (n_words - 1) periods before
+ *     the frame end, and conv_period_ns is passed through,
+ *   - sequence numbers only increase, no frame is lost while the producer
+ *     waits, and the frames skipped equal the overruns the ring counted
+ *     while it does not.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "adc_frame.h"
+
+/* Two channels at 10 kHz each, as adc_stream would configure them */
+#define BENCH_CHANNEL_A 3
+#define BENCH_CHANNEL_B 4
+#define BENCH_STRAY_CHANNEL 9           /*!< Not in the pattern, must be rejected */
+#define BENCH_STRAY_EVERY 37            /*!< One stray word in this many */
+#define BENCH_CONV_PERIOD_NS 50000
+#define BENCH_FRAME_WORDS ADC_FRAME_MAX_SAMPLES
+#define BENCH_SHORT_EVERY 13            /*!< Every such frame is a short DMA read */
+#define BENCH_SHORT_WORDS 150
+
+static const uint32_t channel_mask = (1u << BENCH_CHANNEL_A) | (1u << BENCH_CHANNEL_B);
+
+static adc_frame_ring_t ring;
+static volatile int producer_done;
+static int producer_waits;              /*!< Retry a full ring rather than drop the frame */
+
+static size_t frame_words(uint32_t seq)
+{
+    return seq % BENCH_SHORT_EVERY == 0 ? BENCH_SHORT_WORDS : BENCH_FRAME_WORDS;
+}
+
+static uint8_t word_channel(uint32_t seq, size_t i)
+{
+    if ((seq * 7 + i) % BENCH_STRAY_EVERY == 0) {
+        return BENCH_STRAY_CHANNEL;
+    }
+    return i % 2 ? BENCH_CHANNEL_B : BENCH_CHANNEL_A;
+}
+
+static uint16_t word_raw(uint32_t seq, size_t i)
+{
+    return (uint16_t)((seq * 2654435761u + i * 40503u) >> 7) & ADC_FRAME_DATA_MASK;
+}
+
+/* End of a frame's last conversion; frames follow each other without gaps */
+static int64_t frame_end_us(uint32_t seq)
+{
+    // Whole cycles of BENCH_SHORT_EVERY frames, then the frames into the cycle
+    uint64_t cycle_words = (uint64_t)(BENCH_SHORT_EVERY - 1) * BENCH_FRAME_WORDS + BENCH_SHORT_WORDS;
+    uint64_t words = (uint64_t)(seq / BENCH_SHORT_EVERY) * cycle_words;
+    for (uint32_t s = seq - seq % BENCH_SHORT_EVERY; s <= seq; s++) {
+        words += frame_words(s);
+    }
+    return 1000000 + (int64_t)(words * BENCH_CONV_PERIOD_NS / 1000);
+}
+
+/* Encode a frame the way the S2 DMA lays it out, TYPE1 little endian */
+static size_t make_dma_frame(uint32_t seq, uint8_t *buf)
+{
+    size_t n_words = frame_words(seq);
+    for (size_t i = 0; i < n_words; i++) {
+        uint16_t word = (uint16_t)(word_raw(seq, i) | (word_channel(seq, i) << ADC_FRAME_CHANNEL_SHIFT));
+        buf[2 * i] = (uint8_t)word;
+        buf[2 * i + 1] = (uint8_t)(word >> 8);
+    }
+    return n_words * ADC_FRAME_BYTES_PER_CONV;
+}
+
+/* Compare a decoded frame with what was encoded for its sequence number */
+static int check_frame(const adc_frame_t *frame)
+{
+    uint32_t seq = frame->seq;
+    size_t n_words = frame_words(seq);
+    size_t stored = 0;
+    size_t rejected = 0;
+
+    for (size_t i = 0; i < n_words; i++) {
+        uint8_t channel = word_channel(seq, i);
+        if (channel == BENCH_STRAY_CHANNEL) {
+            rejected++;
+            continue;
+        }
+        if (stored >= frame->n_samples ||
+            frame->samples[stored].raw != word_raw(seq, i) ||
+            frame->samples[stored].channel != channel) {
+            fprintf(stderr, "frame %" PRIu32 ": sample %zu decoded wrong\n", seq, stored);
+            return -1;
+        }
+        stored++;
+    }
+    if (frame->n_samples != stored || frame->n_rejected != rejected) {
+        fprintf(stderr, "frame %" PRIu32 ": %u samples %u rejected, expected %zu and %zu\n",
+                seq, frame->n_samples, frame->n_rejected, stored, rejected);
+        return -1;
+    }
+
+    int64_t first_us = frame_end_us(seq) - (int64_t)(n_words - 1) * BENCH_CONV_PERIOD_NS / 1000;
+    if (frame->timestamp_us != first_us || frame->conv_period_ns != BENCH_CONV_PERIOD_NS) {
+        fprintf(stderr, "frame %" PRIu32 ": timestamp %" PRId64 " us, expected %" PRId64 " us\n",
+                seq, frame->timestamp_us, first_us);
+        return -1;
+    }
+    return 0;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *producer(void *arg)
+{
+    uint32_t n_frames = *(const uint32_t *)arg;
+    uint8_t buf[BENCH_FRAME_WORDS * ADC_FRAME_BYTES_PER_CONV];
+
+    for (uint32_t seq = 0; seq < n_frames; seq++) {
+        size_t len = make_dma_frame(seq, buf);
+        adc_frame_t *frame = adc_frame_ring_claim(&ring);
+        while (frame == NULL && producer_waits) {
+            sched_yield();
+            frame = adc_frame_ring_claim(&ring);
+        }
+        if (frame == NULL) {
+            // Dropped like adc_stream drops it, the sequence number moves on
+            continue;
+        }
+        adc_frame_parse(frame, buf, len, channel_mask, frame_end_us(seq), BENCH_CONV_PERIOD_NS);
+        frame->seq = seq;
+        adc_frame_ring_publish(&ring);
+    }
+    __atomic_store_n(&producer_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* Producer and consumer threads through the ring, 0 if every check passed */
+static int run_ring(uint32_t n_frames, int waits)
+{
+    int failed = 0;
+    adc_frame_ring_reset(&ring);
+    producer_waits = waits;
+    producer_done = 0;
+    pthread_t thread;
+    double t0 = now_s();
+    if (pthread_create(&thread, NULL, producer, &n_frames) != 0) {
+        perror("pthread_create");
+        return 1;
+    }
+
+    uint32_t received = 0;
+    uint32_t skipped = 0;
+    int64_t last_seq = -1;
+    for (;;) {
+        const adc_frame_t *f = adc_frame_ring_peek(&ring);
+        if (f == NULL) {
+            if (__atomic_load_n(&producer_done, __ATOMIC_ACQUIRE) && adc_frame_ring_peek(&ring) == NULL) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        if ((int64_t)f->seq <= last_seq) {
+            fprintf(stderr, "frame %" PRIu32 " after %" PRId64 "\n", f->seq, last_seq);
+            failed = 1;
+        } else {
+            skipped += (uint32_t)(f->seq - last_seq - 1);
+        }
+        last_seq = f->seq;
+        if (check_frame(f) != 0) {
+            failed = 1;
+        }
+        received++;
+        adc_frame_ring_release(&ring);
+    }
+    pthread_join(thread, NULL);
+    double ring_s = now_s() - t0;
+    skipped += (uint32_t)(n_frames - 1 - last_seq);
+
+    printf("ring, producer %s: %" PRIu32 " frames in %.3f s, %" PRIu32 " decoded, %" PRIu32 " overruns\n",
+           waits ? "waits" : "drops", n_frames, ring_s, received, ring.overruns);
+    if (waits) {
+        // At 20 kHz the target fills 20000 / BENCH_FRAME_WORDS frames per second
+        printf("ring, producer waits: %.0f frames/s, %.0fx the 20 kHz DMA rate\n",
+               n_frames / ring_s, n_frames / ring_s / (1e9 / BENCH_CONV_PERIOD_NS / BENCH_FRAME_WORDS));
+    }
+    if ((waits && skipped != 0) || (!waits && skipped != ring.overruns) || received + skipped != n_frames) {
+        fprintf(stderr, "%" PRIu32 " frames missing, the ring counted %" PRIu32 " overruns\n",
+                skipped, ring.overruns);
+        failed = 1;
+    }
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t n_frames = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 1000000;
+    if (n_frames == 0) {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return 2;
+    }
+
+    // Parser alone, one buffer decoded over and over
+    static uint8_t buf[BENCH_FRAME_WORDS * ADC_FRAME_BYTES_PER_CONV];
+    static adc_frame_t frame;
+    size_t len = make_dma_frame(1, buf);
+    uint64_t words = 0;
+    double t0 = now_s();
+    for (uint32_t i = 0; i < n_frames; i++) {
+        adc_frame_parse(&frame, buf, len, channel_mask, frame_end_us(1), BENCH_CONV_PERIOD_NS);
+        words += len / ADC_FRAME_BYTES_PER_CONV;
+    }
+    double parse_s = now_s() - t0;
+    frame.seq = 1;
+    int failed = check_frame(&frame) != 0;
+    printf("parse: %" PRIu64 " words in %.3f s, %.2f ns/word, %.1f Mwords/s\n",
+           words, parse_s, parse_s * 1e9 / words, words / parse_s / 1e6);
+
+    failed |= run_ring(n_frames, 1);
+    failed |= run_ring(n_frames, 0);
+    return failed;
+}
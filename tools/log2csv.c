@@ -0,0 +1,279 @@
+/*
+ * Convert binary day files (main/log_format.h) to CSV or to column files.
+ *
+ * Build on the host:
+ *     cc -O2 -I../main -o log2csv log2csv.c ../main/log_format.c ../main/crc32.c
+ *
+ * Usage:
+ *     log2csv FILE.dlg...            CSV on stdout, one row per record
+ *     log2csv -c DIR FILE.dlg...     one little-endian column per file in DIR:
+ *                                    time.u32 plus <channel>.i32, and schema.txt
+ *
+ * Records that do not decode are skipped up to the next sync record and
+ * counted on stderr, as are segments whose checkpoint CRC does not match.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "log_format.h"
+#include "crc32.h"
+
+typedef struct {
+    FILE *time;
+    FILE *channel[LOG_FORMAT_MAX_CHANNELS];
+} columns_t;
+
+static uint8_t *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *buf = malloc(size > 0 ? (size_t)size : 1);
+    if (buf == NULL || fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        free(buf);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *len = (size_t)size;
+    return buf;
+}
+
+/* Longest name channel_name() makes: the stored name, '_' and an ADC channel */
+#define CHANNEL_NAME_MAX (LOG_FORMAT_NAME_LEN + 5)
+
+static void base_name(const log_format_header_t *hdr, size_t ch, char *out)
+{
+    memcpy(out, hdr->channels[ch].name, LOG_FORMAT_NAME_LEN);
+    out[LOG_FORMAT_NAME_LEN] = '\0';
+    if (out[0] == '\0') {
+        sprintf(out, "ch%u", hdr->channels[ch].adc_channel);
+    }
+}
+
+/*
+ * Column name of channel ch. Older firmware cut "ADC1 Channel 3" and
+ * "ADC1 Channel 4" to the same 8 bytes, such names get the ADC channel
+ * appended so every column keeps its own name and file.
+ */
+static void channel_name(const log_format_header_t *hdr, size_t ch, char *out)
+{
+    char other[CHANNEL_NAME_MAX];
+    base_name(hdr, ch, out);
+    for (size_t i = 0; i < hdr->n_channels; i++) {
+        base_name(hdr, i, other);
+        if (i != ch && strcmp(out, other) == 0) {
+            sprintf(out + strlen(out), "_%u", hdr->channels[ch].adc_channel);
+            return;
+        }
+    }
+}
+
+/* 0 if the column names of hdr are unique, which -c needs for its files */
+static int check_names(const char *path, const log_format_header_t *hdr)
+{
+    char a[CHANNEL_NAME_MAX];
+    char b[CHANNEL_NAME_MAX];
+    for (size_t i = 0; i < hdr->n_channels; i++) {
+        channel_name(hdr, i, a);
+        for (size_t j = i + 1; j < hdr->n_channels; j++) {
+            channel_name(hdr, j, b);
+            if (strcmp(a, b) == 0) {
+                fprintf(stderr, "%s: channels %zu and %zu are both named \"%s\"\n", path, i, j, a);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void put_le32(FILE *f, uint32_t v)
+{
+    uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+    fwrite(b, 1, sizeof(b), f);
+}
+
+static int open_columns(columns_t *cols, const char *dir, const log_format_header_t *hdr)
+{
+    char path[512];
+    char name[CHANNEL_NAME_MAX];
+
+    snprintf(path, sizeof(path), "%s/schema.txt", dir);
+    FILE *schema = fopen(path, "w");
+    if (schema == NULL) {
+        perror(path);
+        return -1;
+    }
+    fprintf(schema, "time u32 seconds since 1970-01-01 UTC\n");
+
+    snprintf(path, sizeof(path), "%s/time.u32", dir);
+    cols->time = fopen(path, "wb");
+    int ok = cols->time != NULL;
+    for (size_t ch = 0; ok && ch < hdr->n_channels; ch++) {
+        channel_name(hdr, ch, name);
+        fprintf(schema, "%s i32 mV adc_channel=%u atten=%u\n", name,
+                hdr->channels[ch].adc_channel, hdr->channels[ch].atten);
+        snprintf(path, sizeof(path), "%s/%s.i32", dir, name);
+        cols->channel[ch] = fopen(path, "wb");
+        ok = cols->channel[ch] != NULL;
+    }
+    fclose(schema);
+    if (!ok) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+static int convert(const char *path, const char *column_dir, columns_t *cols, int *header_printed)
+{
+    size_t len;
+    uint8_t *buf = read_file(path, &len);
+    if (buf == NULL) {
+        return -1;
+    }
+
+    log_format_header_t hdr;
+    int header_len = log_format_read_header(buf, len, &hdr);
+    if (header_len <= 0) {
+        fprintf(stderr, "%s: not a version 1-%d log file\n", path, LOG_FORMAT_VERSION);
+        free(buf);
+        return -1;
+    }
+    // Preallocated files: past data_end is stale card content
+    if (hdr.data_end != 0 && hdr.data_end < len) {
+        len = hdr.data_end;
+    }
+
+    if (!*header_printed) {
+        char name[CHANNEL_NAME_MAX];
+        if (check_names(path, &hdr) != 0) {
+            free(buf);
+            return -1;
+        }
+        if (column_dir) {
+            if (open_columns(cols, column_dir, &hdr) != 0) {
+                free(buf);
+                return -1;
+            }
+        } else {
+            printf("time");
+            for (size_t ch = 0; ch < hdr.n_channels; ch++) {
+                channel_name(&hdr, ch, name);
+                printf(",%s", name);
+            }
+            printf("\n");
+        }
+        *header_printed = 1;
+    }
+
+    log_format_state_t state;
+    log_format_reset(&state, hdr.n_channels);
+    size_t pos = (size_t)header_len;
+    size_t skipped = 0;
+    size_t segment_start = pos;
+    unsigned long records = 0;
+    unsigned long bad_segments = 0;
+
+    while (pos < len) {
+        uint32_t seq, segment_len, crc;
+        int n = log_format_read_checkpoint(buf + pos, len - pos, &seq, &segment_len, &crc);
+        if (n > 0) {
+            // The records since the previous checkpoint were already printed
+            if (pos - segment_start != segment_len ||
+                crc32_update(0, buf + segment_start, segment_len) != crc) {
+                bad_segments++;
+            }
+            pos += (size_t)n;
+            segment_start = pos;
+            continue;
+        }
+
+        n = log_format_decode(&state, buf + pos, len - pos);
+        if (n <= 0) {
+            // Torn tail (0) or garbage (-1): look for the next sync record
+            long next = log_format_find_sync(buf + pos + 1, len - pos - 1);
+            size_t skip = next < 0 ? len - pos : (size_t)next + 1;
+            skipped += skip;
+            pos += skip;
+            state.synced = false;
+            continue;
+        }
+        pos += (size_t)n;
+        records++;
+
+        if (column_dir) {
+            put_le32(cols->time, state.t);
+            for (size_t ch = 0; ch < hdr.n_channels; ch++) {
+                put_le32(cols->channel[ch], (uint32_t)state.v[ch]);
+            }
+        } else {
+            time_t t = state.t;
+            struct tm tm_t;
+            char stamp[32];
+            gmtime_r(&t, &tm_t);
+            strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm_t);
+            printf("%s", stamp);
+            for (size_t ch = 0; ch < hdr.n_channels; ch++) {
+                printf(",%d", (int)state.v[ch]);
+            }
+            printf("\n");
+        }
+    }
+
+    fprintf(stderr, "%s: %lu records, %lu bytes (%.1f per record)", path, records,
+            (unsigned long)len, records ? (double)(len - header_len) / records : 0.0);
+    if (skipped) {
+        fprintf(stderr, ", %lu bytes skipped", (unsigned long)skipped);
+    }
+    if (bad_segments) {
+        fprintf(stderr, ", %lu segments failed their CRC", bad_segments);
+    }
+    fprintf(stderr, "\n");
+    free(buf);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *column_dir = NULL;
+    int first = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-c") == 0) {
+        column_dir = argv[2];
+        first = 3;
+    }
+    if (first >= argc) {
+        fprintf(stderr, "usage: %s [-c DIR] FILE.dlg...\n", argv[0]);
+        return 2;
+    }
+
+    columns_t cols = {0};
+    int header_printed = 0;
+    int status = 0;
+    for (int i = first; i < argc; i++) {
+        if (convert(argv[i], column_dir, &cols, &header_printed) != 0) {
+            status = 1;
+        }
+    }
+
+    if (cols.time) {
+        fclose(cols.time);
+    }
+    for (size_t ch = 0; ch < LOG_FORMAT_MAX_CHANNELS; ch++) {
+        if (cols.channel[ch]) {
+            fclose(cols.channel[ch]);
+        }
+    }
+    return status;
+}
@@ -0,0 +1,151 @@
+/*
+ * Check phase_stats percentiles (main/phase_stats.h) against exact ones
+ * over runs long enough to halve the histogram hundreds of times.
+ *
+ * Build on the host:
+ *     cc -O2 -I../main -o phasecheck phasecheck.c ../main/phase_stats.c
+ *
+ * Usage:
+ *     phasecheck [samples]          default 4000000 per distribution
+ *
+ * Each distribution is fed to one phase_stats_t and kept in full to sort.
+ * Prints p50, p90 and p99 estimated and exact, and exits with 1 if an
+ * estimate is off by more than a bucket: below 4/5 or above 5/4 of the
+ * exact value.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "phase_stats.h"
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* Uniform in [lo, hi) */
+static uint32_t rng_range(uint32_t lo, uint32_t hi)
+{
+    return lo + (uint32_t)(rng() % (hi - lo));
+}
+
+/* A steady boot time with slow wakes, 1 in tail_in of them, about 15x as long */
+static uint32_t boot_with_tail(unsigned tail_in)
+{
+    if (rng() % tail_in == 0) {
+        return rng_range(2000000, 2500000);
+    }
+    return rng_range(150000, 210000);
+}
+
+static uint32_t gen_tail_2pct(void)
+{
+    return boot_with_tail(50);
+}
+
+static uint32_t gen_tail_half_pct(void)
+{
+    return boot_with_tail(200);
+}
+
+/* Rare outliers, 1 in tail_in, spread over the octaves from 0.5 s to 16 s */
+static uint32_t boot_with_spread_tail(unsigned tail_in)
+{
+    if (rng() % tail_in == 0) {
+        unsigned octave = 19 + (unsigned)(rng() % 5);
+        return rng_range(1u << octave, 2u << octave);
+    }
+    return rng_range(150000, 210000);
+}
+
+static uint32_t gen_spread_3pct(void)
+{
+    return boot_with_spread_tail(33);
+}
+
+static uint32_t gen_spread_third_pct(void)
+{
+    return boot_with_spread_tail(300);
+}
+
+/* Spread evenly over the octaves from 64 us to 1 s */
+static uint32_t gen_log_uniform(void)
+{
+    unsigned octave = 6 + (unsigned)(rng() % 14);
+    return rng_range(1u << octave, 2u << octave);
+}
+
+/* SD mounts: a fast resume or a full probe */
+static uint32_t gen_bimodal(void)
+{
+    return rng() % 3 ? rng_range(8000, 9000) : rng_range(300000, 450000);
+}
+
+static const struct {
+    const char *name;
+    uint32_t (*gen)(void);
+} dists[] = {
+    {"tail_2pct", gen_tail_2pct},
+    {"tail_0.5pct", gen_tail_half_pct},
+    {"spread_3pct", gen_spread_3pct},
+    {"spread_0.3pct", gen_spread_third_pct},
+    {"log_uniform", gen_log_uniform},
+    {"bimodal", gen_bimodal},
+};
+
+static const unsigned pcts[] = {50, 90, 99};
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 4000000;
+    uint32_t *values = malloc(n * sizeof(*values));
+    if (n == 0 || values == NULL) {
+        fprintf(stderr, "usage: %s [samples]\n", argv[0]);
+        return 2;
+    }
+
+    int failed = 0;
+    printf("distribution,pct,estimate_us,exact_us\n");
+    for (size_t d = 0; d < sizeof(dists) / sizeof(dists[0]); d++) {
+        phase_stats_t stats;
+        phase_stats_reset(&stats);
+        for (size_t i = 0; i < n; i++) {
+            values[i] = dists[d].gen();
+            phase_stats_add(&stats, values[i]);
+        }
+        qsort(values, n, sizeof(*values), cmp_u32);
+
+        for (size_t p = 0; p < sizeof(pcts) / sizeof(pcts[0]); p++) {
+            // Same rank rule as phase_stats_percentile()
+            uint32_t exact = values[(n * pcts[p] + 99) / 100 - 1];
+            uint32_t estimate = phase_stats_percentile(&stats, pcts[p]);
+            printf("%s,p%u,%" PRIu32 ",%" PRIu32 "\n", dists[d].name, pcts[p], estimate, exact);
+            if ((uint64_t)estimate * 5 < (uint64_t)exact * 4 || (uint64_t)estimate * 4 > (uint64_t)exact * 5) {
+                fprintf(stderr, "%s: p%u estimate %" PRIu32 " us, exact %" PRIu32 " us\n",
+                        dists[d].name, pcts[p], estimate, exact);
+                failed = 1;
+            }
+        }
+        if (stats.max_us != values[n - 1] || stats.min_us != values[0]) {
+            fprintf(stderr, "%s: min or max wrong\n", dists[d].name);
+            failed = 1;
+        }
+    }
+
+    free(values);
+    return failed;
+}
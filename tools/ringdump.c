@@ -0,0 +1,104 @@
+/*
+ * Print the records of an SD ring image (main/sd_ring.h) as CSV.
+ *
+ * The ring lives inside the contiguous file ring.bin on the card, so a
+ * copy of that file taken with a card reader is a complete image.
+ *
+ * Build on the host:
+ *     cc -O2 -I../main -o ringdump ringdump.c ../main/sd_ring.c ../main/crc32.c
+ *
+ * Usage:
+ *     ringdump [-a] ring.bin      records after the export mark, -a for all
+ *
+ * Records are the ones sd_card_example_main.c writes: t:4 followed by one
+ * int16 mV per channel, little endian.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "sd_ring.h"
+
+static sd_ring_t ring;
+static sd_ring_reader_t reader;
+
+static int file_read(void *ctx, uint32_t sector, void *buf, uint32_t count)
+{
+    FILE *f = ctx;
+    if (fseek(f, (long)sector * SD_RING_SECTOR_SIZE, SEEK_SET) != 0) {
+        return -1;
+    }
+    return fread(buf, SD_RING_SECTOR_SIZE, count, f) == count ? 0 : -1;
+}
+
+static int file_write(void *ctx, uint32_t sector, const void *buf, uint32_t count)
+{
+    // The image is only read, an invalid one is not formatted
+    (void)ctx;
+    (void)sector;
+    (void)buf;
+    (void)count;
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    int all = argc > 2 && strcmp(argv[1], "-a") == 0;
+    if (argc != 2 + all) {
+        fprintf(stderr, "usage: %s [-a] ring.bin\n", argv[0]);
+        return 2;
+    }
+    const char *path = argv[1 + all];
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    sd_ring_dev_t dev = {
+        .ctx = f,
+        .n_sectors = (uint32_t)(ftell(f) / SD_RING_SECTOR_SIZE),
+        .read = file_read,
+        .write = file_write,
+    };
+    if (sd_ring_mount(&ring, &dev, SD_RING_NO_HINT) != 0) {
+        fprintf(stderr, "%s: not a ring image\n", path);
+        fclose(f);
+        return 1;
+    }
+    if (all) {
+        ring.exported_seq = 0;
+    }
+
+    uint8_t rec[SD_RING_RECORD_MAX];
+    size_t len;
+    unsigned long records = 0;
+    int ret;
+    sd_ring_read_begin(&ring, &reader);
+    while ((ret = sd_ring_read_next(&ring, &reader, rec, &len)) > 0) {
+        if (len < 4) {
+            continue;
+        }
+        time_t t = (time_t)((uint32_t)rec[0] | ((uint32_t)rec[1] << 8) |
+                            ((uint32_t)rec[2] << 16) | ((uint32_t)rec[3] << 24));
+        struct tm tm_t;
+        char stamp[32];
+        gmtime_r(&t, &tm_t);
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm_t);
+        printf("%s", stamp);
+        for (size_t i = 4; i + 1 < len; i += 2) {
+            printf(",%d", (int16_t)(rec[i] | (rec[i + 1] << 8)));
+        }
+        printf("\n");
+        records++;
+    }
+
+    fprintf(stderr, "%s: %lu records, %lu segments, head %lu seq %lu, %lu segments skipped\n",
+            path, records, (unsigned long)ring.n_segments, (unsigned long)ring.head,
+            (unsigned long)ring.seq, (unsigned long)reader.n_skipped);
+    fclose(f);
+    return ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Simulate the deep-sleep wake scheduler (main/wake_sched.h) over millions
+ * of wakes and check that it neither drifts nor loses deadlines.
+ *
+ * Each simulated wake boots for a random time, serves the due tasks, stays
+ * awake a while longer (now and then for an SD flush, rarely for longer
+ * than an interval) and sleeps for what wake_sched_sleep_us() asks. The
+ * sleep timer runs off by a slowly wandering rate error, the clock is
+ * stepped by up to a second now and then as clock_sync would, and a few
+ * sleeps end early on a button wake. Some timer wakes go to the wake stub
+ * instead, which samples every SIM_STUB_PERIOD_US for a while before the
+ * next full boot reports its deadlines with wake_sched_cover().
+ *
+ * Build on the host:
+ *     cc -O2 -I../main -o schedsim schedsim.c ../main/wake_sched.c
+ *
+ * Usage:
+ *     schedsim [wakes [seed]]       default 5000000 wakes
+ *
+ * Prints per task how late deadlines were served and how many were
+ * skipped, and exits with 1 if
+ *   - a deadline left the grid of whole intervals, or the deadlines served,
+ *     skipped and covered by the stub do not add up to the time simulated,
+ *   - a deadline was served before the merge window,
+ *   - a deadline was served more than SIM_LATE_BOUND_US late although it
+ *     was reachable from the sleep before: passed while asleep, not while
+ *     awake, on a timer wake after the lead settled,
+ *   - more deadlines were skipped than the long wakes, clock steps and
+ *     button wakes account for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "wake_sched.h"
+
+#define SIM_MERGE_US 200000
+#define SIM_MIN_SLEEP_US 100000
+#define SIM_MAX_LEAD_US 2000000
+#define SIM_LATE_BOUND_US 100000
+#define SIM_BOOT_US 150000              /*!< Reset to the scheduler, plus up to SIM_BOOT_JITTER_US */
+#define SIM_BOOT_JITTER_US 60000
+#define SIM_RATE_PPM 3000               /*!< Largest sleep timer rate error */
+#define SIM_WARMUP_WAKES 16             /*!< Until the lead has settled */
+#define SIM_STUB_PERIOD_US 30000000     /*!< Wake stub sampling period */
+#define SIM_STUB_MAX_WAKES 48           /*!< Stub wakes before its ring boots the app */
+
+static const int64_t intervals_us[] = {
+    5000000,                            /* signals */
+    30000000,
+    600000000,                          /* battery */
+    7000000,                            /* shares few wakes with the others */
+};
+#define SIM_TASKS (sizeof(intervals_us) / sizeof(intervals_us[0]))
+
+static wake_sched_t sched;
+/* Deadlines served more than SIM_LATE_BOUND_US late, and of those the ones
+ * the scheduler could have met: due after the earliest wake it could plan */
+static uint32_t n_late[SIM_TASKS];
+static uint32_t n_missed_wake[SIM_TASKS];
+static int64_t max_late[SIM_TASKS];
+/* First deadline served; every grid point from there is served or skipped */
+static int64_t first_deadline[SIM_TASKS];
+static uint64_t rng_state;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* Uniform in [0, n) */
+static int64_t rng_below(int64_t n)
+{
+    return (int64_t)(rng() % (uint64_t)n);
+}
+
+/* True with probability 1/n */
+static int rng_one_in(int64_t n)
+{
+    return rng_below(n) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long n_wakes = argc > 1 ? strtoul(argv[1], NULL, 0) : 5000000;
+    rng_state = argc > 2 ? strtoull(argv[2], NULL, 0) : 0x9E3779B97F4A7C15ull;
+    if (n_wakes == 0 || rng_state == 0) {
+        fprintf(stderr, "usage: %s [wakes [seed]], both non-zero\n", argv[0]);
+        return 2;
+    }
+
+    wake_sched_init(&sched, SIM_MERGE_US, SIM_MIN_SLEEP_US, SIM_MAX_LEAD_US);
+    for (size_t i = 0; i < SIM_TASKS; i++) {
+        wake_sched_add(&sched, intervals_us[i]);
+    }
+
+    int64_t now = 1700000000LL * 1000000;   /* the device's clock */
+    int64_t rate_ppm = 0;
+    int64_t awake_total = 0;
+    int64_t max_early = 0;
+    unsigned long n_long = 0, n_steps = 0, n_button = 0, n_early = 0, n_stub = 0;
+    int timer_wake = 0;
+    int stub_ran = 0;
+    int64_t reachable = INT64_MAX;      /* deadlines from here on could be met this wake */
+
+    for (unsigned long w = 0; w < n_wakes; w++) {
+        int64_t boot = SIM_BOOT_US + rng_below(SIM_BOOT_JITTER_US);
+        now += boot;
+
+        int64_t before[SIM_TASKS];
+        for (size_t i = 0; i < SIM_TASKS; i++) {
+            before[i] = sched.tasks[i].next_us;
+        }
+        if (stub_ran) {
+            wake_sched_cover(&sched, now);
+        }
+        uint32_t due = wake_sched_due(&sched, now, timer_wake && !stub_ran);
+        for (size_t i = 0; i < SIM_TASKS; i++) {
+            if (!(due & (1u << i))) {
+                continue;
+            }
+            // The deadline served is the last one reached by the merge window
+            int64_t deadline = sched.tasks[i].next_us - intervals_us[i];
+            if (before[i] == INT64_MIN) {
+                first_deadline[i] = deadline;
+                continue;
+            }
+            int64_t error = now - deadline;
+            if (error < -SIM_MERGE_US) {
+                n_early++;
+            }
+            if (-error > max_early) {
+                max_early = -error;
+            }
+            if (error > SIM_LATE_BOUND_US) {
+                n_late[i]++;
+                if (timer_wake && !stub_ran && deadline >= reachable && w >= SIM_WARMUP_WAKES) {
+                    n_missed_wake[i]++;
+                }
+            }
+            if (error > max_late[i]) {
+                max_late[i] = error;
+            }
+        }
+
+        // Awake after sampling: a short write, an SD flush, or rarely far longer
+        int64_t awake = 20000 + rng_below(40000);
+        if (rng_one_in(20)) {
+            awake += 300000 + rng_below(1200000);
+        }
+        if (rng_one_in(20000)) {
+            awake += 20000000 + rng_below(60000000);
+            n_long++;
+        }
+        now += awake;
+        awake_total += boot + awake;
+
+        // clock_sync corrects the clock by up to a second
+        if (rng_one_in(5000)) {
+            now += rng_below(2000001) - 1000000;
+            n_steps++;
+        }
+
+        // The timer rate wanders slowly within SIM_RATE_PPM
+        rate_ppm += rng_below(21) - 10;
+        if (rate_ppm > SIM_RATE_PPM) {
+            rate_ppm = SIM_RATE_PPM;
+        }
+        if (rate_ppm < -SIM_RATE_PPM) {
+            rate_ppm = -SIM_RATE_PPM;
+        }
+
+        reachable = now + SIM_MIN_SLEEP_US + sched.lead_us;
+        int64_t sleep = wake_sched_sleep_us(&sched, now);
+        int64_t slept = sleep + sleep * rate_ppm / 1000000;
+        timer_wake = !rng_one_in(10000);
+        if (!timer_wake) {
+            slept = rng_below(slept) + 1;
+            n_button++;
+        }
+        // The stub takes the timer wakes until its ring fills
+        stub_ran = timer_wake && rng_one_in(200);
+        if (stub_ran) {
+            slept += (1 + rng_below(SIM_STUB_MAX_WAKES)) * SIM_STUB_PERIOD_US;
+            n_stub++;
+        }
+        now += slept;
+    }
+
+    // Deadlines the long wakes, clock steps and button wakes may cost; the
+    // long ones last up to 80 s
+    uint64_t expected_missed = 0;
+    for (size_t i = 0; i < SIM_TASKS; i++) {
+        expected_missed += (n_long * 80000000ull) / (uint64_t)intervals_us[i] + n_long + n_steps + n_button;
+    }
+
+    printf("%lu wakes, %" PRIu32 " found nothing due, lead %lld ms, %lu long wakes, %lu clock steps, %lu button wakes, %lu stub runs\n",
+           n_wakes, sched.n_idle, (long long)(sched.lead_us / 1000), n_long, n_steps, n_button, n_stub);
+    printf("task,interval_s,served,skipped,covered,late,late_avoidable,max_late_ms\n");
+    int failed = 0;
+    uint64_t missed = 0;
+    for (size_t i = 0; i < SIM_TASKS; i++) {
+        const wake_sched_task_t *task = &sched.tasks[i];
+        printf("%zu,%lld,%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%lld\n",
+               i, (long long)(intervals_us[i] / 1000000), task->n_served, task->n_missed, task->n_covered,
+               n_late[i], n_missed_wake[i], (long long)(max_late[i] / 1000));
+        missed += task->n_missed;
+        int64_t span = task->next_us - first_deadline[i];
+        if (task->next_us % intervals_us[i] != 0 ||
+            span / intervals_us[i] != (int64_t)task->n_served + task->n_missed + task->n_covered) {
+            fprintf(stderr, "task %zu: deadlines left the grid, %lld intervals but %" PRIu32 " served, %" PRIu32 " skipped and %" PRIu32 " covered\n",
+                    i, (long long)(span / intervals_us[i]), task->n_served, task->n_missed, task->n_covered);
+            failed = 1;
+        }
+        if (n_missed_wake[i] > 0) {
+            fprintf(stderr, "task %zu: %" PRIu32 " deadlines served late that a planned wake could have met\n",
+                    i, n_missed_wake[i]);
+            failed = 1;
+        }
+    }
+    printf("earliest service %lld ms before its deadline\n", (long long)(max_early / 1000));
+    printf("a fixed %lld s timer would have lost %lld s per day to time awake\n",
+           (long long)(intervals_us[1] / 1000000),
+           (long long)(awake_total / (int64_t)n_wakes * (86400000000LL / intervals_us[1]) / 1000000));
+
+    if (n_early > 0) {
+        fprintf(stderr, "%lu deadlines served before the merge window\n", n_early);
+        failed = 1;
+    }
+    if (missed > expected_missed) {
+        fprintf(stderr, "%" PRIu64 " deadlines skipped, at most %" PRIu64 " expected\n", missed, expected_missed);
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,258 @@
+/*
+ * Check the trend compressor (main/trend_compress.h) on synthetic signals
+ * and measure how much it keeps and how fast it runs.
+ *
+ * Every signal is two channels sampled every 30 s, as the logger writes
+ * them, and is run through both modes at a few tolerances. The series is
+ * flushed every SIM_FLUSH_EVERY records, as the firmware does before each
+ * write to the card, and at the end.
+ *
+ * Build on the host:
+ *     cc -O2 -I../main -o trendcheck trendcheck.c ../main/trend_compress.c -lm
+ *
+ * Usage:
+ *     trendcheck [records [seed]]   default 200000 records per signal
+ *
+ * Prints per signal, mode and tolerance the share of records kept and the
+ * time per pushed record, and exits with 1 if
+ *   - a kept record is not one of the input records, or kept records are
+ *     not in time order, or the first and last input records are not kept,
+ *   - swinging door: linear interpolation between kept records misses an
+ *     input record by more than the tolerance on any channel,
+ *   - deadband: holding the last kept record misses an input record by
+ *     more than the tolerance, or a kept record other than a flushed one
+ *     lies within the tolerance of the record kept before it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include "trend_compress.h"
+
+#define SIM_CHANNELS 2
+#define SIM_STEP_S 30
+#define SIM_FLUSH_EVERY 100             /*!< About one stage of two-channel records */
+
+typedef struct {
+    int64_t t;
+    int32_t v[SIM_CHANNELS];
+    uint32_t index;                     /*!< Of the input record */
+    int flushed;                        /*!< Released by trend_compress_flush() */
+} kept_t;
+
+static uint64_t rng_state = 0x2545F4914F6CDD1Dull;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* Uniform in [-amp, amp] */
+static int32_t noise(int32_t amp)
+{
+    return (int32_t)(rng() % (uint64_t)(2 * amp + 1)) - amp;
+}
+
+/* Daily swing with a little ADC noise, and a battery slowly running down */
+static void gen_daily(size_t i, int32_t *v)
+{
+    v[0] = 1500 + (int32_t)lrint(800 * sin(2 * M_PI * (double)i / 2880)) + noise(3);
+    v[1] = 4100 - (int32_t)(i / 400) + noise(2);
+}
+
+/* Level changes now and then, held between them */
+static void gen_steps(size_t i, int32_t *v)
+{
+    static int32_t level[SIM_CHANNELS] = {1000, 2500};
+    if (i == 0) {
+        level[0] = 1000;
+        level[1] = 2500;
+    }
+    for (int ch = 0; ch < SIM_CHANNELS; ch++) {
+        if (rng() % 500 == 0) {
+            level[ch] = 200 + (int32_t)(rng() % 3000);
+        }
+        v[ch] = level[ch] + noise(1);
+    }
+}
+
+/* Random walk, the worst case for both modes */
+static void gen_walk(size_t i, int32_t *v)
+{
+    static int32_t pos[SIM_CHANNELS];
+    for (int ch = 0; ch < SIM_CHANNELS; ch++) {
+        pos[ch] = i == 0 ? 1500 : pos[ch] + noise(6);
+        v[ch] = pos[ch];
+    }
+}
+
+/* Noise wider than the tolerance on a flat level */
+static void gen_noisy(size_t i, int32_t *v)
+{
+    (void)i;
+    v[0] = 1200 + noise(20);
+    v[1] = 3300 + noise(4);
+}
+
+static const struct {
+    const char *name;
+    void (*gen)(size_t i, int32_t *v);
+} signals[] = {
+    {"daily", gen_daily},
+    {"steps", gen_steps},
+    {"walk", gen_walk},
+    {"noisy", gen_noisy},
+};
+
+static const struct {
+    const char *name;
+    trend_mode_t mode;
+} modes[] = {
+    {"deadband", TREND_MODE_DEADBAND},
+    {"swinging_door", TREND_MODE_SWINGING_DOOR},
+};
+
+static const int32_t tolerances[] = {2, 5, 10, 25};
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Index of the input record at time t, or -1 if none was pushed then */
+static long input_index(int64_t t, size_t n)
+{
+    if (t % SIM_STEP_S != 0 || t < 0 || (size_t)(t / SIM_STEP_S) >= n) {
+        return -1;
+    }
+    return (long)(t / SIM_STEP_S);
+}
+
+static int check(const char *what, trend_mode_t mode, int32_t tol,
+                 int32_t (*in)[SIM_CHANNELS], size_t n, const kept_t *kept, size_t n_kept)
+{
+    if (n_kept == 0 || kept[0].index != 0 || kept[n_kept - 1].index != n - 1) {
+        fprintf(stderr, "%s: first or last record not kept\n", what);
+        return -1;
+    }
+    for (size_t k = 1; k < n_kept; k++) {
+        if (kept[k].t <= kept[k - 1].t) {
+            fprintf(stderr, "%s: kept record %zu out of order\n", what, k);
+            return -1;
+        }
+    }
+
+    for (size_t k = 0; k + 1 < n_kept; k++) {
+        const kept_t *a = &kept[k];
+        const kept_t *b = &kept[k + 1];
+        if (mode == TREND_MODE_DEADBAND && !b->flushed) {
+            int inside = 1;
+            for (int ch = 0; ch < SIM_CHANNELS; ch++) {
+                int64_t dv = (int64_t)b->v[ch] - a->v[ch];
+                inside = inside && dv <= tol && -dv <= tol;
+            }
+            if (inside) {
+                fprintf(stderr, "%s: record %" PRIu32 " kept inside the deadband\n", what, b->index);
+                return -1;
+            }
+        }
+        for (uint32_t i = a->index + 1; i < b->index; i++) {
+            int64_t t = (int64_t)i * SIM_STEP_S;
+            for (int ch = 0; ch < SIM_CHANNELS; ch++) {
+                int64_t dt = b->t - a->t;
+                // Error scaled by dt, so the comparison stays exact
+                int64_t err = mode == TREND_MODE_DEADBAND
+                              ? ((int64_t)in[i][ch] - a->v[ch]) * dt
+                              : ((int64_t)in[i][ch] - a->v[ch]) * dt - ((int64_t)b->v[ch] - a->v[ch]) * (t - a->t);
+                if (err > (int64_t)tol * dt || -err > (int64_t)tol * dt) {
+                    fprintf(stderr, "%s: record %" PRIu32 " channel %d off by %.1f mV\n",
+                            what, i, ch, (double)err / dt);
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+    if (argc > 2) {
+        rng_state = strtoull(argv[2], NULL, 0) | 1;
+    }
+    int32_t (*in)[SIM_CHANNELS] = malloc(n * sizeof(*in));
+    kept_t *kept = malloc((n + 1) * sizeof(*kept));
+    if (n == 0 || in == NULL || kept == NULL) {
+        fprintf(stderr, "usage: %s [records [seed]]\n", argv[0]);
+        return 2;
+    }
+
+    static trend_compressor_t c;
+    int failed = 0;
+    printf("signal,mode,tolerance_mv,kept,records,kept_pct,ns_per_record\n");
+    for (size_t s = 0; s < sizeof(signals) / sizeof(signals[0]); s++) {
+        for (size_t i = 0; i < n; i++) {
+            signals[s].gen(i, in[i]);
+        }
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            for (size_t k = 0; k < sizeof(tolerances) / sizeof(tolerances[0]); k++) {
+                int32_t tol[SIM_CHANNELS] = {tolerances[k], tolerances[k]};
+                trend_compress_init(&c, modes[m].mode, SIM_CHANNELS, tol);
+
+                size_t n_kept = 0;
+                int bad_index = 0;
+                trend_point_t out[TREND_MAX_EMIT];
+                trend_point_t last;
+                double t0 = now_s();
+                for (size_t i = 0; i < n; i++) {
+                    int got = trend_compress_push(&c, (int64_t)i * SIM_STEP_S, in[i], out);
+                    int flushed = (i + 1) % SIM_FLUSH_EVERY == 0 || i + 1 == n;
+                    if (flushed && trend_compress_flush(&c, &last)) {
+                        out[got++] = last;
+                    } else {
+                        flushed = 0;
+                    }
+                    for (int j = 0; j < got; j++) {
+                        long idx = input_index(out[j].t, n);
+                        bad_index |= idx < 0;
+                        for (int ch = 0; idx >= 0 && ch < SIM_CHANNELS; ch++) {
+                            bad_index |= out[j].v[ch] != in[idx][ch];
+                        }
+                        kept[n_kept++] = (kept_t){out[j].t, {out[j].v[0], out[j].v[1]}, (uint32_t)idx,
+                                                  flushed && j == got - 1};
+                    }
+                }
+                double elapsed = now_s() - t0;
+
+                char what[64];
+                snprintf(what, sizeof(what), "%s %s %" PRId32 " mV", signals[s].name, modes[m].name, tolerances[k]);
+                if (bad_index) {
+                    fprintf(stderr, "%s: kept a record that was not pushed\n", what);
+                    failed = 1;
+                } else if (check(what, modes[m].mode, tolerances[k], in, n, kept, n_kept) != 0) {
+                    failed = 1;
+                }
+                if (c.n_in != n || c.n_out != n_kept) {
+                    fprintf(stderr, "%s: counters %" PRIu32 "/%" PRIu32 ", expected %zu/%zu\n",
+                            what, c.n_out, c.n_in, n_kept, n);
+                    failed = 1;
+                }
+                printf("%s,%s,%" PRId32 ",%zu,%zu,%.2f,%.1f\n", signals[s].name, modes[m].name, tolerances[k],
+                       n_kept, n, 100.0 * n_kept / n, elapsed * 1e9 / n);
+            }
+        }
+    }
+
+    free(in);
+    free(kept);
+    return failed;
+}
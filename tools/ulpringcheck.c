@@ -0,0 +1,182 @@
+/*
+ * Check the ULP sample ring (main/ulp_ring.h) against a plain FIFO model.
+ *
+ * A random mix of pushes, standing in for the ULP program, and drains of
+ * random size, standing in for the main core, runs on a uint32_t array in
+ * place of RTC slow memory. After every push the upper half of each word
+ * the ULP stored to is filled with a random value, as the FSM ULP writes
+ * its store PC there.
+ *
+ * Build on the host:
+ *     cc -O2 -I../main -o ulpringcheck ulpringcheck.c ../main/ulp_ring.c
+ *
+ * Usage:
+ *     ulpringcheck [steps [seed]]   default 10000000 steps
+ *
+ * Exits with 1 if
+ *   - a drain returns other sample sets, or in another order, than the
+ *     model, or the fill level differs from it,
+ *   - a push into a full ring is not dropped, or does not raise the
+ *     overflow flag, or the flag is raised without a drop,
+ *   - push does not report the high-water mark exactly when the fill
+ *     level reaches it,
+ *   - ulp_ring_is_valid() accepts a header with a wrong magic or an index
+ *     out of range, or rejects a ring in use.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "ulp_ring.h"
+
+#define CHECK_HIGH_WATER (ULP_RING_CAPACITY * 7 / 8)
+
+static uint32_t mem[ULP_RING_WORDS];
+
+/* Model: the sets in the ring, oldest first */
+static ulp_ring_sample_t model[ULP_RING_CAPACITY];
+static size_t model_head;
+static size_t model_fill;
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* What the ULP leaves in the upper half of the words it stored */
+static void scribble_upper(size_t off)
+{
+    mem[off] = (mem[off] & 0xFFFF) | (uint32_t)(rng() & 0xFFFF) << 16;
+}
+
+static int fail(unsigned long step, const char *what)
+{
+    fprintf(stderr, "step %lu: %s\n", step, what);
+    return 1;
+}
+
+static int check_is_valid(void)
+{
+    static uint32_t copy[ULP_RING_WORDS];
+    int failed = 0;
+
+    memcpy(copy, mem, sizeof(copy));
+    if (!ulp_ring_is_valid(copy)) {
+        failed = fail(0, "ring in use rejected");
+    }
+    copy[ULP_RING_OFF_MAGIC] ^= 1;
+    if (ulp_ring_is_valid(copy)) {
+        failed = fail(0, "wrong magic accepted");
+    }
+
+    memcpy(copy, mem, sizeof(copy));
+    copy[ULP_RING_OFF_WR] = (copy[ULP_RING_OFF_WR] & 0xFFFF0000u) | ULP_RING_CAPACITY;
+    if (ulp_ring_is_valid(copy)) {
+        failed = fail(0, "write index out of range accepted");
+    }
+
+    memcpy(copy, mem, sizeof(copy));
+    copy[ULP_RING_OFF_RD] = 0xFFFF;
+    if (ulp_ring_is_valid(copy)) {
+        failed = fail(0, "read index out of range accepted");
+    }
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long steps = argc > 1 ? strtoul(argv[1], NULL, 0) : 10000000;
+    if (argc > 2) {
+        rng_state = strtoull(argv[2], NULL, 0) | 1;
+    }
+
+    // RTC memory holds garbage after power-on
+    for (size_t i = 0; i < ULP_RING_WORDS; i++) {
+        mem[i] = (uint32_t)rng();
+    }
+    mem[ULP_RING_OFF_MAGIC] = 0;
+    if (ulp_ring_is_valid(mem)) {
+        return fail(0, "uninitialised ring accepted");
+    }
+    ulp_ring_init(mem, CHECK_HIGH_WATER);
+
+    int failed = check_is_valid();
+    unsigned long pushes = 0, drops = 0, drains = 0, drained = 0;
+    int dropped_since_take = 0;
+    // Bursts of pushes and drains, so the ring runs both full and empty
+    int push_bias = 50;
+
+    for (unsigned long step = 1; step <= steps && !failed; step++) {
+        if (step % 4096 == 0) {
+            push_bias = 30 + (int)(rng() % 70);
+        }
+
+        if ((int)(rng() % 100) < push_bias) {
+            ulp_ring_sample_t s = {{(uint16_t)(rng() & 0xFFF), (uint16_t)(rng() & 0xFFF)}};
+            uint16_t wr = (uint16_t)(mem[ULP_RING_OFF_WR] & 0xFFFF);
+            bool high = ulp_ring_push(mem, &s);
+            pushes++;
+            if (model_fill == ULP_RING_CAPACITY - 1) {
+                // One slot always stays free, this set is dropped
+                drops++;
+                dropped_since_take = 1;
+                if (!high || (mem[ULP_RING_OFF_WR] & 0xFFFF) != wr) {
+                    failed = fail(step, "push into a full ring not dropped");
+                }
+                scribble_upper(ULP_RING_OFF_OVERFLOW);
+            } else {
+                model[(model_head + model_fill) % ULP_RING_CAPACITY] = s;
+                model_fill++;
+                if (high != (model_fill >= CHECK_HIGH_WATER)) {
+                    failed = fail(step, "high-water mark reported wrong");
+                }
+                for (int ch = 0; ch < ULP_RING_CHANNELS; ch++) {
+                    scribble_upper(ULP_RING_OFF_DATA + wr * ULP_RING_CHANNELS + ch);
+                }
+                scribble_upper(ULP_RING_OFF_WR);
+            }
+        } else {
+            ulp_ring_sample_t out[ULP_RING_CAPACITY];
+            size_t max = (size_t)(rng() % (ULP_RING_CAPACITY + 1));
+            size_t n = ulp_ring_drain(mem, out, max);
+            size_t expect = model_fill < max ? model_fill : max;
+            drains++;
+            drained += n;
+            if (n != expect) {
+                failed = fail(step, "drain returned the wrong count");
+            }
+            for (size_t i = 0; i < n && !failed; i++) {
+                const ulp_ring_sample_t *m = &model[(model_head + i) % ULP_RING_CAPACITY];
+                if (memcmp(&out[i], m, sizeof(*m)) != 0) {
+                    failed = fail(step, "drain returned another sample set");
+                }
+            }
+            model_head = (model_head + n) % ULP_RING_CAPACITY;
+            model_fill -= n;
+
+            if (ulp_ring_take_overflow(mem) != dropped_since_take) {
+                failed = fail(step, "overflow flag does not match the drops");
+            }
+            dropped_since_take = 0;
+            if (ulp_ring_take_overflow(mem)) {
+                failed = fail(step, "overflow flag not cleared");
+            }
+        }
+
+        if (ulp_ring_fill(mem) != model_fill) {
+            failed = fail(step, "fill level differs from the model");
+        }
+        if (step % 65536 == 0 && !failed) {
+            failed = check_is_valid();
+        }
+    }
+
+    printf("%lu pushes, %lu dropped, %lu drains, %lu sample sets drained\n", pushes, drops, drains, drained);
+    return failed;
+}